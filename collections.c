@@ -25,552 +25,5263 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLECTIONS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define COLLECTIONS_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(COLLECTIONS_SSE2)
+#define COLLECTIONS_PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#define COLLECTIONS_PREFETCH(addr) ((void)(addr))
+#endif
+
+#ifdef COLLECTIONS_LARGE_TABLES
+#define COLLECTIONS_SIZE_MAX ULLONG_MAX
+#else
+#define COLLECTIONS_SIZE_MAX UINT_MAX
+#endif
+
+#if defined(COLLECTIONS_LARGE_TABLES) && !defined(COLLECTIONS_NO_HUGE_PAGES) && defined(__linux__)
+#include <sys/mman.h>
+#ifdef MADV_HUGEPAGE
+#define COLLECTIONS_HUGE_PAGES
+#endif
+#endif
+
+#define COLLECTIONS_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define COLLECTIONS_HUGE_PAGE_MIN_ARRAY_SIZE (8 * COLLECTIONS_HUGE_PAGE_SIZE)
+
+// Large allocations are mmapped by malloc, so the 2MB aligned interior of an array can
+// be backed by transparent huge pages, which saves most TLB misses on random probes of
+// big tables. It's only advice, errors are ignored. Should be called before the array
+// is filled, pages touched before that are collapsed later by khugepaged.
+static void collections_advise_huge_pages(void *ptr, size_t size) {
+#ifdef COLLECTIONS_HUGE_PAGES
+    if (ptr == NULL || size < COLLECTIONS_HUGE_PAGE_MIN_ARRAY_SIZE) {
+        return;
+    }
+    uintptr_t mask = ~(uintptr_t)(COLLECTIONS_HUGE_PAGE_SIZE - 1);
+    uintptr_t start = ((uintptr_t)ptr + COLLECTIONS_HUGE_PAGE_SIZE - 1) & mask;
+    uintptr_t end = ((uintptr_t)ptr + size) & mask;
+    if (end > start) {
+        madvise((void*)start, end - start, MADV_HUGEPAGE);
+    }
+#else
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Allocator
+//-----------------------------------------------------------------------------
+
+// Bump allocator, allocations are taken from the first block in blocks. Ones
+// larger than block_size get a block of their own, chained after it. Reset
+// keeps only the first block made.
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block_ {
+    struct arena_block_ *next;
+    size_t size;
+    size_t used;
+    size_t padding; // keeps data ARENA_ALIGNMENT aligned
+    unsigned char data[];
+} arena_block_t;
+
+typedef struct collections_arena_ {
+    collections_allocator_t allocator;
+    arena_block_t *blocks;
+    arena_block_t *first_block;
+    size_t block_size;
+    size_t used;
+    void *last_alloc; // can be grown in place by realloc
+} collections_arena_t_;
+
+// Private declarations
+static void *malloc_allocator_alloc(void *ctx, size_t size);
+static void *malloc_allocator_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void malloc_allocator_free(void *ctx, void *ptr);
+static void *arena_alloc(void *ctx, size_t size);
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void arena_free(void *ctx, void *ptr);
+static arena_block_t *arena_add_block(collections_arena_t_ *arena, size_t size);
+static void *collections_alloc(const collections_allocator_t *allocator, size_t size);
+static void *collections_calloc(const collections_allocator_t *allocator, size_t count, size_t size);
+static void *collections_realloc(const collections_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size);
+static void collections_free(const collections_allocator_t *allocator, void *ptr);
+
+// Public
+const collections_allocator_t collections_malloc_allocator = {
+    malloc_allocator_alloc,
+    malloc_allocator_realloc,
+    malloc_allocator_free,
+    NULL,
+};
+
+collections_arena_t_* collections_arena_make(size_t block_size) {
+    collections_arena_t_ *arena = malloc(sizeof(collections_arena_t_));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.realloc = arena_realloc;
+    arena->allocator.free = arena_free;
+    arena->allocator.ctx = arena;
+    arena->blocks = NULL;
+    block_size = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    if (block_size > SIZE_MAX - ARENA_ALIGNMENT) {
+        free(arena);
+        return NULL;
+    }
+    // blocks hold whole aligned allocations, so used never passes size
+    arena->block_size = (block_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena->used = 0;
+    arena->last_alloc = NULL;
+    arena->first_block = arena_add_block(arena, arena->block_size);
+    if (arena->first_block == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void collections_arena_destroy(collections_arena_t_ *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    collections_arena_reset(arena);
+    free(arena->first_block);
+    free(arena);
+}
+
+void collections_arena_reset(collections_arena_t_ *arena) {
+    arena_block_t *block = arena->blocks;
+    while (block) {
+        arena_block_t *next = block->next;
+        if (block != arena->first_block) {
+            free(block);
+        }
+        block = next;
+    }
+    arena->blocks = arena->first_block;
+    arena->first_block->next = NULL;
+    arena->first_block->used = 0;
+    arena->used = 0;
+    arena->last_alloc = NULL;
+}
+
+const collections_allocator_t* collections_arena_allocator(collections_arena_t_ *arena) {
+    return &arena->allocator;
+}
+
+size_t collections_arena_used(const collections_arena_t_ *arena) {
+    return arena->used;
+}
+
+// Private definitions
+static void *malloc_allocator_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *malloc_allocator_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    (void)ctx;
+    (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void malloc_allocator_free(void *ctx, void *ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+static void *arena_alloc(void *ctx, size_t size) {
+    collections_arena_t_ *arena = ctx;
+    if (size > SIZE_MAX - ARENA_ALIGNMENT) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena_block_t *block = arena->blocks;
+    if (size > arena->block_size) {
+        // goes behind the current block, which keeps serving small allocations
+        arena_block_t *own_block = malloc(sizeof(arena_block_t) + size);
+        if (own_block == NULL) {
+            return NULL;
+        }
+        own_block->next = block->next;
+        own_block->size = size;
+        own_block->used = size;
+        block->next = own_block;
+        arena->used += size;
+        return own_block->data;
+    }
+    if (block->size - block->used < size) {
+        block = arena_add_block(arena, arena->block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    void *res = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    arena->last_alloc = res;
+    return res;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    collections_arena_t_ *arena = ctx;
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    arena_block_t *block = arena->blocks;
+    size_t offset = (unsigned char*)ptr - block->data;
+    size_t size = new_size <= SIZE_MAX - ARENA_ALIGNMENT ? (new_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1) : SIZE_MAX;
+    if (ptr == arena->last_alloc && size <= block->size - offset) {
+        // the last allocation grows or shrinks in place
+        arena->used = arena->used - (block->used - offset) + size;
+        block->used = offset + size;
+        return ptr;
+    }
+    void *res = arena_alloc(arena, new_size);
+    if (res) {
+        memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return res;
+}
+
+static void arena_free(void *ctx, void *ptr) {
+    (void)ctx;
+    (void)ptr;
+}
+
+static arena_block_t *arena_add_block(collections_arena_t_ *arena, size_t size) {
+    if (size > SIZE_MAX - sizeof(arena_block_t)) {
+        return NULL;
+    }
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    arena->blocks = block;
+    return block;
+}
+
+static void *collections_alloc(const collections_allocator_t *allocator, size_t size) {
+    return allocator->alloc(allocator->ctx, size);
+}
+
+static void *collections_calloc(const collections_allocator_t *allocator, size_t count, size_t size) {
+    if (allocator == &collections_malloc_allocator) {
+        return calloc(count, size); // large blocks come zeroed from the OS without touching them
+    }
+    if (size && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *res = allocator->alloc(allocator->ctx, count * size);
+    if (res) {
+        memset(res, 0, count * size);
+    }
+    return res;
+}
+
+static void *collections_realloc(const collections_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size) {
+    return allocator->realloc(allocator->ctx, ptr, old_size, new_size);
+}
+
+static void collections_free(const collections_allocator_t *allocator, void *ptr) {
+    if (ptr) {
+        allocator->free(allocator->ctx, ptr);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Bloom filter
+//-----------------------------------------------------------------------------
+
+// Split block Bloom filter: a key sets one bit in each 64 bit word of a single
+// cache line sized block, so adding or checking a key touches one cache line.
+// The block is picked by the high half of the mixed hash, bits by the low half.
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_BLOCK_ALIGNMENT 64
+#define BLOOM_DEFAULT_BITS_PER_KEY 12
+
+typedef struct {
+    uint64_t words[BLOOM_BLOCK_WORDS];
+} bloom_block_t;
+
+typedef struct bloom_ {
+    bloom_block_t *blocks; // BLOOM_BLOCK_ALIGNMENT aligned into allocation
+    void *allocation;
+    collections_size_t block_count;
+    collections_size_t count;
+    unsigned long seed;
+    const collections_allocator_t *allocator;
+} bloom_t_;
+
+// Odd multipliers spreading the low half of a hash into a bit index per word.
+static const uint32_t bloom_salts[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+// Private declarations
+static uint64_t bloom_block_count(collections_size_t capacity, unsigned int bits_per_key);
+static uint64_t bloom_mix(unsigned long hash);
+static bloom_block_t *bloom_block(const bloom_t_ *bloom, uint64_t mixed_hash);
+static void bloom_make_masks(uint64_t mixed_hash, uint64_t *out_masks);
+
+// Public
+bloom_t_* bloom_make(collections_size_t capacity, unsigned int bits_per_key) {
+    return bloom_make_with_allocator(capacity, bits_per_key, NULL);
+}
+
+bloom_t_* bloom_make_with_allocator(collections_size_t capacity, unsigned int bits_per_key, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    if (bits_per_key == 0) {
+        bits_per_key = BLOOM_DEFAULT_BITS_PER_KEY;
+    }
+    uint64_t block_count = bloom_block_count(capacity, bits_per_key);
+    if (block_count > UINT32_MAX || block_count > SIZE_MAX / sizeof(bloom_block_t) - 1) {
+        return NULL;
+    }
+    bloom_t_ *bloom = collections_alloc(allocator, sizeof(bloom_t_));
+    if (bloom == NULL) {
+        return NULL;
+    }
+    bloom->allocation = collections_calloc(allocator, (size_t)block_count + 1, sizeof(bloom_block_t));
+    if (bloom->allocation == NULL) {
+        collections_free(allocator, bloom);
+        return NULL;
+    }
+    bloom->allocator = allocator;
+    uintptr_t aligned = ((uintptr_t)bloom->allocation + BLOOM_BLOCK_ALIGNMENT - 1) & ~(uintptr_t)(BLOOM_BLOCK_ALIGNMENT - 1);
+    bloom->blocks = (bloom_block_t*)aligned;
+    bloom->block_count = (collections_size_t)block_count;
+    bloom->count = 0;
+    bloom->seed = dict_hash_default_seed();
+    return bloom;
+}
+
+void bloom_destroy(bloom_t_ *bloom) {
+    if (bloom == NULL) {
+        return;
+    }
+    collections_free(bloom->allocator, bloom->allocation);
+    collections_free(bloom->allocator, bloom);
+}
+
+void bloom_add(bloom_t_ *bloom, const char *key) {
+    bloom_addn(bloom, key, strlen(key));
+}
+
+void bloom_addn(bloom_t_ *bloom, const char *key, size_t len) {
+    bloom_add_hash(bloom, dict_hash_wyhash(key, len, bloom->seed));
+}
+
+void bloom_add_hash(bloom_t_ *bloom, unsigned long hash) {
+    uint64_t mixed_hash = bloom_mix(hash);
+    bloom_block_t *block = bloom_block(bloom, mixed_hash);
+    uint64_t masks[BLOOM_BLOCK_WORDS];
+    bloom_make_masks(mixed_hash, masks);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        block->words[i] |= masks[i];
+    }
+    bloom->count++;
+}
+
+bool bloom_may_contain(const bloom_t_ *bloom, const char *key) {
+    return bloom_may_containn(bloom, key, strlen(key));
+}
+
+bool bloom_may_containn(const bloom_t_ *bloom, const char *key, size_t len) {
+    return bloom_may_contain_hash(bloom, dict_hash_wyhash(key, len, bloom->seed));
+}
+
+bool bloom_may_contain_hash(const bloom_t_ *bloom, unsigned long hash) {
+    uint64_t mixed_hash = bloom_mix(hash);
+    const bloom_block_t *block = bloom_block(bloom, mixed_hash);
+    uint64_t masks[BLOOM_BLOCK_WORDS];
+    bloom_make_masks(mixed_hash, masks);
+#ifdef COLLECTIONS_SSE2
+    __m128i missing = _mm_setzero_si128();
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i += 2) {
+        __m128i mask = _mm_loadu_si128((const __m128i*)&masks[i]);
+        __m128i words = _mm_load_si128((const __m128i*)&block->words[i]);
+        missing = _mm_or_si128(missing, _mm_andnot_si128(words, mask));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xffff;
+#else
+    uint64_t missing = 0;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        missing |= masks[i] & ~block->words[i];
+    }
+    return missing == 0;
+#endif
+}
+
+collections_size_t bloom_count(const bloom_t_ *bloom) {
+    return bloom->count;
+}
+
+size_t bloom_size_bytes(const bloom_t_ *bloom) {
+    return (size_t)bloom->block_count * sizeof(bloom_block_t);
+}
+
+void bloom_clear(bloom_t_ *bloom) {
+    memset(bloom->blocks, 0, (size_t)bloom->block_count * sizeof(bloom_block_t));
+    bloom->count = 0;
+}
+
+// Private definitions
+static uint64_t bloom_block_count(collections_size_t capacity, unsigned int bits_per_key) {
+    uint64_t block_count = ((uint64_t)capacity * bits_per_key + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    return block_count > 0 ? block_count : 1;
+}
+
+static uint64_t bloom_mix(unsigned long hash) {
+    // murmur3 finalizer, dict hashes can be 32 bit (compact dicts) and their low bits pick cells
+    uint64_t h = hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static bloom_block_t *bloom_block(const bloom_t_ *bloom, uint64_t mixed_hash) {
+    return &bloom->blocks[((mixed_hash >> 32) * (uint64_t)bloom->block_count) >> 32];
+}
+
+static void bloom_make_masks(uint64_t mixed_hash, uint64_t *out_masks) {
+    uint32_t key = (uint32_t)mixed_hash;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        out_masks[i] = (uint64_t)1 << ((key * bloom_salts[i]) >> 26);
+    }
+}
 
 //-----------------------------------------------------------------------------
 // Dictionary
 //-----------------------------------------------------------------------------
 
-#define DICT_INVALID_IX UINT_MAX
+#if defined(_WIN32)
+#include <windows.h>
+typedef HANDLE dict_thread_t;
+typedef DWORD dict_thread_result_t;
+#define DICT_THREAD_CALL WINAPI
+#define dict_thread_start(thread, fn, arg) ((*(thread) = CreateThread(NULL, 0, fn, arg, 0, NULL)) != NULL)
+#define dict_thread_join(thread) (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+#else
+#include <pthread.h>
+typedef pthread_t dict_thread_t;
+typedef void *dict_thread_result_t;
+#define DICT_THREAD_CALL
+#define dict_thread_start(thread, fn, arg) (pthread_create(thread, NULL, fn, arg) == 0)
+#define dict_thread_join(thread) pthread_join(thread, NULL)
+#endif
+
+#define DICT_INVALID_IX COLLECTIONS_SIZE_MAX
+
+// cdict looks up under a read lock, so lookup counters are bumped by concurrent readers
+#if defined(_MSC_VER)
+#define dict_counter_inc(counter) InterlockedIncrement64((volatile LONG64*)(counter))
+#define dict_counter_load(counter) ((unsigned long long)InterlockedCompareExchange64((volatile LONG64*)(counter), 0, 0))
+#else
+#define dict_counter_inc(counter) __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED)
+#define dict_counter_load(counter) __atomic_load_n(counter, __ATOMIC_RELAXED)
+#endif
+
+// Every cell has a control byte: DICT_CTRL_EMPTY or DICT_CTRL_FULL with a 7 bit
+// tag of the hash of the key stored in it. Lookups match tags of DICT_GROUP_WIDTH
+// consecutive cells at once and only touch keys on a tag hit. First DICT_GROUP_WIDTH - 1
+// control bytes are mirrored past the end so a group can be loaded at any cell.
+// Control bytes decide which cells are occupied, so cells[] is never initialized
+// and zeroed (calloc'd) control bytes are an empty table.
+#define DICT_GROUP_WIDTH 16
+#define DICT_CTRL_EMPTY 0x00
+#define DICT_CTRL_DELETED 0x01
+#define DICT_CTRL_FULL 0x80
+
+// Number of old table cells migrated by every set/remove while incrementally rehashing.
+// Table doubles when it's max_load_factor full so, for load factors above 1/DICT_REHASH_STEP,
+// migration is done before the next growth.
+#define DICT_REHASH_STEP 32
+
+#define DICT_MIN_CELL_CAPACITY 16
+#define DICT_BLOCK_ALIGNMENT 16
+#define DICT_DEFAULT_MAX_LOAD_FACTOR 0.7f
+
+// Number of keys *_get_many hashes and prefetches before probing any of them.
+#define DICT_BATCH_SIZE 32
+
+// Fewer keys per thread than this aren't worth starting a thread for.
+#define DICT_PARALLEL_MIN_KEYS_PER_THREAD 4096
+
+// Key arena blocks start small and double up to DICT_KEY_BLOCK_MAX_SIZE.
+#define DICT_KEY_BLOCK_MIN_SIZE 4096
+#define DICT_KEY_BLOCK_MAX_SIZE (1024 * 1024)
+
+// Keys shorter than DICT_INLINE_KEY_SIZE are stored NUL padded in their slot, so
+// comparing them doesn't chase a pointer and setting them doesn't allocate.
+// Longer keys are copied out of line, their slot holds a pointer to the copy
+// followed by the key's prefix, which rejects most mismatches without touching
+// the copy. Last byte of a slot is 0 for inline keys. DICT_INLINE_KEY_SIZE
+// has to be larger than sizeof(char*) + 1.
+#ifndef DICT_INLINE_KEY_SIZE
+#define DICT_INLINE_KEY_SIZE 16
+#endif
+#define DICT_KEY_SLOT_OUT_OF_LINE 1
+#define DICT_KEY_SLOT_PREFIX_SIZE (DICT_INLINE_KEY_SIZE - sizeof(char*) - 1)
+
+typedef struct {
+    char data[DICT_INLINE_KEY_SIZE];
+} dict_key_slot_t;
+
+// Range of keys hashed by one thread of dict_build_from_arrays_parallel.
+typedef struct {
+    const dict_t_ *dict;
+    const char * const *keys;
+    size_t *lens;
+    unsigned long *hashes;
+    collections_size_t count;
+} dict_hash_job_t;
+
+typedef struct dict_key_block_ {
+    struct dict_key_block_ *next;
+    size_t size;
+    size_t used;
+    char data[];
+} dict_key_block_t;
 
 typedef struct dict_ {
-    unsigned int *cells;
+    collections_size_t *cells;
+    unsigned char *ctrl;
     unsigned long *hashes;
-    char **keys;
+    // Compact dicts keep cells, ctrl and item arrays in one block (following the dict
+    // itself until the first resize) and hash keys to 32 bits, stored in short_hashes.
+    bool compact;
+    unsigned char *block;
+    uint32_t *short_hashes;
+    dict_key_slot_t *keys;
     void **values;
-    unsigned int *cell_ixs;
-    unsigned int count;
-    unsigned int item_capacity;
-    unsigned int cell_capacity;
+    // When value_size isn't 0 values are stored inline in value_data instead (valdict).
+    unsigned char *value_data;
+    size_t value_size;
+    collections_size_t *cell_ixs;
+    collections_size_t count;
+    collections_size_t item_capacity;
+    collections_size_t cell_capacity;
+    float max_load_factor;
+    unsigned int rehash_count;
+    double rehash_seconds;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    unsigned long long hits;
+    unsigned long long misses;
+#endif
+    dict_hash_fn hash_fn;
+    unsigned long seed;
+    bool incremental_rehash;
+    // Table being migrated from during incremental rehash (NULL otherwise).
+    // Migrated and removed cells are marked with DICT_CTRL_DELETED.
+    collections_size_t *old_cells;
+    unsigned char *old_ctrl;
+    collections_size_t old_cell_capacity;
+    collections_size_t rehash_ix;
+    // When key_arena is set out of line keys are bump allocated in key_blocks
+    // (newest first) instead of allocated one by one. Removed keys only count as waste until compaction.
+    bool key_arena;
+    dict_key_block_t *key_blocks;
+    size_t key_arena_used;
+    size_t key_arena_waste;
+    // Optional filter of hashes of all keys, sized for item_capacity. Removed keys
+    // stay in it until bloom_removed exceeds count and it's rebuilt.
+    bloom_t_ *bloom;
+    collections_size_t bloom_removed;
+    const collections_allocator_t *allocator;
 } dict_t_;
 
-// Private declarations
-static bool dict_init(dict_t_ *hd, unsigned int initial_capacity);
-static void dict_deinit(dict_t_ *hd, bool free_keys);
-static unsigned int dict_get_cell_ix(const dict_t_ *hd,
-                                     const char *key,
-                                     unsigned long hash,
-                                     bool *out_found);
-static unsigned long hash_string(const char *str);
-static bool dict_grow_and_rehash(dict_t_ *hd);
-static bool dict_set_internal(dict_t_ *hd, const char *ckey, char *mkey, void *value);
+// Private declarations
+static dict_t_* dict_make_with_value_size(collections_size_t capacity,
+                                          size_t value_size,
+                                          bool compact,
+                                          const collections_allocator_t *allocator);
+static bool dict_init(dict_t_ *hd, collections_size_t initial_cell_capacity);
+static void dict_deinit(dict_t_ *hd, bool free_keys);
+static size_t dict_compact_layout(dict_t_ *hd, unsigned char *block, collections_size_t cell_capacity, collections_size_t item_capacity);
+static unsigned char *dict_inline_block(dict_t_ *hd);
+static void dict_free_block(dict_t_ *hd, unsigned char *block);
+static bool dict_compact_resize(dict_t_ *hd, collections_size_t cell_capacity, collections_size_t item_capacity);
+static collections_size_t dict_get_cell_ix(const dict_t_ *hd,
+                                           const char *key,
+                                           size_t len,
+                                           unsigned long hash,
+                                           bool *out_found);
+static collections_size_t dict_get_old_cell_ix(const dict_t_ *hd,
+                                               const char *key,
+                                               size_t len,
+                                               unsigned long hash,
+                                               bool *out_found);
+static collections_size_t dict_probe(const dict_t_ *hd,
+                                     const collections_size_t *cells,
+                                     const unsigned char *ctrl,
+                                     collections_size_t cell_capacity,
+                                     const char *key,
+                                     size_t len,
+                                     unsigned long hash,
+                                     bool *out_found);
+static collections_size_t dict_get_item_ix(const dict_t_ *hd, const char *key, size_t len, unsigned long hash);
+static void dict_insert_cell(dict_t_ *hd, collections_size_t item_ix);
+static void dict_remove_cell(dict_t_ *hd, collections_size_t cell_ix);
+static bool dict_item_in_old_table(const dict_t_ *hd, collections_size_t item_ix);
+static unsigned long dict_hash_key(const dict_t_ *dict, const char *key, size_t len);
+static unsigned long dict_key_hash(const dict_t_ *dict, const dict_key_t *key);
+static unsigned long dict_item_hash(const dict_t_ *hd, collections_size_t item_ix);
+static void dict_set_item_hash(dict_t_ *hd, collections_size_t item_ix, unsigned long hash);
+static void wyhash_mum(uint64_t *a, uint64_t *b);
+static uint64_t wyhash_mix(uint64_t a, uint64_t b);
+static unsigned char dict_hash_tag(unsigned long hash);
+static void dict_set_ctrl(dict_t_ *dict, collections_size_t cell_ix, unsigned char ctrl);
+static void ctrl_set(unsigned char *ctrl, collections_size_t cell_capacity, collections_size_t cell_ix, unsigned char value);
+static unsigned int dict_match_group(const unsigned char *ctrl, unsigned char tag, unsigned int *out_empty);
+static unsigned int bit_scan_forward(unsigned int x);
+static bool dict_grow_and_rehash(dict_t_ *hd);
+static bool dict_resize(dict_t_ *hd, collections_size_t cell_capacity, bool incremental);
+static collections_size_t dict_cell_capacity_for(collections_size_t item_capacity, float max_load_factor);
+static bool dict_realloc_items(dict_t_ *hd, collections_size_t item_capacity);
+static void dict_advise_huge_pages(dict_t_ *dict);
+static void dict_rehash_step(dict_t_ *hd, collections_size_t cells_to_migrate);
+static void dict_finish_rehash(dict_t_ *hd);
+static bool dict_rebuild_bloom(dict_t_ *hd);
+static bool dict_set_internal(dict_t_ *hd, const char *key, size_t len, unsigned long hash, const void *value);
+static collections_size_t dict_upsert(dict_t_ *hd, const char *key, size_t len, unsigned long hash, bool *out_added);
+static void dict_store_value(dict_t_ *hd, collections_size_t item_ix, const void *value);
+static bool dict_remove_internal(dict_t_ *hd, const char *key, size_t len, unsigned long hash);
+static void dict_remove_item(dict_t_ *hd, collections_size_t item_ix);
+static bool dict_make_key_slot(dict_t_ *hd, const collections_allocator_t *allocator, const char *key, size_t len, dict_key_slot_t *out_slot);
+static bool dict_key_slot_is_inline(const dict_key_slot_t *slot);
+static char *dict_key_slot_ptr(const dict_key_slot_t *slot);
+static void dict_key_slot_set_ptr(dict_key_slot_t *slot, char *ptr);
+static const char *dict_item_key(const dict_t_ *hd, collections_size_t item_ix);
+static bool dict_item_key_equals(const dict_t_ *hd, collections_size_t item_ix, const char *key, size_t len);
+static bool dict_key_slot_equals(const dict_key_slot_t *slot, const char *key, size_t len);
+static char *dict_copy_key(dict_t_ *hd, const collections_allocator_t *allocator, const char *key, size_t len);
+static void dict_free_key(dict_t_ *hd, const collections_allocator_t *allocator, const dict_key_slot_t *slot);
+static void dict_free_keys(dict_t_ *hd);
+static char *key_arena_alloc(dict_t_ *hd, size_t size);
+static void key_arena_free_blocks(dict_t_ *hd, dict_key_block_t *blocks);
+static void stats_add_displacement(dict_stats_t *stats, unsigned int displacement);
+static bool dict_set_hashed(dict_t_ *hd,
+                            const char * const *keys,
+                            const size_t *lens,
+                            const unsigned long *hashes,
+                            void * const *values,
+                            collections_size_t count);
+static void dict_hash_keys(dict_hash_job_t *job);
+static dict_thread_result_t DICT_THREAD_CALL dict_hash_keys_thread(void *arg);
+
+// Public
+dict_t_* dict_make(void) {
+    return dict_make_with_capacity(0);
+}
+
+dict_t_* dict_make_with_capacity(collections_size_t capacity) {
+    return dict_make_with_value_size(capacity, 0, false, NULL);
+}
+
+dict_t_* dict_make_compact(collections_size_t capacity) {
+    return dict_make_with_value_size(capacity, 0, true, NULL);
+}
+
+dict_t_* dict_make_with_allocator(collections_size_t capacity, const collections_allocator_t *allocator) {
+    return dict_make_with_value_size(capacity, 0, false, allocator);
+}
+
+void dict_destroy(dict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    dict_deinit(dict, true);
+    collections_free(dict->allocator, dict);
+}
+
+void dict_set_hash_fn(dict_t_ *dict, dict_hash_fn hash_fn, unsigned long seed) {
+    dict_finish_rehash(dict);
+    clock_t start = clock();
+    dict->hash_fn = hash_fn;
+    dict->seed = seed;
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        const char *key = dict_item_key(dict, i);
+        dict_set_item_hash(dict, i, dict_hash_key(dict, key, strlen(key)));
+    }
+    memset(dict->ctrl, DICT_CTRL_EMPTY, dict->cell_capacity + DICT_GROUP_WIDTH - 1);
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        dict_insert_cell(dict, i);
+    }
+    dict_rebuild_bloom(dict);
+    dict->rehash_count++;
+    dict->rehash_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+bool dict_reserve(dict_t_ *dict, collections_size_t capacity) {
+    if (capacity <= dict->item_capacity) {
+        return true;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(capacity, dict->max_load_factor);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    return dict_resize(dict, cell_capacity, false);
+}
+
+bool dict_shrink_to_fit(dict_t_ *dict) {
+    collections_size_t cell_capacity = dict_cell_capacity_for(dict->count, dict->max_load_factor);
+    return dict_resize(dict, cell_capacity, false);
+}
+
+bool dict_set_max_load_factor(dict_t_ *dict, float max_load_factor) {
+    if (!(max_load_factor > 0.0f && max_load_factor < 1.0f)) {
+        return false;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(dict->count, max_load_factor);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    float prev_max_load_factor = dict->max_load_factor;
+    dict->max_load_factor = max_load_factor;
+    if (cell_capacity < dict->cell_capacity) {
+        cell_capacity = dict->cell_capacity; // only grows, use dict_shrink_to_fit to shrink
+    }
+    bool succeeded = dict_resize(dict, cell_capacity, false);
+    if (succeeded == false) {
+        dict->max_load_factor = prev_max_load_factor;
+    }
+    return succeeded;
+}
+
+bool dict_set_bloom_filter(dict_t_ *dict, bool enabled) {
+    if (enabled == false) {
+        bloom_destroy(dict->bloom);
+        dict->bloom = NULL;
+        return true;
+    }
+    if (dict->bloom) {
+        return true;
+    }
+    dict->bloom = bloom_make_with_allocator(dict->item_capacity, 0, dict->allocator);
+    if (dict->bloom == NULL) {
+        return false;
+    }
+    return dict_rebuild_bloom(dict);
+}
+
+void dict_set_incremental_rehash(dict_t_ *dict, bool enabled) {
+    if (!enabled) {
+        dict_finish_rehash(dict);
+    }
+    dict->incremental_rehash = enabled;
+}
+
+bool dict_set_key_arena(dict_t_ *dict, bool enabled) {
+    if (enabled == dict->key_arena) {
+        return true;
+    }
+    if (enabled) {
+        dict->key_arena = true;
+        if (dict_compact_keys(dict) == false) {
+            dict->key_arena = false;
+            return false;
+        }
+        return true;
+    }
+    char **keys = collections_calloc(dict->allocator, dict->count + 1, sizeof(char*));
+    if (keys == NULL) {
+        return false;
+    }
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        if (dict_key_slot_is_inline(&dict->keys[i])) {
+            continue;
+        }
+        const char *key = dict_key_slot_ptr(&dict->keys[i]);
+        size_t size = strlen(key) + 1;
+        keys[i] = collections_alloc(dict->allocator, size);
+        if (keys[i] == NULL) {
+            for (collections_size_t j = 0; j < i; j++) {
+                collections_free(dict->allocator, keys[j]);
+            }
+            collections_free(dict->allocator, keys);
+            return false;
+        }
+        memcpy(keys[i], key, size);
+    }
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        if (keys[i]) {
+            dict_key_slot_set_ptr(&dict->keys[i], keys[i]);
+        }
+    }
+    collections_free(dict->allocator, keys);
+    key_arena_free_blocks(dict, dict->key_blocks);
+    dict->key_blocks = NULL;
+    dict->key_arena_used = 0;
+    dict->key_arena_waste = 0;
+    dict->key_arena = false;
+    return true;
+}
+
+bool dict_compact_keys(dict_t_ *dict) {
+    if (dict->key_arena == false) {
+        return true;
+    }
+    size_t live = 0;
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        if (dict_key_slot_is_inline(&dict->keys[i]) == false) {
+            live += strlen(dict_key_slot_ptr(&dict->keys[i])) + 1;
+        }
+    }
+    dict_key_block_t *block = collections_alloc(dict->allocator, sizeof(dict_key_block_t) + live);
+    if (block == NULL) {
+        return false;
+    }
+    block->next = NULL;
+    block->size = live;
+    block->used = 0;
+    // without blocks keys were allocated one by one before the arena got enabled
+    bool keys_in_arena = dict->key_blocks != NULL;
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        if (dict_key_slot_is_inline(&dict->keys[i])) {
+            continue;
+        }
+        char *prev_key = dict_key_slot_ptr(&dict->keys[i]);
+        size_t len = strlen(prev_key) + 1;
+        char *key = block->data + block->used;
+        memcpy(key, prev_key, len);
+        block->used += len;
+        if (keys_in_arena == false) {
+            collections_free(dict->allocator, prev_key);
+        }
+        dict_key_slot_set_ptr(&dict->keys[i], key);
+    }
+    key_arena_free_blocks(dict, dict->key_blocks);
+    dict->key_blocks = block;
+    dict->key_arena_used = live;
+    dict->key_arena_waste = 0;
+    return true;
+}
+
+size_t dict_key_arena_waste(const dict_t_ *dict) {
+    return dict->key_arena_waste;
+}
+
+dict_key_t dict_key_make(const dict_t_ *dict, const char *ptr, size_t len) {
+    dict_key_t key;
+    key.ptr = ptr;
+    key.len = len;
+    key.hash_fn = dict ? dict->hash_fn : dict_hash_wyhash;
+    key.seed = dict ? dict->seed : dict_hash_default_seed();
+    key.hash = key.hash_fn(ptr, len, key.seed);
+    return key;
+}
+
+bool dict_set(dict_t_ *dict, const char *key, void *value) {
+    return dict_setn(dict, key, strlen(key), value);
+}
+
+bool dict_setn(dict_t_ *dict, const char *key, size_t len, void *value) {
+    unsigned long hash = dict_hash_key(dict, key, len);
+    return dict_set_internal(dict, key, len, hash, value);
+}
+
+bool dict_set_with_key(dict_t_ *dict, const dict_key_t *key, void *value) {
+    unsigned long hash = dict_key_hash(dict, key);
+    return dict_set_internal(dict, key->ptr, key->len, hash, value);
+}
+
+dict_t_* dict_build_from_arrays(const char * const *keys, void * const *values, collections_size_t count) {
+    return dict_build_from_arrays_parallel(keys, values, count, 1);
+}
+
+dict_t_* dict_build_from_arrays_parallel(const char * const *keys,
+                                         void * const *values,
+                                         collections_size_t count,
+                                         unsigned int thread_count)
+{
+    dict_t_ *dict = dict_make_with_capacity(count);
+    size_t *lens = malloc((count + 1) * sizeof(size_t));
+    unsigned long *hashes = malloc((count + 1) * sizeof(unsigned long));
+    if (dict == NULL || lens == NULL || hashes == NULL || dict_set_key_arena(dict, true) == false) {
+        goto error;
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    collections_size_t max_thread_count = count / DICT_PARALLEL_MIN_KEYS_PER_THREAD;
+    if (thread_count > max_thread_count) {
+        thread_count = max_thread_count > 0 ? (unsigned int)max_thread_count : 1;
+    }
+    dict_hash_job_t *jobs = malloc(thread_count * (sizeof(dict_hash_job_t) + sizeof(dict_thread_t)));
+    if (jobs == NULL) {
+        goto error;
+    }
+    dict_thread_t *threads = (dict_thread_t*)(jobs + thread_count);
+    unsigned int started_count = 0;
+    for (unsigned int i = 0; i < thread_count; i++) {
+        collections_size_t start = count / thread_count * i;
+        collections_size_t end = i == thread_count - 1 ? count : count / thread_count * (i + 1);
+        jobs[i].dict = dict;
+        jobs[i].keys = keys + start;
+        jobs[i].lens = lens + start;
+        jobs[i].hashes = hashes + start;
+        jobs[i].count = end - start;
+        // first range is hashed by this thread, as are the ones of threads that failed to start
+        if (i > 0 && dict_thread_start(&threads[started_count], dict_hash_keys_thread, &jobs[i])) {
+            started_count++;
+        } else if (i > 0) {
+            dict_hash_keys(&jobs[i]);
+        }
+    }
+    dict_hash_keys(&jobs[0]);
+    for (unsigned int i = 0; i < started_count; i++) {
+        dict_thread_join(threads[i]);
+    }
+    free(jobs);
+    if (dict_set_hashed(dict, keys, lens, hashes, values, count) == false) {
+        goto error;
+    }
+    free(lens);
+    free(hashes);
+    return dict;
+error:
+    dict_destroy(dict);
+    free(lens);
+    free(hashes);
+    return NULL;
+}
+
+bool dict_merge(dict_t_ *dest, const dict_t_ *source) {
+    if (source->count > COLLECTIONS_SIZE_MAX - dest->count
+        || dict_reserve(dest, dest->count + source->count) == false) {
+        return false;
+    }
+    // compact dicts only keep 32 bits of hashes
+    bool reuse_hashes = dest->hash_fn == source->hash_fn
+                     && dest->seed == source->seed
+                     && (source->compact == false || dest->compact);
+    const char *keys[DICT_BATCH_SIZE];
+    size_t lens[DICT_BATCH_SIZE];
+    unsigned long hashes[DICT_BATCH_SIZE];
+    for (collections_size_t start = 0; start < source->count; start += DICT_BATCH_SIZE) {
+        collections_size_t batch_count = (source->count - start) < DICT_BATCH_SIZE ? (source->count - start) : DICT_BATCH_SIZE;
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            keys[i] = dict_item_key(source, start + i);
+            lens[i] = strlen(keys[i]);
+            if (reuse_hashes) {
+                hashes[i] = dict_item_hash(source, start + i);
+                hashes[i] = dest->compact ? (uint32_t)hashes[i] : hashes[i];
+            } else {
+                hashes[i] = dict_hash_key(dest, keys[i], lens[i]);
+            }
+        }
+        if (dict_set_hashed(dest, keys, lens, hashes, source->values + start, batch_count) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void *dict_get(const dict_t_ *dict, const char *key) {
+    return dict_getn(dict, key, strlen(key));
+}
+
+void *dict_getn(const dict_t_ *dict, const char *key, size_t len) {
+    unsigned long hash = dict_hash_key(dict, key, len);
+    collections_size_t item_ix = dict_get_item_ix(dict, key, len, hash);
+    if (item_ix == DICT_INVALID_IX) {
+        return NULL;
+    }
+    return dict->values[item_ix];
+}
+
+void *dict_get_with_key(const dict_t_ *dict, const dict_key_t *key) {
+    unsigned long hash = dict_key_hash(dict, key);
+    collections_size_t item_ix = dict_get_item_ix(dict, key->ptr, key->len, hash);
+    if (item_ix == DICT_INVALID_IX) {
+        return NULL;
+    }
+    return dict->values[item_ix];
+}
+
+collections_size_t dict_get_many(const dict_t_ *dict, const char * const *keys, collections_size_t count, void **out_values) {
+    size_t lens[DICT_BATCH_SIZE];
+    unsigned long hashes[DICT_BATCH_SIZE];
+    collections_size_t item_ixs[DICT_BATCH_SIZE];
+    collections_size_t mask = dict->cell_capacity - 1;
+    collections_size_t found_count = 0;
+    for (collections_size_t start = 0; start < count; start += DICT_BATCH_SIZE) {
+        const char * const *batch = keys + start;
+        collections_size_t batch_count = (count - start) < DICT_BATCH_SIZE ? (count - start) : DICT_BATCH_SIZE;
+        // every stage only issues loads for the next one, so misses of the whole batch overlap
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            lens[i] = strlen(batch[i]);
+            hashes[i] = dict_hash_key(dict, batch[i], lens[i]);
+            COLLECTIONS_PREFETCH(dict->ctrl + (hashes[i] & mask));
+            COLLECTIONS_PREFETCH(dict->cells + (hashes[i] & mask));
+            if (dict->bloom) {
+                COLLECTIONS_PREFETCH(bloom_block(dict->bloom, bloom_mix(hashes[i])));
+            }
+        }
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            collections_size_t cell_ix = hashes[i] & mask;
+            unsigned int empty = 0;
+            unsigned int matches = dict_match_group(dict->ctrl + cell_ix, dict_hash_tag(hashes[i]), &empty);
+            item_ixs[i] = DICT_INVALID_IX;
+            if (matches) {
+                item_ixs[i] = dict->cells[(cell_ix + bit_scan_forward(matches)) & mask];
+                COLLECTIONS_PREFETCH(dict->keys + item_ixs[i]);
+                COLLECTIONS_PREFETCH(dict->values + item_ixs[i]);
+            }
+        }
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            if (item_ixs[i] != DICT_INVALID_IX && lens[i] >= DICT_INLINE_KEY_SIZE
+                && dict_key_slot_is_inline(&dict->keys[item_ixs[i]]) == false) {
+                COLLECTIONS_PREFETCH(dict_key_slot_ptr(&dict->keys[item_ixs[i]]));
+            }
+        }
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            collections_size_t item_ix = dict_get_item_ix(dict, batch[i], lens[i], hashes[i]);
+            if (item_ix == DICT_INVALID_IX) {
+                out_values[start + i] = NULL;
+            } else {
+                out_values[start + i] = dict->values[item_ix];
+                found_count++;
+            }
+        }
+    }
+    return found_count;
+}
+
+void *dict_get_value_at(const dict_t_ *dict, collections_size_t ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict->values[ix];
+}
+
+const char *dict_get_key_at(const dict_t_ *dict, collections_size_t ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict_item_key(dict, ix);
+}
+
+collections_size_t dict_count(const dict_t_ *dict) {
+    if (!dict) {
+        return 0;
+    }
+    return dict->count;
+}
+
+bool dict_remove(dict_t_ *dict, const char *key) {
+    return dict_removen(dict, key, strlen(key));
+}
+
+bool dict_removen(dict_t_ *dict, const char *key, size_t len) {
+    unsigned long hash = dict_hash_key(dict, key, len);
+    return dict_remove_internal(dict, key, len, hash);
+}
+
+bool dict_remove_with_key(dict_t_ *dict, const dict_key_t *key) {
+    unsigned long hash = dict_key_hash(dict, key);
+    return dict_remove_internal(dict, key->ptr, key->len, hash);
+}
+
+void dict_clear(dict_t_ *dict) {
+    dict_free_keys(dict);
+    collections_free(dict->allocator, dict->old_cells);
+    collections_free(dict->allocator, dict->old_ctrl);
+    dict->old_cells = NULL;
+    dict->old_ctrl = NULL;
+    dict->old_cell_capacity = 0;
+    dict->rehash_ix = 0;
+    dict->count = 0;
+    memset(dict->ctrl, DICT_CTRL_EMPTY, dict->cell_capacity + DICT_GROUP_WIDTH - 1);
+    if (dict->bloom) {
+        bloom_clear(dict->bloom);
+        dict->bloom_removed = 0;
+    }
+}
+
+void dict_get_stats(const dict_t_ *dict, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = dict->count;
+    out_stats->item_capacity = dict->item_capacity;
+    out_stats->cell_capacity = dict->cell_capacity;
+    out_stats->load_factor = (float)dict->count / dict->cell_capacity;
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        collections_size_t cell_capacity = dict_item_in_old_table(dict, i) ? dict->old_cell_capacity : dict->cell_capacity;
+        collections_size_t home_ix = dict_item_hash(dict, i) & (cell_capacity - 1);
+        stats_add_displacement(out_stats, (dict->cell_ixs[i] - home_ix) & (cell_capacity - 1));
+    }
+    if (dict->count > 0) {
+        out_stats->avg_displacement /= dict->count;
+    }
+    out_stats->rehash_count = dict->rehash_count;
+    out_stats->rehash_seconds = dict->rehash_seconds;
+
+    out_stats->cells_bytes = dict->cell_capacity * sizeof(*dict->cells);
+    out_stats->ctrl_bytes = dict->cell_capacity + DICT_GROUP_WIDTH - 1;
+    out_stats->keys_bytes = dict->item_capacity * sizeof(*dict->keys);
+    out_stats->values_bytes = dict->item_capacity * (dict->value_size ? dict->value_size : sizeof(*dict->values));
+    out_stats->cell_ixs_bytes = dict->item_capacity * sizeof(*dict->cell_ixs);
+    out_stats->hashes_bytes = dict->item_capacity * (dict->compact ? sizeof(*dict->short_hashes) : sizeof(*dict->hashes));
+    out_stats->bloom_bytes = dict->bloom ? sizeof(bloom_t_) + bloom_size_bytes(dict->bloom) : 0;
+    if (dict->old_cells) {
+        out_stats->old_table_bytes = dict->old_cell_capacity * sizeof(*dict->old_cells)
+                                   + dict->old_cell_capacity + DICT_GROUP_WIDTH - 1;
+    }
+    if (dict->key_arena) {
+        for (dict_key_block_t *block = dict->key_blocks; block; block = block->next) {
+            out_stats->key_data_bytes += sizeof(dict_key_block_t) + block->size;
+        }
+    } else {
+        for (collections_size_t i = 0; i < dict->count; i++) {
+            if (dict_key_slot_is_inline(&dict->keys[i]) == false) {
+                out_stats->key_data_bytes += strlen(dict_key_slot_ptr(&dict->keys[i])) + 1;
+            }
+        }
+    }
+    out_stats->total_bytes = sizeof(dict_t_)
+                           + out_stats->cells_bytes + out_stats->ctrl_bytes
+                           + out_stats->keys_bytes + out_stats->key_data_bytes
+                           + out_stats->values_bytes + out_stats->cell_ixs_bytes
+                           + out_stats->hashes_bytes + out_stats->old_table_bytes
+                           + out_stats->bloom_bytes;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    out_stats->hits = dict_counter_load(&dict->hits);
+    out_stats->misses = dict_counter_load(&dict->misses);
+#endif
+}
+
+unsigned long dict_hash_default_seed(void) {
+    // address of a static differs between processes when ASLR is enabled
+    static const char seed_source = 0;
+    return (unsigned long)wyhash_mix((uintptr_t)&seed_source, 0x2d358dccaa6c78a5ull);
+}
+
+static uint64_t wyhash_read8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wyhash_read4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+unsigned long dict_hash_wyhash(const char *key, size_t len, unsigned long seed) { /* wyhash final4 */
+    static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+    };
+    const unsigned char *p = (const unsigned char*)key;
+    uint64_t s = (uint64_t)seed;
+    s ^= wyhash_mix(s ^ secret[0], secret[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (wyhash_read4(p) << 32) | wyhash_read4(p + mid);
+            b = (wyhash_read4(p + len - 4) << 32) | wyhash_read4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t s1 = s;
+            uint64_t s2 = s;
+            do {
+                s = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ s);
+                s1 = wyhash_mix(wyhash_read8(p + 16) ^ secret[2], wyhash_read8(p + 24) ^ s1);
+                s2 = wyhash_mix(wyhash_read8(p + 32) ^ secret[3], wyhash_read8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            s ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            s = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ s);
+            i -= 16;
+            p += 16;
+        }
+        a = wyhash_read8(p + i - 16);
+        b = wyhash_read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= s;
+    wyhash_mum(&a, &b);
+    return (unsigned long)wyhash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+unsigned long dict_hash_djb2(const char *key, size_t len, unsigned long seed) {
+    unsigned long hash = 5381 + seed;
+    for (size_t i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)key[i]; /* hash * 33 + c */
+    }
+    return hash;
+}
+
+// Private definitions
+static dict_t_* dict_make_with_value_size(collections_size_t capacity,
+                                          size_t value_size,
+                                          bool compact,
+                                          const collections_allocator_t *allocator)
+{
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return NULL;
+    }
+    dict_t_ layout;
+    layout.value_size = value_size;
+    size_t size = sizeof(dict_t_);
+    if (compact) {
+        collections_size_t item_capacity = (collections_size_t)(cell_capacity * (double)DICT_DEFAULT_MAX_LOAD_FACTOR);
+        size = (size_t)(dict_inline_block(&layout) - (unsigned char*)&layout)
+             + dict_compact_layout(&layout, NULL, cell_capacity, item_capacity);
+    }
+    dict_t_ *dict = collections_alloc(allocator, size);
+    if (dict == NULL) {
+        return NULL;
+    }
+    dict->allocator = allocator;
+    dict->max_load_factor = DICT_DEFAULT_MAX_LOAD_FACTOR;
+    dict->hash_fn = dict_hash_wyhash;
+    dict->seed = dict_hash_default_seed();
+    dict->incremental_rehash = false;
+    dict->key_arena = false;
+    dict->value_size = value_size;
+    dict->compact = compact;
+    bool succeeded = dict_init(dict, cell_capacity);
+    if (succeeded == false) {
+        collections_free(dict->allocator, dict);
+        return NULL;
+    }
+    return dict;
+}
+
+static bool dict_init(dict_t_ *dict, collections_size_t initial_cell_capacity) {
+    assert((initial_cell_capacity & (initial_cell_capacity - 1)) == 0);
+    dict->cells = NULL;
+    dict->ctrl = NULL;
+    dict->keys = NULL;
+    dict->values = NULL;
+    dict->value_data = NULL;
+    dict->cell_ixs = NULL;
+    dict->hashes = NULL;
+    dict->block = NULL;
+    dict->short_hashes = NULL;
+    dict->old_cells = NULL;
+    dict->old_ctrl = NULL;
+    dict->old_cell_capacity = 0;
+    dict->rehash_ix = 0;
+    dict->key_blocks = NULL;
+    dict->bloom = NULL;
+    dict->bloom_removed = 0;
+    dict->key_arena_used = 0;
+    dict->key_arena_waste = 0;
+    dict->rehash_count = 0;
+    dict->rehash_seconds = 0;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    dict->hits = 0;
+    dict->misses = 0;
+#endif
+
+    dict->count = 0;
+    dict->cell_capacity = initial_cell_capacity;
+    dict->item_capacity = (collections_size_t)(initial_cell_capacity * (double)dict->max_load_factor);
+
+    if (dict->compact) {
+        // block was allocated along with dict
+        dict_compact_layout(dict, dict_inline_block(dict), dict->cell_capacity, dict->item_capacity);
+        memset(dict->ctrl, DICT_CTRL_EMPTY, dict->cell_capacity + DICT_GROUP_WIDTH - 1);
+        return true;
+    }
+
+    dict->cells = collections_alloc(dict->allocator, dict->cell_capacity * sizeof(*dict->cells));
+    dict->ctrl = collections_calloc(dict->allocator, dict->cell_capacity + DICT_GROUP_WIDTH - 1, 1);
+    dict->keys = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->keys));
+    if (dict->value_size) {
+        dict->value_data = collections_alloc(dict->allocator, dict->item_capacity * dict->value_size);
+    } else {
+        dict->values = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->values));
+    }
+    dict->cell_ixs = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->cell_ixs));
+    dict->hashes = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->hashes));
+    if (dict->cells == NULL
+        || dict->ctrl == NULL
+        || dict->keys == NULL
+        || (dict->values == NULL && dict->value_data == NULL)
+        || dict->cell_ixs == NULL
+        || dict->hashes == NULL) {
+        goto error;
+    }
+    collections_advise_huge_pages(dict->cells, dict->cell_capacity * sizeof(*dict->cells));
+    collections_advise_huge_pages(dict->ctrl, dict->cell_capacity);
+    dict_advise_huge_pages(dict);
+    return true;
+error:
+    collections_free(dict->allocator, dict->cells);
+    collections_free(dict->allocator, dict->ctrl);
+    collections_free(dict->allocator, dict->keys);
+    collections_free(dict->allocator, dict->values);
+    collections_free(dict->allocator, dict->value_data);
+    collections_free(dict->allocator, dict->cell_ixs);
+    collections_free(dict->allocator, dict->hashes);
+    return false;
+}
+
+static void dict_deinit(dict_t_ *dict, bool free_keys) {
+    if (free_keys) {
+        dict_free_keys(dict);
+        key_arena_free_blocks(dict, dict->key_blocks);
+        dict->key_blocks = NULL;
+    }
+    dict->count = 0;
+    dict->item_capacity = 0;
+    dict->cell_capacity = 0;
+
+    if (dict->compact) {
+        dict_free_block(dict, dict->block);
+    } else {
+        collections_free(dict->allocator, dict->cells);
+        collections_free(dict->allocator, dict->ctrl);
+        collections_free(dict->allocator, dict->keys);
+        collections_free(dict->allocator, dict->values);
+        collections_free(dict->allocator, dict->value_data);
+        collections_free(dict->allocator, dict->cell_ixs);
+        collections_free(dict->allocator, dict->hashes);
+    }
+    collections_free(dict->allocator, dict->old_cells);
+    collections_free(dict->allocator, dict->old_ctrl);
+    bloom_destroy(dict->bloom);
+
+    dict->cells = NULL;
+    dict->ctrl = NULL;
+    dict->keys = NULL;
+    dict->values = NULL;
+    dict->value_data = NULL;
+    dict->cell_ixs = NULL;
+    dict->hashes = NULL;
+    dict->block = NULL;
+    dict->short_hashes = NULL;
+    dict->old_cells = NULL;
+    dict->old_ctrl = NULL;
+    dict->bloom = NULL;
+}
+
+// Lays out a compact dict's arrays in block, or only returns the size of the block
+// if it's NULL. Every array starts DICT_BLOCK_ALIGNMENT aligned, values first, so
+// valdict values are as aligned as in a malloc'd array.
+static size_t dict_compact_layout(dict_t_ *dict,
+                                  unsigned char *block,
+                                  collections_size_t cell_capacity,
+                                  collections_size_t item_capacity)
+{
+    size_t value_size = dict->value_size ? dict->value_size : sizeof(void*);
+    size_t sizes[6] = {
+        item_capacity * value_size,
+        item_capacity * sizeof(dict_key_slot_t),
+        cell_capacity * sizeof(collections_size_t),
+        item_capacity * sizeof(collections_size_t),
+        item_capacity * sizeof(uint32_t),
+        cell_capacity + DICT_GROUP_WIDTH - 1,
+    };
+    size_t offsets[6];
+    size_t size = 0;
+    for (int i = 0; i < 6; i++) {
+        offsets[i] = size;
+        size += (sizes[i] + DICT_BLOCK_ALIGNMENT - 1) & ~(size_t)(DICT_BLOCK_ALIGNMENT - 1);
+    }
+    if (block == NULL) {
+        return size;
+    }
+    dict->block = block;
+    if (dict->value_size) {
+        dict->value_data = block + offsets[0];
+    } else {
+        dict->values = (void**)(block + offsets[0]);
+    }
+    dict->keys = (dict_key_slot_t*)(block + offsets[1]);
+    dict->cells = (collections_size_t*)(block + offsets[2]);
+    dict->cell_ixs = (collections_size_t*)(block + offsets[3]);
+    dict->short_hashes = (uint32_t*)(block + offsets[4]);
+    dict->ctrl = block + offsets[5];
+    return size;
+}
+
+static unsigned char *dict_inline_block(dict_t_ *dict) {
+    size_t offset = (sizeof(dict_t_) + DICT_BLOCK_ALIGNMENT - 1) & ~(size_t)(DICT_BLOCK_ALIGNMENT - 1);
+    return (unsigned char*)dict + offset;
+}
+
+static void dict_free_block(dict_t_ *dict, unsigned char *block) {
+    if (block != dict_inline_block(dict)) {
+        collections_free(dict->allocator, block);
+    }
+}
+
+static bool dict_compact_resize(dict_t_ *dict, collections_size_t new_cell_capacity, collections_size_t item_capacity) {
+    clock_t start = clock();
+    dict_t_ old = *dict;
+    unsigned char *block = collections_alloc(dict->allocator, dict_compact_layout(dict, NULL, new_cell_capacity, item_capacity));
+    if (block == NULL) {
+        return false;
+    }
+    dict_compact_layout(dict, block, new_cell_capacity, item_capacity);
+    dict->cell_capacity = new_cell_capacity;
+    dict->item_capacity = item_capacity;
+    memcpy(dict->keys, old.keys, dict->count * sizeof(*dict->keys));
+    if (dict->value_size) {
+        memcpy(dict->value_data, old.value_data, dict->count * dict->value_size);
+    } else {
+        memcpy(dict->values, old.values, dict->count * sizeof(*dict->values));
+    }
+    memcpy(dict->short_hashes, old.short_hashes, dict->count * sizeof(*dict->short_hashes));
+    memset(dict->ctrl, DICT_CTRL_EMPTY, dict->cell_capacity + DICT_GROUP_WIDTH - 1);
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        dict_insert_cell(dict, i);
+    }
+    dict_free_block(dict, old.block);
+    dict_rebuild_bloom(dict);
+    dict->rehash_count++;
+    dict->rehash_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    return true;
+}
+
+static collections_size_t dict_get_cell_ix(const dict_t_ *dict,
+                                           const char *key,
+                                           size_t len,
+                                           unsigned long hash,
+                                           bool *out_found)
+{
+    return dict_probe(dict, dict->cells, dict->ctrl, dict->cell_capacity, key, len, hash, out_found);
+}
+
+static collections_size_t dict_get_old_cell_ix(const dict_t_ *dict,
+                                               const char *key,
+                                               size_t len,
+                                               unsigned long hash,
+                                               bool *out_found)
+{
+    return dict_probe(dict, dict->old_cells, dict->old_ctrl, dict->old_cell_capacity, key, len, hash, out_found);
+}
+
+static collections_size_t dict_probe(const dict_t_ *dict,
+                                     const collections_size_t *cells,
+                                     const unsigned char *ctrl,
+                                     collections_size_t cell_capacity,
+                                     const char *key,
+                                     size_t len,
+                                     unsigned long hash,
+                                     bool *out_found)
+{
+    *out_found = false;
+    collections_size_t mask = cell_capacity - 1;
+    collections_size_t cell_ix = hash & mask;
+    unsigned char tag = dict_hash_tag(hash);
+    for (collections_size_t i = 0; i < cell_capacity; i += DICT_GROUP_WIDTH) {
+        collections_size_t group_ix = (cell_ix + i) & mask;
+        unsigned int empty = 0;
+        unsigned int matches = dict_match_group(ctrl + group_ix, tag, &empty);
+        if (empty) {
+            // probe sequence ends at first empty cell, later matches belong to other chains
+            matches &= (1u << bit_scan_forward(empty)) - 1;
+        }
+        while (matches) {
+            collections_size_t ix = (group_ix + bit_scan_forward(matches)) & mask;
+            if (dict_item_key_equals(dict, cells[ix], key, len)) {
+                *out_found = true;
+                return ix;
+            }
+            matches &= matches - 1;
+        }
+        if (empty) {
+            return (group_ix + bit_scan_forward(empty)) & mask;
+        }
+    }
+    return DICT_INVALID_IX;
+}
+
+static collections_size_t dict_get_item_ix(const dict_t_ *dict, const char *key, size_t len, unsigned long hash) {
+    collections_size_t item_ix = DICT_INVALID_IX;
+    bool found = false;
+    if (dict->bloom) {
+        // the first group loads while the filter is checked, so hits don't pay for both in turn
+        COLLECTIONS_PREFETCH(dict->ctrl + (hash & (dict->cell_capacity - 1)));
+    }
+    if (dict->bloom == NULL || bloom_may_contain_hash(dict->bloom, hash)) {
+        collections_size_t cell_ix = dict_get_cell_ix(dict, key, len, hash, &found);
+        if (found) {
+            item_ix = dict->cells[cell_ix];
+        } else if (dict->old_cells) {
+            cell_ix = dict_get_old_cell_ix(dict, key, len, hash, &found);
+            if (found) {
+                item_ix = dict->old_cells[cell_ix];
+            }
+        }
+    }
+#ifdef COLLECTIONS_DICT_COUNTERS
+    // counters aren't part of dict's observable state, so they're updated through const
+    if (found) {
+        dict_counter_inc(&((dict_t_*)dict)->hits);
+    } else {
+        dict_counter_inc(&((dict_t_*)dict)->misses);
+    }
+#endif
+    return item_ix;
+}
+
+static void dict_insert_cell(dict_t_ *dict, collections_size_t item_ix) {
+    // item's key is known to be absent, so only empty cells need to be matched
+    unsigned long hash = dict_item_hash(dict, item_ix);
+    collections_size_t mask = dict->cell_capacity - 1;
+    collections_size_t group_ix = hash & mask;
+    unsigned int empty = 0;
+    dict_match_group(dict->ctrl + group_ix, 0, &empty);
+    while (empty == 0) {
+        group_ix = (group_ix + DICT_GROUP_WIDTH) & mask;
+        dict_match_group(dict->ctrl + group_ix, 0, &empty);
+    }
+    collections_size_t cell_ix = (group_ix + bit_scan_forward(empty)) & mask;
+    dict->cells[cell_ix] = item_ix;
+    dict_set_ctrl(dict, cell_ix, dict_hash_tag(hash));
+    dict->cell_ixs[item_ix] = cell_ix;
+}
+
+static void dict_remove_cell(dict_t_ *dict, collections_size_t cell_ix) {
+    collections_size_t i = cell_ix;
+    collections_size_t j = i;
+    for (collections_size_t x = 0; x < (dict->cell_capacity - 1); x++) {
+        j = (j + 1) & (dict->cell_capacity - 1);
+        if (dict->ctrl[j] == DICT_CTRL_EMPTY) {
+            break;
+        }
+        collections_size_t k = dict_item_hash(dict, dict->cells[j]) & (dict->cell_capacity - 1);
+        if ((j > i && (k <= i || k > j))
+            || (j < i && (k <= i && k > j))) {
+            dict->cell_ixs[dict->cells[j]] = i;
+            dict->cells[i] = dict->cells[j];
+            dict_set_ctrl(dict, i, dict->ctrl[j]);
+            i = j;
+        }
+    }
+    dict_set_ctrl(dict, i, DICT_CTRL_EMPTY);
+}
+
+static bool dict_item_in_old_table(const dict_t_ *dict, collections_size_t item_ix) {
+    if (dict->old_cells == NULL) {
+        return false;
+    }
+    // an item is referenced by exactly one live cell, in either the old or the new table
+    collections_size_t cell_ix = dict->cell_ixs[item_ix];
+    return cell_ix < dict->old_cell_capacity
+        && (dict->old_ctrl[cell_ix] & DICT_CTRL_FULL)
+        && dict->old_cells[cell_ix] == item_ix;
+}
+
+static unsigned long dict_hash_key(const dict_t_ *dict, const char *key, size_t len) {
+    unsigned long hash = dict->hash_fn(key, len, dict->seed);
+    return dict->compact ? (uint32_t)hash : hash;
+}
+
+static unsigned long dict_key_hash(const dict_t_ *dict, const dict_key_t *key) {
+    if (key->hash_fn == dict->hash_fn && key->seed == dict->seed) {
+        return dict->compact ? (uint32_t)key->hash : key->hash;
+    }
+    return dict_hash_key(dict, key->ptr, key->len);
+}
+
+static unsigned long dict_item_hash(const dict_t_ *dict, collections_size_t item_ix) {
+    return dict->compact ? dict->short_hashes[item_ix] : dict->hashes[item_ix];
+}
+
+static void dict_set_item_hash(dict_t_ *dict, collections_size_t item_ix, unsigned long hash) {
+    if (dict->compact) {
+        dict->short_hashes[item_ix] = (uint32_t)hash;
+    } else {
+        dict->hashes[item_ix] = hash;
+    }
+}
+
+static void wyhash_mum(uint64_t *a, uint64_t *b) { // 64x64 -> 128 bit multiply
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    wyhash_mum(&a, &b);
+    return a ^ b;
+}
+
+static unsigned char dict_hash_tag(unsigned long hash) {
+    // multiplicative mix so the tag doesn't repeat the low bits used for the cell index
+    return DICT_CTRL_FULL | (unsigned char)(((uint64_t)hash * 0x9e3779b97f4a7c15ull) >> 57);
+}
+
+static void dict_set_ctrl(dict_t_ *dict, collections_size_t cell_ix, unsigned char ctrl) {
+    ctrl_set(dict->ctrl, dict->cell_capacity, cell_ix, ctrl);
+}
+
+static void ctrl_set(unsigned char *ctrl, collections_size_t cell_capacity, collections_size_t cell_ix, unsigned char value) {
+    ctrl[cell_ix] = value;
+    collections_size_t ctrl_len = cell_capacity + DICT_GROUP_WIDTH - 1;
+    for (collections_size_t i = cell_ix + cell_capacity; i < ctrl_len; i += cell_capacity) {
+        ctrl[i] = value;
+    }
+}
+
+static unsigned int dict_match_group(const unsigned char *ctrl, unsigned char tag, unsigned int *out_empty) {
+#ifdef COLLECTIONS_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    *out_empty = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)DICT_CTRL_EMPTY)));
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    unsigned int matches = 0;
+    unsigned int empty = 0;
+    for (unsigned int i = 0; i < DICT_GROUP_WIDTH; i++) {
+        if (ctrl[i] == tag) {
+            matches |= 1u << i;
+        } else if (ctrl[i] == DICT_CTRL_EMPTY) {
+            empty |= 1u << i;
+        }
+    }
+    *out_empty = empty;
+    return matches;
+#endif
+}
+
+static unsigned int bit_scan_forward(unsigned int x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_ctz(x);
+#elif defined(_MSC_VER)
+    unsigned long ix;
+    _BitScanForward(&ix, x);
+    return (unsigned int)ix;
+#else
+    unsigned int ix = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        ix++;
+    }
+    return ix;
+#endif
+}
+
+static bool dict_grow_and_rehash(dict_t_ *dict) {
+    if (dict->cell_capacity > COLLECTIONS_SIZE_MAX / 2) {
+        return false;
+    }
+    return dict_resize(dict, dict->cell_capacity * 2, dict->incremental_rehash);
+}
+
+static bool dict_resize(dict_t_ *dict, collections_size_t new_cell_capacity, bool incremental) {
+    dict_finish_rehash(dict);
+    collections_size_t item_capacity = (collections_size_t)(new_cell_capacity * (double)dict->max_load_factor);
+    if (dict->compact) {
+        return dict_compact_resize(dict, new_cell_capacity, item_capacity); // never incremental
+    }
+    if (new_cell_capacity == dict->cell_capacity) {
+        return dict_realloc_items(dict, item_capacity);
+    }
+    clock_t start = clock();
+    collections_size_t *new_cells = collections_alloc(dict->allocator, new_cell_capacity * sizeof(*new_cells));
+    unsigned char *new_ctrl = collections_calloc(dict->allocator, new_cell_capacity + DICT_GROUP_WIDTH - 1, 1);
+    if (new_cells == NULL
+        || new_ctrl == NULL
+        || dict_realloc_items(dict, item_capacity) == false) {
+        collections_free(dict->allocator, new_cells);
+        collections_free(dict->allocator, new_ctrl);
+        return false;
+    }
+    collections_advise_huge_pages(new_cells, new_cell_capacity * sizeof(*new_cells));
+    collections_advise_huge_pages(new_ctrl, new_cell_capacity);
+
+    if (incremental) {
+        dict->old_cells = dict->cells;
+        dict->old_ctrl = dict->ctrl;
+        dict->old_cell_capacity = dict->cell_capacity;
+        dict->rehash_ix = 0;
+    } else {
+        collections_free(dict->allocator, dict->cells);
+        collections_free(dict->allocator, dict->ctrl);
+    }
+    dict->cells = new_cells;
+    dict->ctrl = new_ctrl;
+    dict->cell_capacity = new_cell_capacity;
+
+    if (incremental == false) {
+        for (collections_size_t i = 0; i < dict->count; i++) {
+            dict_insert_cell(dict, i);
+        }
+    }
+    dict->rehash_count++;
+    dict->rehash_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    return true;
+}
+
+static collections_size_t dict_cell_capacity_for(collections_size_t item_capacity, float max_load_factor) {
+    collections_size_t cell_capacity = DICT_MIN_CELL_CAPACITY;
+    while ((collections_size_t)(cell_capacity * (double)max_load_factor) < item_capacity) {
+        if (cell_capacity > COLLECTIONS_SIZE_MAX / 2) {
+            return 0;
+        }
+        cell_capacity *= 2;
+    }
+    return cell_capacity;
+}
+
+static bool dict_realloc_items(dict_t_ *dict, collections_size_t item_capacity) {
+    if (item_capacity < dict->item_capacity) {
+        // when shrinking arrays not reallocated due to a failure are just larger than needed
+        dict->item_capacity = item_capacity;
+    }
+    dict_key_slot_t *keys = collections_realloc(dict->allocator, dict->keys,
+                                                dict->item_capacity * sizeof(*dict->keys), item_capacity * sizeof(*dict->keys));
+    if (keys == NULL) {
+        return false;
+    }
+    dict->keys = keys;
+    if (dict->value_size) {
+        unsigned char *value_data = collections_realloc(dict->allocator, dict->value_data,
+                                                        dict->item_capacity * dict->value_size, item_capacity * dict->value_size);
+        if (value_data == NULL) {
+            return false;
+        }
+        dict->value_data = value_data;
+    } else {
+        void **values = collections_realloc(dict->allocator, dict->values,
+                                            dict->item_capacity * sizeof(*dict->values), item_capacity * sizeof(*dict->values));
+        if (values == NULL) {
+            return false;
+        }
+        dict->values = values;
+    }
+    collections_size_t *cell_ixs = collections_realloc(dict->allocator, dict->cell_ixs,
+                                                       dict->item_capacity * sizeof(*dict->cell_ixs), item_capacity * sizeof(*dict->cell_ixs));
+    if (cell_ixs == NULL) {
+        return false;
+    }
+    dict->cell_ixs = cell_ixs;
+    unsigned long *hashes = collections_realloc(dict->allocator, dict->hashes,
+                                                dict->item_capacity * sizeof(*dict->hashes), item_capacity * sizeof(*dict->hashes));
+    if (hashes == NULL) {
+        return false;
+    }
+    dict->hashes = hashes;
+    dict->item_capacity = item_capacity;
+    dict_advise_huge_pages(dict);
+    dict_rebuild_bloom(dict);
+    return true;
+}
+
+static void dict_advise_huge_pages(dict_t_ *dict) {
+    collections_size_t n = dict->item_capacity;
+    collections_advise_huge_pages(dict->keys, n * sizeof(*dict->keys));
+    if (dict->value_size) {
+        collections_advise_huge_pages(dict->value_data, n * dict->value_size);
+    } else {
+        collections_advise_huge_pages(dict->values, n * sizeof(*dict->values));
+    }
+    collections_advise_huge_pages(dict->cell_ixs, n * sizeof(*dict->cell_ixs));
+    collections_advise_huge_pages(dict->hashes, n * sizeof(*dict->hashes));
+}
+
+static void dict_rehash_step(dict_t_ *dict, collections_size_t cells_to_migrate) {
+    collections_size_t end = dict->rehash_ix + cells_to_migrate;
+    if (end > dict->old_cell_capacity) {
+        end = dict->old_cell_capacity;
+    }
+    for (; dict->rehash_ix < end; dict->rehash_ix++) {
+        collections_size_t ix = dict->rehash_ix;
+        if ((dict->old_ctrl[ix] & DICT_CTRL_FULL) == 0) {
+            continue;
+        }
+        dict_insert_cell(dict, dict->old_cells[ix]);
+        ctrl_set(dict->old_ctrl, dict->old_cell_capacity, ix, DICT_CTRL_DELETED);
+    }
+    if (dict->rehash_ix == dict->old_cell_capacity) {
+        collections_free(dict->allocator, dict->old_cells);
+        collections_free(dict->allocator, dict->old_ctrl);
+        dict->old_cells = NULL;
+        dict->old_ctrl = NULL;
+        dict->old_cell_capacity = 0;
+        dict->rehash_ix = 0;
+    }
+}
+
+// Refills the filter from cached hashes. If it can't be resized the old one is
+// reused, it stays correct but gives more false positives.
+static bool dict_rebuild_bloom(dict_t_ *dict) {
+    if (dict->bloom == NULL) {
+        return true;
+    }
+    bool resized = true;
+    bloom_t_ *bloom = NULL;
+    if (dict->bloom->block_count != bloom_block_count(dict->item_capacity, BLOOM_DEFAULT_BITS_PER_KEY)) {
+        bloom = bloom_make_with_allocator(dict->item_capacity, 0, dict->allocator);
+        resized = bloom != NULL;
+    }
+    if (bloom) {
+        bloom_destroy(dict->bloom);
+        dict->bloom = bloom;
+    } else {
+        bloom_clear(dict->bloom);
+    }
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        bloom_add_hash(dict->bloom, dict_item_hash(dict, i));
+    }
+    dict->bloom_removed = 0;
+    return resized;
+}
+
+static void dict_finish_rehash(dict_t_ *dict) {
+    if (dict->old_cells) {
+        dict_rehash_step(dict, dict->old_cell_capacity);
+    }
+}
+
+static bool dict_set_internal(dict_t_ *dict, const char *key, size_t len, unsigned long hash, const void *value) {
+    bool added = false;
+    collections_size_t item_ix = dict_upsert(dict, key, len, hash, &added);
+    if (item_ix == DICT_INVALID_IX) {
+        return false;
+    }
+    dict_store_value(dict, item_ix, value);
+    return true;
+}
+
+// Sets keys with already computed lens and hashes. Home cells of a batch of keys
+// are prefetched before any of them is set, so their misses overlap.
+static bool dict_set_hashed(dict_t_ *dict,
+                            const char * const *keys,
+                            const size_t *lens,
+                            const unsigned long *hashes,
+                            void * const *values,
+                            collections_size_t count)
+{
+    for (collections_size_t start = 0; start < count; start += DICT_BATCH_SIZE) {
+        collections_size_t end = (count - start) < DICT_BATCH_SIZE ? count : start + DICT_BATCH_SIZE;
+        collections_size_t mask = dict->cell_capacity - 1;
+        for (collections_size_t i = start; i < end; i++) {
+            COLLECTIONS_PREFETCH(dict->ctrl + (hashes[i] & mask));
+            COLLECTIONS_PREFETCH(dict->cells + (hashes[i] & mask));
+        }
+        for (collections_size_t i = start; i < end; i++) {
+            if (dict_set_internal(dict, keys[i], lens[i], hashes[i], values[i]) == false) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void dict_hash_keys(dict_hash_job_t *job) {
+    for (collections_size_t i = 0; i < job->count; i++) {
+        job->lens[i] = strlen(job->keys[i]);
+        job->hashes[i] = dict_hash_key(job->dict, job->keys[i], job->lens[i]);
+    }
+}
+
+static dict_thread_result_t DICT_THREAD_CALL dict_hash_keys_thread(void *arg) {
+    dict_hash_keys(arg);
+    return 0;
+}
+
+// Returns item index of key, adding it with an unset value if it's absent (DICT_INVALID_IX if that fails).
+static collections_size_t dict_upsert(dict_t_ *dict, const char *key, size_t len, unsigned long hash, bool *out_added) {
+    *out_added = false;
+    if (dict->old_cells) {
+        dict_rehash_step(dict, DICT_REHASH_STEP);
+    }
+    bool found = false;
+    collections_size_t cell_ix = dict_get_cell_ix(dict, key, len, hash, &found);
+    if (found) {
+        return dict->cells[cell_ix];
+    }
+    if (dict->old_cells) {
+        collections_size_t old_cell_ix = dict_get_old_cell_ix(dict, key, len, hash, &found);
+        if (found) {
+            return dict->old_cells[old_cell_ix];
+        }
+    }
+    dict_key_slot_t key_slot;
+    if (dict_make_key_slot(dict, dict->allocator, key, len, &key_slot) == false) {
+        return DICT_INVALID_IX;
+    }
+    if (dict->count >= dict->item_capacity) {
+        bool succeeded = dict_grow_and_rehash(dict);
+        if (succeeded == false) {
+            dict_free_key(dict, dict->allocator, &key_slot);
+            return DICT_INVALID_IX;
+        }
+        cell_ix = dict_get_cell_ix(dict, key, len, hash, &found);
+    }
+    dict->cells[cell_ix] = dict->count;
+    dict_set_ctrl(dict, cell_ix, dict_hash_tag(hash));
+    dict->keys[dict->count] = key_slot;
+    dict->cell_ixs[dict->count] = cell_ix;
+    dict_set_item_hash(dict, dict->count, hash);
+    dict->count++;
+    if (dict->bloom) {
+        bloom_add_hash(dict->bloom, hash);
+    }
+    *out_added = true;
+    return dict->count - 1;
+}
+
+static void dict_store_value(dict_t_ *dict, collections_size_t item_ix, const void *value) {
+    if (dict->value_size == 0) {
+        dict->values[item_ix] = (void*)value;
+    } else if (value) {
+        memcpy(dict->value_data + (size_t)item_ix * dict->value_size, value, dict->value_size);
+    } else {
+        memset(dict->value_data + (size_t)item_ix * dict->value_size, 0, dict->value_size);
+    }
+}
+
+static bool dict_remove_internal(dict_t_ *dict, const char *key, size_t len, unsigned long hash) {
+    if (dict->old_cells) {
+        dict_rehash_step(dict, DICT_REHASH_STEP);
+    }
+    bool found = false;
+    bool in_old_table = false;
+    collections_size_t cell = dict_get_cell_ix(dict, key, len, hash, &found);
+    if (!found && dict->old_cells) {
+        cell = dict_get_old_cell_ix(dict, key, len, hash, &found);
+        in_old_table = found;
+    }
+    if (!found) {
+        return false;
+    }
+    dict_remove_item(dict, in_old_table ? dict->old_cells[cell] : dict->cells[cell]);
+    return true;
+}
+
+// Moves the last item into item_ix, like every remove does.
+static void dict_remove_item(dict_t_ *dict, collections_size_t item_ix) {
+    bool in_old_table = dict_item_in_old_table(dict, item_ix);
+    collections_size_t cell = dict->cell_ixs[item_ix];
+    dict_free_key(dict, dict->allocator, &dict->keys[item_ix]);
+    collections_size_t last_item_ix = dict->count - 1;
+    if (item_ix < last_item_ix) {
+        bool last_in_old_table = dict_item_in_old_table(dict, last_item_ix);
+        dict->keys[item_ix] = dict->keys[last_item_ix];
+        if (dict->value_size) {
+            memcpy(dict->value_data + (size_t)item_ix * dict->value_size,
+                   dict->value_data + (size_t)last_item_ix * dict->value_size, dict->value_size);
+        } else {
+            dict->values[item_ix] = dict->values[last_item_ix];
+        }
+        dict->cell_ixs[item_ix] = dict->cell_ixs[last_item_ix];
+        dict_set_item_hash(dict, item_ix, dict_item_hash(dict, last_item_ix));
+        if (last_in_old_table) {
+            dict->old_cells[dict->cell_ixs[item_ix]] = item_ix;
+        } else {
+            dict->cells[dict->cell_ixs[item_ix]] = item_ix;
+        }
+    }
+    dict->count--;
+
+    if (in_old_table) {
+        ctrl_set(dict->old_ctrl, dict->old_cell_capacity, cell, DICT_CTRL_DELETED);
+    } else {
+        dict_remove_cell(dict, cell);
+    }
+    if (dict->bloom && ++dict->bloom_removed > dict->count) {
+        dict_rebuild_bloom(dict);
+    }
+
+    if (dict->key_arena_waste > DICT_KEY_BLOCK_MIN_SIZE
+        && dict->key_arena_waste > dict->key_arena_used - dict->key_arena_waste) {
+        dict_compact_keys(dict); // on failure keys just stay where they are
+    }
+}
+
+static bool dict_make_key_slot(dict_t_ *dict, const collections_allocator_t *allocator, const char *key, size_t len, dict_key_slot_t *out_slot) {
+    memset(out_slot, 0, sizeof(*out_slot));
+    if (len < DICT_INLINE_KEY_SIZE) {
+        memcpy(out_slot->data, key, len);
+        return true;
+    }
+    char *key_copy = dict_copy_key(dict, allocator, key, len);
+    if (key_copy == NULL) {
+        return false;
+    }
+    dict_key_slot_set_ptr(out_slot, key_copy);
+    memcpy(out_slot->data + sizeof(char*), key, DICT_KEY_SLOT_PREFIX_SIZE);
+    out_slot->data[DICT_INLINE_KEY_SIZE - 1] = DICT_KEY_SLOT_OUT_OF_LINE;
+    return true;
+}
+
+static bool dict_key_slot_is_inline(const dict_key_slot_t *slot) {
+    return slot->data[DICT_INLINE_KEY_SIZE - 1] == '\0';
+}
+
+static char *dict_key_slot_ptr(const dict_key_slot_t *slot) {
+    char *ptr = NULL;
+    memcpy(&ptr, slot->data, sizeof(char*));
+    return ptr;
+}
+
+static void dict_key_slot_set_ptr(dict_key_slot_t *slot, char *ptr) {
+    memcpy(slot->data, &ptr, sizeof(char*));
+}
+
+static const char *dict_item_key(const dict_t_ *dict, collections_size_t item_ix) {
+    const dict_key_slot_t *slot = &dict->keys[item_ix];
+    return dict_key_slot_is_inline(slot) ? slot->data : dict_key_slot_ptr(slot);
+}
+
+static bool dict_item_key_equals(const dict_t_ *dict, collections_size_t item_ix, const char *key, size_t len) {
+    return dict_key_slot_equals(&dict->keys[item_ix], key, len);
+}
+
+static bool dict_key_slot_equals(const dict_key_slot_t *slot, const char *key, size_t len) {
+    // key doesn't have to be NUL terminated, stored keys always are
+    if (len < DICT_INLINE_KEY_SIZE) {
+        // out of line slots start with pointer bytes, which can be anything including NUL
+        return dict_key_slot_is_inline(slot) && memcmp(slot->data, key, len) == 0 && slot->data[len] == '\0';
+    }
+    if (dict_key_slot_is_inline(slot)
+        || memcmp(slot->data + sizeof(char*), key, DICT_KEY_SLOT_PREFIX_SIZE) != 0) {
+        return false;
+    }
+    const char *key_to_check = dict_key_slot_ptr(slot);
+    return strncmp(key_to_check, key, len) == 0 && key_to_check[len] == '\0';
+}
+
+// dict is NULL for keys owned by a strset, copies come from allocator unless dict has a key arena.
+static char *dict_copy_key(dict_t_ *dict, const collections_allocator_t *allocator, const char *key, size_t len) {
+    char *res = NULL;
+    if (dict && dict->key_arena) {
+        res = key_arena_alloc(dict, len + 1);
+    } else {
+        res = collections_alloc(allocator, len + 1);
+    }
+    if (res == NULL) {
+        return NULL;
+    }
+    memcpy(res, key, len);
+    res[len] = '\0';
+    return res;
+}
+
+static void dict_free_key(dict_t_ *dict, const collections_allocator_t *allocator, const dict_key_slot_t *slot) {
+    if (dict_key_slot_is_inline(slot)) {
+        return;
+    }
+    char *key = dict_key_slot_ptr(slot);
+    if (dict && dict->key_arena) {
+        dict->key_arena_waste += strlen(key) + 1;
+    } else {
+        collections_free(allocator, key);
+    }
+}
+
+static void dict_free_keys(dict_t_ *dict) {
+    if (dict->key_arena == false) {
+        for (collections_size_t i = 0; i < dict->count; i++) {
+            dict_free_key(dict, dict->allocator, &dict->keys[i]);
+        }
+        return;
+    }
+    // keep the newest (largest) block for reuse
+    dict_key_block_t *block = dict->key_blocks;
+    if (block) {
+        key_arena_free_blocks(dict, block->next);
+        block->next = NULL;
+        block->used = 0;
+    }
+    dict->key_arena_used = 0;
+    dict->key_arena_waste = 0;
+}
+
+static char *key_arena_alloc(dict_t_ *dict, size_t size) {
+    dict_key_block_t *block = dict->key_blocks;
+    if (block == NULL || (block->size - block->used) < size) {
+        size_t block_size = block ? block->size * 2 : DICT_KEY_BLOCK_MIN_SIZE;
+        if (block_size < DICT_KEY_BLOCK_MIN_SIZE) {
+            block_size = DICT_KEY_BLOCK_MIN_SIZE;
+        }
+        if (block_size > DICT_KEY_BLOCK_MAX_SIZE) {
+            block_size = DICT_KEY_BLOCK_MAX_SIZE;
+        }
+        if (block_size < size) {
+            block_size = size;
+        }
+        dict_key_block_t *new_block = collections_alloc(dict->allocator, sizeof(dict_key_block_t) + block_size);
+        if (new_block == NULL) {
+            return NULL;
+        }
+        new_block->next = block;
+        new_block->size = block_size;
+        new_block->used = 0;
+        dict->key_blocks = new_block;
+        if (block) {
+            // space left at the end of the previous block is never used
+            dict->key_arena_used += block->size - block->used;
+            dict->key_arena_waste += block->size - block->used;
+            block->used = block->size;
+        }
+        block = new_block;
+    }
+    char *res = block->data + block->used;
+    block->used += size;
+    dict->key_arena_used += size;
+    return res;
+}
+
+static void key_arena_free_blocks(dict_t_ *dict, dict_key_block_t *blocks) {
+    while (blocks) {
+        dict_key_block_t *next = blocks->next;
+        collections_free(dict->allocator, blocks);
+        blocks = next;
+    }
+}
+
+static void stats_add_displacement(dict_stats_t *stats, unsigned int displacement) {
+    unsigned int bucket = displacement < (DICT_STATS_HISTOGRAM_SIZE - 1) ? displacement : (DICT_STATS_HISTOGRAM_SIZE - 1);
+    stats->displacement_histogram[bucket]++;
+    stats->avg_displacement += displacement; // sum until divided by count
+    if (displacement > stats->max_displacement) {
+        stats->max_displacement = displacement;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Pointer dictionary
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define PTRDICT_INVALID_IX COLLECTIONS_SIZE_MAX
+// cells hold item index + 1, so zeroed (calloc'd) cells are an empty table
+#define PTRDICT_EMPTY_CELL 0
+#define PTRDICT_DELETED_CELL COLLECTIONS_SIZE_MAX
+#define PTRDICT_REHASH_STEP DICT_REHASH_STEP
+#define PTRDICT_BATCH_SIZE DICT_BATCH_SIZE
+
+typedef struct ptrdict_ {
+    collections_size_t *cells;
+    void **keys;
+    void **values;
+    collections_size_t *cell_ixs;
+    collections_size_t *hashes; // mixed keys, cell indices never need more bits
+    collections_size_t count;
+    collections_size_t item_capacity;
+    collections_size_t cell_capacity;
+    float max_load_factor;
+    unsigned int rehash_count;
+    double rehash_seconds;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    unsigned long long hits;
+    unsigned long long misses;
+#endif
+    bool incremental_rehash;
+    // Table being migrated from during incremental rehash (NULL otherwise).
+    // Migrated and removed cells are marked with PTRDICT_DELETED_CELL.
+    collections_size_t *old_cells;
+    collections_size_t old_cell_capacity;
+    collections_size_t rehash_ix;
+    const collections_allocator_t *allocator;
+} ptrdict_t_;
+
+// Private declarations
+static bool ptrdict_init(ptrdict_t_ *pd, collections_size_t initial_cell_capacity);
+static void ptrdict_deinit(ptrdict_t_ *pd);
+static collections_size_t ptrdict_get_cell_ix(const ptrdict_t_ *pd, void *key, collections_size_t hash, bool *out_found);
+static collections_size_t ptrdict_get_old_cell_ix(const ptrdict_t_ *pd, void *key, collections_size_t hash, bool *out_found);
+static collections_size_t ptrdict_probe(const ptrdict_t_ *pd,
+                                        const collections_size_t *cells,
+                                        collections_size_t cell_capacity,
+                                        void *key,
+                                        collections_size_t hash,
+                                        bool *out_found);
+static collections_size_t ptrdict_get_item_ix(const ptrdict_t_ *pd, void *key, collections_size_t hash);
+static collections_size_t ptrdict_hash_key(const void *key);
+static void ptrdict_insert_cell(ptrdict_t_ *pd, collections_size_t item_ix);
+static void ptrdict_remove_cell(ptrdict_t_ *pd, collections_size_t cell_ix);
+static bool ptrdict_item_in_old_table(const ptrdict_t_ *pd, collections_size_t item_ix);
+static bool ptrdict_grow_and_rehash(ptrdict_t_ *pd);
+static bool ptrdict_resize(ptrdict_t_ *pd, collections_size_t cell_capacity, bool incremental);
+static bool ptrdict_realloc_items(ptrdict_t_ *pd, collections_size_t item_capacity);
+static void ptrdict_advise_huge_pages(ptrdict_t_ *pd);
+static void ptrdict_rehash_step(ptrdict_t_ *pd, collections_size_t cells_to_migrate);
+static void ptrdict_finish_rehash(ptrdict_t_ *pd);
+static bool ptrdict_set_internal(ptrdict_t_ *pd, void *key, void *value);
+
+// Public
+ptrdict_t_* ptrdict_make(void) {
+    return ptrdict_make_with_capacity(0);
+}
+
+ptrdict_t_* ptrdict_make_with_capacity(collections_size_t capacity) {
+    return ptrdict_make_with_allocator(capacity, NULL);
+}
+
+ptrdict_t_* ptrdict_make_with_allocator(collections_size_t capacity, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return NULL;
+    }
+    ptrdict_t_ *dict = collections_alloc(allocator, sizeof(ptrdict_t_));
+    if (dict == NULL) {
+        return NULL;
+    }
+    dict->allocator = allocator;
+    dict->max_load_factor = DICT_DEFAULT_MAX_LOAD_FACTOR;
+    dict->incremental_rehash = false;
+    bool succeeded = ptrdict_init(dict, cell_capacity);
+    if (succeeded == false) {
+        collections_free(dict->allocator, dict);
+        return NULL;
+    }
+    return dict;
+}
+
+void ptrdict_destroy(ptrdict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    ptrdict_deinit(dict);
+    collections_free(dict->allocator, dict);
+}
+
+bool ptrdict_reserve(ptrdict_t_ *dict, collections_size_t capacity) {
+    if (capacity <= dict->item_capacity) {
+        return true;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(capacity, dict->max_load_factor);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    return ptrdict_resize(dict, cell_capacity, false);
+}
+
+bool ptrdict_shrink_to_fit(ptrdict_t_ *dict) {
+    collections_size_t cell_capacity = dict_cell_capacity_for(dict->count, dict->max_load_factor);
+    return ptrdict_resize(dict, cell_capacity, false);
+}
+
+bool ptrdict_set_max_load_factor(ptrdict_t_ *dict, float max_load_factor) {
+    if (!(max_load_factor > 0.0f && max_load_factor < 1.0f)) {
+        return false;
+    }
+    collections_size_t cell_capacity = dict_cell_capacity_for(dict->count, max_load_factor);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    float prev_max_load_factor = dict->max_load_factor;
+    dict->max_load_factor = max_load_factor;
+    if (cell_capacity < dict->cell_capacity) {
+        cell_capacity = dict->cell_capacity;
+    }
+    bool succeeded = ptrdict_resize(dict, cell_capacity, false);
+    if (succeeded == false) {
+        dict->max_load_factor = prev_max_load_factor;
+    }
+    return succeeded;
+}
+
+void ptrdict_set_incremental_rehash(ptrdict_t_ *dict, bool enabled) {
+    if (!enabled) {
+        ptrdict_finish_rehash(dict);
+    }
+    dict->incremental_rehash = enabled;
+}
+
+bool ptrdict_set(ptrdict_t_ *dict, void *key, void *value) {
+    return ptrdict_set_internal(dict, key, value);
+}
+
+void *ptrdict_get(const ptrdict_t_ *dict, void *key) {
+    collections_size_t item_ix = ptrdict_get_item_ix(dict, key, ptrdict_hash_key(key));
+    if (item_ix == PTRDICT_INVALID_IX) {
+        return NULL;
+    }
+    return dict->values[item_ix];
+}
+
+collections_size_t ptrdict_get_many(const ptrdict_t_ *dict, void * const *keys, collections_size_t count, void **out_values) {
+    collections_size_t hashes[PTRDICT_BATCH_SIZE];
+    collections_size_t mask = dict->cell_capacity - 1;
+    collections_size_t found_count = 0;
+    for (collections_size_t start = 0; start < count; start += PTRDICT_BATCH_SIZE) {
+        void * const *batch = keys + start;
+        collections_size_t batch_count = (count - start) < PTRDICT_BATCH_SIZE ? (count - start) : PTRDICT_BATCH_SIZE;
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            hashes[i] = ptrdict_hash_key(batch[i]);
+            COLLECTIONS_PREFETCH(dict->cells + (hashes[i] & mask));
+        }
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            collections_size_t cell = dict->cells[hashes[i] & mask];
+            if (cell != PTRDICT_EMPTY_CELL && cell != PTRDICT_DELETED_CELL) {
+                COLLECTIONS_PREFETCH(dict->keys + (cell - 1));
+                COLLECTIONS_PREFETCH(dict->values + (cell - 1));
+            }
+        }
+        for (collections_size_t i = 0; i < batch_count; i++) {
+            collections_size_t item_ix = ptrdict_get_item_ix(dict, batch[i], hashes[i]);
+            if (item_ix == PTRDICT_INVALID_IX) {
+                out_values[start + i] = NULL;
+            } else {
+                out_values[start + i] = dict->values[item_ix];
+                found_count++;
+            }
+        }
+    }
+    return found_count;
+}
+
+void *ptrdict_get_value_at(const ptrdict_t_ *dict, collections_size_t ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict->values[ix];
+}
+
+void *ptrdict_get_key_at(const ptrdict_t_ *dict, collections_size_t ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict->keys[ix];
+}
+
+collections_size_t ptrdict_count(const ptrdict_t_ *dict) {
+    if (!dict) {
+        return 0;
+    }
+    return dict->count;
+}
+
+bool ptrdict_remove(ptrdict_t_ *dict, void *key) {
+    if (dict->old_cells) {
+        ptrdict_rehash_step(dict, PTRDICT_REHASH_STEP);
+    }
+    collections_size_t hash = ptrdict_hash_key(key);
+    bool found = false;
+    bool in_old_table = false;
+    collections_size_t cell = ptrdict_get_cell_ix(dict, key, hash, &found);
+    if (!found && dict->old_cells) {
+        cell = ptrdict_get_old_cell_ix(dict, key, hash, &found);
+        in_old_table = found;
+    }
+    if (!found) {
+        return false;
+    }
+
+    // keys aren't owned by ptrdict, so they're not freed here
+    collections_size_t item_ix = (in_old_table ? dict->old_cells[cell] : dict->cells[cell]) - 1;
+    collections_size_t last_item_ix = dict->count - 1;
+    if (item_ix < last_item_ix) {
+        bool last_in_old_table = ptrdict_item_in_old_table(dict, last_item_ix);
+        dict->keys[item_ix] = dict->keys[last_item_ix];
+        dict->values[item_ix] = dict->values[last_item_ix];
+        dict->cell_ixs[item_ix] = dict->cell_ixs[last_item_ix];
+        dict->hashes[item_ix] = dict->hashes[last_item_ix];
+        if (last_in_old_table) {
+            dict->old_cells[dict->cell_ixs[item_ix]] = item_ix + 1;
+        } else {
+            dict->cells[dict->cell_ixs[item_ix]] = item_ix + 1;
+        }
+    }
+    dict->count--;
+
+    if (in_old_table) {
+        dict->old_cells[cell] = PTRDICT_DELETED_CELL;
+    } else {
+        ptrdict_remove_cell(dict, cell);
+    }
+    return true;
+}
+
+void ptrdict_get_stats(const ptrdict_t_ *dict, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = dict->count;
+    out_stats->item_capacity = dict->item_capacity;
+    out_stats->cell_capacity = dict->cell_capacity;
+    out_stats->load_factor = (float)dict->count / dict->cell_capacity;
+    for (collections_size_t i = 0; i < dict->count; i++) {
+        collections_size_t cell_capacity = ptrdict_item_in_old_table(dict, i) ? dict->old_cell_capacity : dict->cell_capacity;
+        collections_size_t home_ix = dict->hashes[i] & (cell_capacity - 1);
+        stats_add_displacement(out_stats, (dict->cell_ixs[i] - home_ix) & (cell_capacity - 1));
+    }
+    if (dict->count > 0) {
+        out_stats->avg_displacement /= dict->count;
+    }
+    out_stats->rehash_count = dict->rehash_count;
+    out_stats->rehash_seconds = dict->rehash_seconds;
+
+    out_stats->cells_bytes = dict->cell_capacity * sizeof(*dict->cells);
+    out_stats->keys_bytes = dict->item_capacity * sizeof(*dict->keys);
+    out_stats->values_bytes = dict->item_capacity * sizeof(*dict->values);
+    out_stats->cell_ixs_bytes = dict->item_capacity * sizeof(*dict->cell_ixs);
+    out_stats->hashes_bytes = dict->item_capacity * sizeof(*dict->hashes);
+    out_stats->old_table_bytes = dict->old_cell_capacity * sizeof(*dict->old_cells);
+    out_stats->total_bytes = sizeof(ptrdict_t_)
+                           + out_stats->cells_bytes + out_stats->keys_bytes
+                           + out_stats->values_bytes + out_stats->cell_ixs_bytes
+                           + out_stats->hashes_bytes + out_stats->old_table_bytes;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    out_stats->hits = dict_counter_load(&dict->hits);
+    out_stats->misses = dict_counter_load(&dict->misses);
+#endif
+}
+
+void ptrdict_clear(ptrdict_t_ *dict) {
+    collections_free(dict->allocator, dict->old_cells);
+    dict->old_cells = NULL;
+    dict->old_cell_capacity = 0;
+    dict->rehash_ix = 0;
+    dict->count = 0;
+    memset(dict->cells, 0, dict->cell_capacity * sizeof(*dict->cells));
+}
+
+// Private definitions
+static bool ptrdict_init(ptrdict_t_ *dict, collections_size_t initial_cell_capacity) {
+    assert((initial_cell_capacity & (initial_cell_capacity - 1)) == 0);
+    dict->cells = NULL;
+    dict->keys = NULL;
+    dict->values = NULL;
+    dict->cell_ixs = NULL;
+    dict->hashes = NULL;
+    dict->old_cells = NULL;
+    dict->old_cell_capacity = 0;
+    dict->rehash_ix = 0;
+    dict->rehash_count = 0;
+    dict->rehash_seconds = 0;
+#ifdef COLLECTIONS_DICT_COUNTERS
+    dict->hits = 0;
+    dict->misses = 0;
+#endif
+
+    dict->count = 0;
+    dict->cell_capacity = initial_cell_capacity;
+    dict->item_capacity = (collections_size_t)(initial_cell_capacity * (double)dict->max_load_factor);
+
+    dict->cells = collections_calloc(dict->allocator, dict->cell_capacity, sizeof(*dict->cells));
+    dict->keys = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->keys));
+    dict->values = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->values));
+    dict->cell_ixs = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->cell_ixs));
+    dict->hashes = collections_alloc(dict->allocator, dict->item_capacity * sizeof(*dict->hashes));
+    if (dict->cells == NULL
+        || dict->keys == NULL
+        || dict->values == NULL
+        || dict->cell_ixs == NULL
+        || dict->hashes == NULL) {
+        goto error;
+    }
+    collections_advise_huge_pages(dict->cells, dict->cell_capacity * sizeof(*dict->cells));
+    ptrdict_advise_huge_pages(dict);
+    return true;
+error:
+    collections_free(dict->allocator, dict->cells);
+    collections_free(dict->allocator, dict->keys);
+    collections_free(dict->allocator, dict->values);
+    collections_free(dict->allocator, dict->cell_ixs);
+    collections_free(dict->allocator, dict->hashes);
+    return false;
+}
+
+static void ptrdict_deinit(ptrdict_t_ *dict) {
+    dict->count = 0;
+    dict->item_capacity = 0;
+    dict->cell_capacity = 0;
+
+    collections_free(dict->allocator, dict->cells);
+    collections_free(dict->allocator, dict->keys);
+    collections_free(dict->allocator, dict->values);
+    collections_free(dict->allocator, dict->cell_ixs);
+    collections_free(dict->allocator, dict->hashes);
+    collections_free(dict->allocator, dict->old_cells);
+
+    dict->cells = NULL;
+    dict->keys = NULL;
+    dict->values = NULL;
+    dict->cell_ixs = NULL;
+    dict->hashes = NULL;
+    dict->old_cells = NULL;
+}
+
+static collections_size_t ptrdict_get_cell_ix(const ptrdict_t_ *dict, void *key, collections_size_t hash, bool *out_found) {
+    return ptrdict_probe(dict, dict->cells, dict->cell_capacity, key, hash, out_found);
+}
+
+static collections_size_t ptrdict_get_old_cell_ix(const ptrdict_t_ *dict, void *key, collections_size_t hash, bool *out_found) {
+    return ptrdict_probe(dict, dict->old_cells, dict->old_cell_capacity, key, hash, out_found);
+}
+
+static collections_size_t ptrdict_probe(const ptrdict_t_ *dict,
+                                        const collections_size_t *cells,
+                                        collections_size_t cell_capacity,
+                                        void *key,
+                                        collections_size_t hash,
+                                        bool *out_found)
+{
+    *out_found = false;
+    collections_size_t cell_ix = hash & (cell_capacity - 1);
+    for (collections_size_t i = 0; i < cell_capacity; i++) {
+        collections_size_t ix = (cell_ix + i) & (cell_capacity - 1);
+        collections_size_t cell = cells[ix];
+        if (cell == PTRDICT_EMPTY_CELL) {
+            return ix;
+        }
+        if (cell == PTRDICT_DELETED_CELL) {
+            continue;
+        }
+        void *key_to_check = dict->keys[cell - 1];
+        if (key == key_to_check) {
+            *out_found = true;
+            return ix;
+        }
+    }
+    return PTRDICT_INVALID_IX;
+}
+
+static collections_size_t ptrdict_get_item_ix(const ptrdict_t_ *dict, void *key, collections_size_t hash) {
+    collections_size_t item_ix = PTRDICT_INVALID_IX;
+    bool found = false;
+    collections_size_t cell_ix = ptrdict_get_cell_ix(dict, key, hash, &found);
+    if (found) {
+        item_ix = dict->cells[cell_ix] - 1;
+    } else if (dict->old_cells) {
+        cell_ix = ptrdict_get_old_cell_ix(dict, key, hash, &found);
+        if (found) {
+            item_ix = dict->old_cells[cell_ix] - 1;
+        }
+    }
+#ifdef COLLECTIONS_DICT_COUNTERS
+    if (found) {
+        dict_counter_inc(&((ptrdict_t_*)dict)->hits);
+    } else {
+        dict_counter_inc(&((ptrdict_t_*)dict)->misses);
+    }
+#endif
+    return item_ix;
+}
+
+static collections_size_t ptrdict_hash_key(const void *key) {
+    // murmur3 fmix64, aligned pointers differ only in their middle bits which
+    // would otherwise leave most home cells unused
+    uint64_t x = (uintptr_t)key;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return (collections_size_t)x;
+}
+
+static void ptrdict_insert_cell(ptrdict_t_ *dict, collections_size_t item_ix) {
+    collections_size_t mask = dict->cell_capacity - 1;
+    collections_size_t cell_ix = dict->hashes[item_ix] & mask;
+    while (dict->cells[cell_ix] != PTRDICT_EMPTY_CELL) {
+        cell_ix = (cell_ix + 1) & mask;
+    }
+    dict->cells[cell_ix] = item_ix + 1;
+    dict->cell_ixs[item_ix] = cell_ix;
+}
+
+static void ptrdict_remove_cell(ptrdict_t_ *dict, collections_size_t cell_ix) {
+    collections_size_t i = cell_ix;
+    collections_size_t j = i;
+    for (collections_size_t x = 0; x < (dict->cell_capacity - 1); x++) {
+        j = (j + 1) & (dict->cell_capacity - 1);
+        if (dict->cells[j] == PTRDICT_EMPTY_CELL) {
+            break;
+        }
+        collections_size_t k = dict->hashes[dict->cells[j] - 1] & (dict->cell_capacity - 1);
+        if ((j > i && (k <= i || k > j))
+            || (j < i && (k <= i && k > j))) {
+            dict->cell_ixs[dict->cells[j] - 1] = i;
+            dict->cells[i] = dict->cells[j];
+            i = j;
+        }
+    }
+    dict->cells[i] = PTRDICT_EMPTY_CELL;
+}
+
+static bool ptrdict_item_in_old_table(const ptrdict_t_ *dict, collections_size_t item_ix) {
+    if (dict->old_cells == NULL) {
+        return false;
+    }
+    collections_size_t cell_ix = dict->cell_ixs[item_ix];
+    return cell_ix < dict->old_cell_capacity && dict->old_cells[cell_ix] == item_ix + 1;
+}
+
+static bool ptrdict_grow_and_rehash(ptrdict_t_ *dict) {
+    if (dict->cell_capacity > COLLECTIONS_SIZE_MAX / 2) {
+        return false;
+    }
+    return ptrdict_resize(dict, dict->cell_capacity * 2, dict->incremental_rehash);
+}
+
+static bool ptrdict_resize(ptrdict_t_ *dict, collections_size_t new_cell_capacity, bool incremental) {
+    ptrdict_finish_rehash(dict);
+    collections_size_t item_capacity = (collections_size_t)(new_cell_capacity * (double)dict->max_load_factor);
+    if (new_cell_capacity == dict->cell_capacity) {
+        return ptrdict_realloc_items(dict, item_capacity);
+    }
+    clock_t start = clock();
+    collections_size_t *new_cells = collections_calloc(dict->allocator, new_cell_capacity, sizeof(*new_cells));
+    if (new_cells == NULL
+        || ptrdict_realloc_items(dict, item_capacity) == false) {
+        collections_free(dict->allocator, new_cells);
+        return false;
+    }
+    collections_advise_huge_pages(new_cells, new_cell_capacity * sizeof(*new_cells));
+
+    if (incremental) {
+        dict->old_cells = dict->cells;
+        dict->old_cell_capacity = dict->cell_capacity;
+        dict->rehash_ix = 0;
+    } else {
+        collections_free(dict->allocator, dict->cells);
+    }
+    dict->cells = new_cells;
+    dict->cell_capacity = new_cell_capacity;
+
+    if (incremental == false) {
+        for (collections_size_t i = 0; i < dict->count; i++) {
+            ptrdict_insert_cell(dict, i);
+        }
+    }
+    dict->rehash_count++;
+    dict->rehash_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    return true;
+}
+
+static bool ptrdict_realloc_items(ptrdict_t_ *dict, collections_size_t item_capacity) {
+    if (item_capacity < dict->item_capacity) {
+        dict->item_capacity = item_capacity;
+    }
+    void **keys = collections_realloc(dict->allocator, dict->keys,
+                                      dict->item_capacity * sizeof(*dict->keys), item_capacity * sizeof(*dict->keys));
+    if (keys == NULL) {
+        return false;
+    }
+    dict->keys = keys;
+    void **values = collections_realloc(dict->allocator, dict->values,
+                                        dict->item_capacity * sizeof(*dict->values), item_capacity * sizeof(*dict->values));
+    if (values == NULL) {
+        return false;
+    }
+    dict->values = values;
+    collections_size_t *cell_ixs = collections_realloc(dict->allocator, dict->cell_ixs,
+                                                       dict->item_capacity * sizeof(*dict->cell_ixs), item_capacity * sizeof(*dict->cell_ixs));
+    if (cell_ixs == NULL) {
+        return false;
+    }
+    dict->cell_ixs = cell_ixs;
+    collections_size_t *hashes = collections_realloc(dict->allocator, dict->hashes,
+                                                     dict->item_capacity * sizeof(*dict->hashes), item_capacity * sizeof(*dict->hashes));
+    if (hashes == NULL) {
+        return false;
+    }
+    dict->hashes = hashes;
+    dict->item_capacity = item_capacity;
+    ptrdict_advise_huge_pages(dict);
+    return true;
+}
+
+static void ptrdict_advise_huge_pages(ptrdict_t_ *dict) {
+    collections_size_t n = dict->item_capacity;
+    collections_advise_huge_pages(dict->keys, n * sizeof(*dict->keys));
+    collections_advise_huge_pages(dict->values, n * sizeof(*dict->values));
+    collections_advise_huge_pages(dict->cell_ixs, n * sizeof(*dict->cell_ixs));
+    collections_advise_huge_pages(dict->hashes, n * sizeof(*dict->hashes));
+}
+
+static void ptrdict_rehash_step(ptrdict_t_ *dict, collections_size_t cells_to_migrate) {
+    collections_size_t end = dict->rehash_ix + cells_to_migrate;
+    if (end > dict->old_cell_capacity) {
+        end = dict->old_cell_capacity;
+    }
+    for (; dict->rehash_ix < end; dict->rehash_ix++) {
+        collections_size_t ix = dict->rehash_ix;
+        collections_size_t cell = dict->old_cells[ix];
+        if (cell == PTRDICT_EMPTY_CELL || cell == PTRDICT_DELETED_CELL) {
+            continue;
+        }
+        ptrdict_insert_cell(dict, cell - 1);
+        dict->old_cells[ix] = PTRDICT_DELETED_CELL;
+    }
+    if (dict->rehash_ix == dict->old_cell_capacity) {
+        collections_free(dict->allocator, dict->old_cells);
+        dict->old_cells = NULL;
+        dict->old_cell_capacity = 0;
+        dict->rehash_ix = 0;
+    }
+}
+
+static void ptrdict_finish_rehash(ptrdict_t_ *dict) {
+    if (dict->old_cells) {
+        ptrdict_rehash_step(dict, dict->old_cell_capacity);
+    }
+}
+
+static bool ptrdict_set_internal(ptrdict_t_ *dict, void *key, void *value) {
+    if (dict->old_cells) {
+        ptrdict_rehash_step(dict, PTRDICT_REHASH_STEP);
+    }
+    collections_size_t hash = ptrdict_hash_key(key);
+    bool found = false;
+    collections_size_t cell_ix = ptrdict_get_cell_ix(dict, key, hash, &found);
+    if (found) {
+        collections_size_t item_ix = dict->cells[cell_ix] - 1;
+        dict->values[item_ix] = value;
+        return true;
+    }
+    if (dict->old_cells) {
+        collections_size_t old_cell_ix = ptrdict_get_old_cell_ix(dict, key, hash, &found);
+        if (found) {
+            collections_size_t item_ix = dict->old_cells[old_cell_ix] - 1;
+            dict->values[item_ix] = value;
+            return true;
+        }
+    }
+    if (dict->count >= dict->item_capacity) {
+        bool succeeded = ptrdict_grow_and_rehash(dict);
+        if (succeeded == false) {
+            return false;
+        }
+        cell_ix = ptrdict_get_cell_ix(dict, key, hash, &found);
+    }
+    dict->cells[cell_ix] = dict->count + 1;
+    dict->keys[dict->count] = key;
+    dict->values[dict->count] = value;
+    dict->cell_ixs[dict->count] = cell_ix;
+    dict->hashes[dict->count] = hash;
+    dict->count++;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Value dictionary
+//-----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+
+// Same table as dict, values are value_size byte slots in value_data and are
+// moved when items are swapped on removal.
+typedef struct valdict_ {
+    dict_t_ dict;
+} valdict_t_;
+
+// Public
+valdict_t_* valdict_make_(size_t value_size) {
+    return valdict_make_with_capacity(0, value_size);
+}
+
+valdict_t_* valdict_make_with_capacity(collections_size_t capacity, size_t value_size) {
+    return valdict_make_with_allocator(capacity, value_size, NULL);
+}
+
+valdict_t_* valdict_make_with_allocator(collections_size_t capacity, size_t value_size, const collections_allocator_t *allocator) {
+    if (value_size == 0) {
+        return NULL;
+    }
+    return (valdict_t_*)dict_make_with_value_size(capacity, value_size, false, allocator);
+}
+
+void valdict_destroy(valdict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    dict_destroy(&dict->dict);
+}
+
+bool valdict_set(valdict_t_ *dict, const char *key, const void *value) {
+    return valdict_setn(dict, key, strlen(key), value);
+}
+
+bool valdict_setn(valdict_t_ *dict, const char *key, size_t len, const void *value) {
+    unsigned long hash = dict_hash_key(&dict->dict, key, len);
+    return dict_set_internal(&dict->dict, key, len, hash, value);
+}
+
+void *valdict_get(const valdict_t_ *dict, const char *key) {
+    return valdict_getn(dict, key, strlen(key));
+}
+
+void *valdict_getn(const valdict_t_ *dict, const char *key, size_t len) {
+    unsigned long hash = dict_hash_key(&dict->dict, key, len);
+    collections_size_t item_ix = dict_get_item_ix(&dict->dict, key, len, hash);
+    if (item_ix == DICT_INVALID_IX) {
+        return NULL;
+    }
+    return dict->dict.value_data + (size_t)item_ix * dict->dict.value_size;
+}
+
+void *valdict_get_or_add(valdict_t_ *dict, const char *key) {
+    size_t len = strlen(key);
+    unsigned long hash = dict_hash_key(&dict->dict, key, len);
+    bool added = false;
+    collections_size_t item_ix = dict_upsert(&dict->dict, key, len, hash, &added);
+    if (item_ix == DICT_INVALID_IX) {
+        return NULL;
+    }
+    if (added) {
+        dict_store_value(&dict->dict, item_ix, NULL);
+    }
+    return dict->dict.value_data + (size_t)item_ix * dict->dict.value_size;
+}
+
+void *valdict_get_value_at(const valdict_t_ *dict, collections_size_t ix) {
+    if (ix >= dict->dict.count) {
+        return NULL;
+    }
+    return dict->dict.value_data + (size_t)ix * dict->dict.value_size;
+}
+
+const char *valdict_get_key_at(const valdict_t_ *dict, collections_size_t ix) {
+    return dict_get_key_at(&dict->dict, ix);
+}
+
+collections_size_t valdict_count(const valdict_t_ *dict) {
+    if (!dict) {
+        return 0;
+    }
+    return dict->dict.count;
+}
+
+size_t valdict_value_size(const valdict_t_ *dict) {
+    return dict->dict.value_size;
+}
+
+bool valdict_remove(valdict_t_ *dict, const char *key) {
+    return dict_remove(&dict->dict, key);
+}
+
+bool valdict_removen(valdict_t_ *dict, const char *key, size_t len) {
+    return dict_removen(&dict->dict, key, len);
+}
+
+void valdict_clear(valdict_t_ *dict) {
+    dict_clear(&dict->dict);
+}
+
+void valdict_get_stats(const valdict_t_ *dict, dict_stats_t *out_stats) {
+    dict_get_stats(&dict->dict, out_stats);
+}
+
+//-----------------------------------------------------------------------------
+// String set
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same control bytes and key slots as dict, but slots are stored directly in
+// cells, so there are no item arrays, values, cached hashes or cell indices.
+// Hashes are recomputed when rehashing. Removed cells become tombstones
+// (DICT_CTRL_DELETED), which probes skip and rehashing drops.
+typedef struct strset_ {
+    unsigned char *ctrl;
+    dict_key_slot_t *keys;
+    unsigned int count;
+    unsigned int deleted;
+    unsigned int cell_capacity;
+    unsigned long seed;
+    const collections_allocator_t *allocator;
+} strset_t_;
+
+// Private declarations
+static bool strset_init(strset_t_ *set, unsigned int cell_capacity);
+static unsigned long strset_hash_key(const strset_t_ *set, const char *key, size_t len);
+static unsigned int strset_probe(const strset_t_ *set, const char *key, size_t len, unsigned long hash, bool *out_found);
+static bool strset_add_internal(strset_t_ *set, const char *key, size_t len, unsigned long hash);
+static bool strset_resize(strset_t_ *set, unsigned int cell_capacity);
+static const char *strset_cell_key(const strset_t_ *set, unsigned int cell_ix);
+static bool strset_add_members(strset_t_ *dest, const strset_t_ *source, const strset_t_ *filter, bool in_filter);
+
+// Public
+strset_t_* strset_make(void) {
+    return strset_make_with_capacity(0);
+}
+
+strset_t_* strset_make_with_capacity(unsigned int capacity) {
+    return strset_make_with_allocator(capacity, NULL);
+}
+
+strset_t_* strset_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    unsigned int cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return NULL;
+    }
+    strset_t_ *set = collections_alloc(allocator, sizeof(strset_t_));
+    if (set == NULL) {
+        return NULL;
+    }
+    set->seed = dict_hash_default_seed();
+    set->allocator = allocator;
+    if (strset_init(set, cell_capacity) == false) {
+        collections_free(allocator, set);
+        return NULL;
+    }
+    return set;
+}
+
+void strset_destroy(strset_t_ *set) {
+    if (set == NULL) {
+        return;
+    }
+    strset_clear(set);
+    collections_free(set->allocator, set->ctrl);
+    collections_free(set->allocator, set->keys);
+    collections_free(set->allocator, set);
+}
+
+bool strset_reserve(strset_t_ *set, unsigned int capacity) {
+    unsigned int cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    if (cell_capacity <= set->cell_capacity) {
+        return true;
+    }
+    return strset_resize(set, cell_capacity);
+}
+
+bool strset_add(strset_t_ *set, const char *key) {
+    return strset_addn(set, key, strlen(key));
+}
+
+bool strset_addn(strset_t_ *set, const char *key, size_t len) {
+    return strset_add_internal(set, key, len, strset_hash_key(set, key, len));
+}
+
+bool strset_contains(const strset_t_ *set, const char *key) {
+    return strset_containsn(set, key, strlen(key));
+}
+
+bool strset_containsn(const strset_t_ *set, const char *key, size_t len) {
+    bool found = false;
+    strset_probe(set, key, len, strset_hash_key(set, key, len), &found);
+    return found;
+}
+
+bool strset_remove(strset_t_ *set, const char *key) {
+    size_t len = strlen(key);
+    bool found = false;
+    unsigned int cell_ix = strset_probe(set, key, len, strset_hash_key(set, key, len), &found);
+    if (!found) {
+        return false;
+    }
+    dict_free_key(NULL, set->allocator, &set->keys[cell_ix]);
+    // probes stop at the first empty cell, so a cell followed by one isn't part of any other probe
+    unsigned int next_ix = (cell_ix + 1) & (set->cell_capacity - 1);
+    if (set->ctrl[next_ix] == DICT_CTRL_EMPTY) {
+        ctrl_set(set->ctrl, set->cell_capacity, cell_ix, DICT_CTRL_EMPTY);
+    } else {
+        ctrl_set(set->ctrl, set->cell_capacity, cell_ix, DICT_CTRL_DELETED);
+        set->deleted++;
+    }
+    set->count--;
+    return true;
+}
+
+unsigned int strset_count(const strset_t_ *set) {
+    if (!set) {
+        return 0;
+    }
+    return set->count;
+}
+
+const char *strset_next(const strset_t_ *set, unsigned int *cursor) {
+    for (unsigned int i = *cursor; i < set->cell_capacity; i++) {
+        if (set->ctrl[i] & DICT_CTRL_FULL) {
+            *cursor = i + 1;
+            return strset_cell_key(set, i);
+        }
+    }
+    *cursor = set->cell_capacity;
+    return NULL;
+}
+
+void strset_clear(strset_t_ *set) {
+    for (unsigned int i = 0; i < set->cell_capacity; i++) {
+        if (set->ctrl[i] & DICT_CTRL_FULL) {
+            dict_free_key(NULL, set->allocator, &set->keys[i]);
+        }
+    }
+    memset(set->ctrl, DICT_CTRL_EMPTY, set->cell_capacity + DICT_GROUP_WIDTH - 1);
+    set->count = 0;
+    set->deleted = 0;
+}
+
+strset_t_* strset_union(const strset_t_ *a, const strset_t_ *b) {
+    if (a->count > UINT_MAX - b->count) {
+        return NULL;
+    }
+    strset_t_ *res = strset_make_with_allocator(a->count + b->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!strset_add_members(res, a, NULL, false) || !strset_add_members(res, b, NULL, false)) {
+        strset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+strset_t_* strset_intersection(const strset_t_ *a, const strset_t_ *b) {
+    // probing the larger set with members of the smaller one does less work
+    const strset_t_ *smaller = a->count < b->count ? a : b;
+    const strset_t_ *larger = smaller == a ? b : a;
+    strset_t_ *res = strset_make_with_allocator(smaller->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!strset_add_members(res, smaller, larger, true)) {
+        strset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+strset_t_* strset_difference(const strset_t_ *a, const strset_t_ *b) {
+    strset_t_ *res = strset_make_with_allocator(a->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!strset_add_members(res, a, b, false)) {
+        strset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+void strset_get_stats(const strset_t_ *set, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = set->count;
+    out_stats->item_capacity = (unsigned int)(set->cell_capacity * (double)DICT_DEFAULT_MAX_LOAD_FACTOR);
+    out_stats->cell_capacity = set->cell_capacity;
+    out_stats->load_factor = (float)set->count / set->cell_capacity;
+    for (unsigned int i = 0; i < set->cell_capacity; i++) {
+        if ((set->ctrl[i] & DICT_CTRL_FULL) == 0) {
+            continue;
+        }
+        const char *key = strset_cell_key(set, i);
+        size_t len = strlen(key);
+        unsigned int home_ix = strset_hash_key(set, key, len) & (set->cell_capacity - 1);
+        stats_add_displacement(out_stats, (i - home_ix) & (set->cell_capacity - 1));
+        if (dict_key_slot_is_inline(&set->keys[i]) == false) {
+            out_stats->key_data_bytes += len + 1;
+        }
+    }
+    if (set->count > 0) {
+        out_stats->avg_displacement /= set->count;
+    }
+    out_stats->ctrl_bytes = set->cell_capacity + DICT_GROUP_WIDTH - 1;
+    out_stats->keys_bytes = set->cell_capacity * sizeof(*set->keys);
+    out_stats->total_bytes = sizeof(strset_t_) + out_stats->ctrl_bytes
+                           + out_stats->keys_bytes + out_stats->key_data_bytes;
+}
+
+// Private definitions
+static bool strset_init(strset_t_ *set, unsigned int cell_capacity) {
+    set->count = 0;
+    set->deleted = 0;
+    set->cell_capacity = cell_capacity;
+    set->ctrl = collections_calloc(set->allocator, cell_capacity + DICT_GROUP_WIDTH - 1, 1);
+    set->keys = collections_alloc(set->allocator, cell_capacity * sizeof(*set->keys));
+    if (set->ctrl == NULL || set->keys == NULL) {
+        collections_free(set->allocator, set->ctrl);
+        collections_free(set->allocator, set->keys);
+        return false;
+    }
+    return true;
+}
+
+static unsigned long strset_hash_key(const strset_t_ *set, const char *key, size_t len) {
+    return dict_hash_wyhash(key, len, set->seed);
+}
+
+static unsigned int strset_probe(const strset_t_ *set, const char *key, size_t len, unsigned long hash, bool *out_found) {
+    *out_found = false;
+    unsigned int mask = set->cell_capacity - 1;
+    unsigned int cell_ix = hash & mask;
+    unsigned char tag = dict_hash_tag(hash);
+    for (unsigned int i = 0; i < set->cell_capacity; i += DICT_GROUP_WIDTH) {
+        unsigned int group_ix = (cell_ix + i) & mask;
+        unsigned int empty = 0;
+        unsigned int matches = dict_match_group(set->ctrl + group_ix, tag, &empty);
+        if (empty) {
+            matches &= (1u << bit_scan_forward(empty)) - 1;
+        }
+        while (matches) {
+            unsigned int ix = (group_ix + bit_scan_forward(matches)) & mask;
+            if (dict_key_slot_equals(&set->keys[ix], key, len)) {
+                *out_found = true;
+                return ix;
+            }
+            matches &= matches - 1;
+        }
+        if (empty) {
+            return (group_ix + bit_scan_forward(empty)) & mask;
+        }
+    }
+    return UINT_MAX;
+}
+
+static bool strset_add_internal(strset_t_ *set, const char *key, size_t len, unsigned long hash) {
+    bool found = false;
+    unsigned int cell_ix = strset_probe(set, key, len, hash, &found);
+    if (found) {
+        return true;
+    }
+    unsigned int max_count = (unsigned int)(set->cell_capacity * (double)DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (set->count + set->deleted >= max_count) {
+        // sized for live members only, so a table full of tombstones is rehashed in place
+        unsigned int cell_capacity = dict_cell_capacity_for(set->count + 1, DICT_DEFAULT_MAX_LOAD_FACTOR);
+        if (cell_capacity == 0 || strset_resize(set, cell_capacity) == false) {
+            return false;
+        }
+        cell_ix = strset_probe(set, key, len, hash, &found);
+    }
+    if (dict_make_key_slot(NULL, set->allocator, key, len, &set->keys[cell_ix]) == false) {
+        return false;
+    }
+    ctrl_set(set->ctrl, set->cell_capacity, cell_ix, dict_hash_tag(hash));
+    set->count++;
+    return true;
+}
+
+static bool strset_resize(strset_t_ *set, unsigned int cell_capacity) {
+    strset_t_ prev = *set;
+    if (strset_init(set, cell_capacity) == false) {
+        *set = prev;
+        return false;
+    }
+    unsigned int mask = cell_capacity - 1;
+    for (unsigned int i = 0; i < prev.cell_capacity; i++) {
+        if ((prev.ctrl[i] & DICT_CTRL_FULL) == 0) {
+            continue;
+        }
+        const char *key = strset_cell_key(&prev, i);
+        unsigned long hash = strset_hash_key(set, key, strlen(key));
+        unsigned int group_ix = hash & mask;
+        unsigned int empty = 0;
+        dict_match_group(set->ctrl + group_ix, 0, &empty);
+        while (empty == 0) {
+            group_ix = (group_ix + DICT_GROUP_WIDTH) & mask;
+            dict_match_group(set->ctrl + group_ix, 0, &empty);
+        }
+        unsigned int cell_ix = (group_ix + bit_scan_forward(empty)) & mask;
+        set->keys[cell_ix] = prev.keys[i]; // out of line copies move with their slots
+        ctrl_set(set->ctrl, cell_capacity, cell_ix, dict_hash_tag(hash));
+    }
+    set->count = prev.count;
+    collections_free(set->allocator, prev.ctrl);
+    collections_free(set->allocator, prev.keys);
+    return true;
+}
+
+static const char *strset_cell_key(const strset_t_ *set, unsigned int cell_ix) {
+    const dict_key_slot_t *slot = &set->keys[cell_ix];
+    return dict_key_slot_is_inline(slot) ? slot->data : dict_key_slot_ptr(slot);
+}
+
+// Adds members of source to dest, only those whose presence in filter equals in_filter when filter is set.
+// Members are hashed and their home cells prefetched a batch at a time, so cache misses overlap.
+static bool strset_add_members(strset_t_ *dest, const strset_t_ *source, const strset_t_ *filter, bool in_filter) {
+    const char *keys[DICT_BATCH_SIZE];
+    size_t lens[DICT_BATCH_SIZE];
+    unsigned long hashes[DICT_BATCH_SIZE];
+    unsigned int cell_ix = 0;
+    while (cell_ix < source->cell_capacity) {
+        unsigned int batch_count = 0;
+        for (; cell_ix < source->cell_capacity && batch_count < DICT_BATCH_SIZE; cell_ix++) {
+            if ((source->ctrl[cell_ix] & DICT_CTRL_FULL) == 0) {
+                continue;
+            }
+            keys[batch_count] = strset_cell_key(source, cell_ix);
+            lens[batch_count] = strlen(keys[batch_count]);
+            // sets use the default seed, so the hash is usually valid for filter too
+            hashes[batch_count] = strset_hash_key(dest, keys[batch_count], lens[batch_count]);
+            const strset_t_ *probed = filter ? filter : dest;
+            COLLECTIONS_PREFETCH(probed->ctrl + (hashes[batch_count] & (probed->cell_capacity - 1)));
+            batch_count++;
+        }
+        for (unsigned int i = 0; i < batch_count; i++) {
+            if (filter) {
+                bool found = false;
+                unsigned long hash = filter->seed == dest->seed ? hashes[i] : strset_hash_key(filter, keys[i], lens[i]);
+                strset_probe(filter, keys[i], lens[i], hash, &found);
+                if (found != in_filter) {
+                    continue;
+                }
+            }
+            if (strset_add_internal(dest, keys[i], lens[i], hashes[i]) == false) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Pointer set
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linear probing over the members themselves (NULL cells are empty), with
+// ptrdict's pointer hash recomputed whenever it's needed. Removal shifts
+// following members back like dict_remove_cell, so there are no tombstones.
+typedef struct ptrset_ {
+    void **cells;
+    unsigned int count;
+    unsigned int cell_capacity;
+    const collections_allocator_t *allocator;
+} ptrset_t_;
+
+// Private declarations
+static bool ptrset_init(ptrset_t_ *set, unsigned int cell_capacity);
+static unsigned int ptrset_probe(const ptrset_t_ *set, const void *key, bool *out_found);
+static bool ptrset_add_internal(ptrset_t_ *set, void *key);
+static bool ptrset_resize(ptrset_t_ *set, unsigned int cell_capacity);
+static bool ptrset_add_members(ptrset_t_ *dest, const ptrset_t_ *source, const ptrset_t_ *filter, bool in_filter);
+
+// Public
+ptrset_t_* ptrset_make(void) {
+    return ptrset_make_with_capacity(0);
+}
+
+ptrset_t_* ptrset_make_with_capacity(unsigned int capacity) {
+    return ptrset_make_with_allocator(capacity, NULL);
+}
+
+ptrset_t_* ptrset_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    unsigned int cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return NULL;
+    }
+    ptrset_t_ *set = collections_alloc(allocator, sizeof(ptrset_t_));
+    if (set == NULL) {
+        return NULL;
+    }
+    set->allocator = allocator;
+    if (ptrset_init(set, cell_capacity) == false) {
+        collections_free(allocator, set);
+        return NULL;
+    }
+    return set;
+}
+
+void ptrset_destroy(ptrset_t_ *set) {
+    if (set == NULL) {
+        return;
+    }
+    collections_free(set->allocator, set->cells);
+    collections_free(set->allocator, set);
+}
+
+bool ptrset_reserve(ptrset_t_ *set, unsigned int capacity) {
+    unsigned int cell_capacity = dict_cell_capacity_for(capacity, DICT_DEFAULT_MAX_LOAD_FACTOR);
+    if (cell_capacity == 0) {
+        return false;
+    }
+    if (cell_capacity <= set->cell_capacity) {
+        return true;
+    }
+    return ptrset_resize(set, cell_capacity);
+}
+
+bool ptrset_add(ptrset_t_ *set, void *key) {
+    if (key == NULL) {
+        return false;
+    }
+    return ptrset_add_internal(set, key);
+}
+
+bool ptrset_contains(const ptrset_t_ *set, const void *key) {
+    bool found = false;
+    if (key) {
+        ptrset_probe(set, key, &found);
+    }
+    return found;
+}
+
+bool ptrset_remove(ptrset_t_ *set, const void *key) {
+    bool found = false;
+    unsigned int i = key ? ptrset_probe(set, key, &found) : 0;
+    if (!found) {
+        return false;
+    }
+    unsigned int mask = set->cell_capacity - 1;
+    unsigned int j = i;
+    for (unsigned int x = 0; x < mask; x++) {
+        j = (j + 1) & mask;
+        if (set->cells[j] == NULL) {
+            break;
+        }
+        unsigned int k = ptrdict_hash_key(set->cells[j]) & mask;
+        if ((j > i && (k <= i || k > j))
+            || (j < i && (k <= i && k > j))) {
+            set->cells[i] = set->cells[j];
+            i = j;
+        }
+    }
+    set->cells[i] = NULL;
+    set->count--;
+    return true;
+}
+
+unsigned int ptrset_count(const ptrset_t_ *set) {
+    if (!set) {
+        return 0;
+    }
+    return set->count;
+}
+
+void *ptrset_next(const ptrset_t_ *set, unsigned int *cursor) {
+    for (unsigned int i = *cursor; i < set->cell_capacity; i++) {
+        if (set->cells[i]) {
+            *cursor = i + 1;
+            return set->cells[i];
+        }
+    }
+    *cursor = set->cell_capacity;
+    return NULL;
+}
+
+void ptrset_clear(ptrset_t_ *set) {
+    memset(set->cells, 0, set->cell_capacity * sizeof(*set->cells));
+    set->count = 0;
+}
+
+ptrset_t_* ptrset_union(const ptrset_t_ *a, const ptrset_t_ *b) {
+    if (a->count > UINT_MAX - b->count) {
+        return NULL;
+    }
+    ptrset_t_ *res = ptrset_make_with_allocator(a->count + b->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!ptrset_add_members(res, a, NULL, false) || !ptrset_add_members(res, b, NULL, false)) {
+        ptrset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+ptrset_t_* ptrset_intersection(const ptrset_t_ *a, const ptrset_t_ *b) {
+    const ptrset_t_ *smaller = a->count < b->count ? a : b;
+    const ptrset_t_ *larger = smaller == a ? b : a;
+    ptrset_t_ *res = ptrset_make_with_allocator(smaller->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!ptrset_add_members(res, smaller, larger, true)) {
+        ptrset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+ptrset_t_* ptrset_difference(const ptrset_t_ *a, const ptrset_t_ *b) {
+    ptrset_t_ *res = ptrset_make_with_allocator(a->count, a->allocator);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (!ptrset_add_members(res, a, b, false)) {
+        ptrset_destroy(res);
+        return NULL;
+    }
+    return res;
+}
+
+void ptrset_get_stats(const ptrset_t_ *set, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = set->count;
+    out_stats->item_capacity = (unsigned int)(set->cell_capacity * (double)DICT_DEFAULT_MAX_LOAD_FACTOR);
+    out_stats->cell_capacity = set->cell_capacity;
+    out_stats->load_factor = (float)set->count / set->cell_capacity;
+    for (unsigned int i = 0; i < set->cell_capacity; i++) {
+        if (set->cells[i]) {
+            unsigned int home_ix = ptrdict_hash_key(set->cells[i]) & (set->cell_capacity - 1);
+            stats_add_displacement(out_stats, (i - home_ix) & (set->cell_capacity - 1));
+        }
+    }
+    if (set->count > 0) {
+        out_stats->avg_displacement /= set->count;
+    }
+    out_stats->cells_bytes = set->cell_capacity * sizeof(*set->cells);
+    out_stats->total_bytes = sizeof(ptrset_t_) + out_stats->cells_bytes;
+}
+
+// Private definitions
+static bool ptrset_init(ptrset_t_ *set, unsigned int cell_capacity) {
+    set->count = 0;
+    set->cell_capacity = cell_capacity;
+    set->cells = collections_calloc(set->allocator, cell_capacity, sizeof(*set->cells));
+    return set->cells != NULL;
+}
+
+static unsigned int ptrset_probe(const ptrset_t_ *set, const void *key, bool *out_found) {
+    *out_found = false;
+    unsigned int mask = set->cell_capacity - 1;
+    unsigned int cell_ix = ptrdict_hash_key(key) & mask;
+    for (unsigned int i = 0; i < set->cell_capacity; i++) {
+        void *cell = set->cells[cell_ix];
+        if (cell == key) {
+            *out_found = true;
+            return cell_ix;
+        }
+        if (cell == NULL) {
+            return cell_ix;
+        }
+        cell_ix = (cell_ix + 1) & mask;
+    }
+    return UINT_MAX;
+}
+
+static bool ptrset_add_internal(ptrset_t_ *set, void *key) {
+    bool found = false;
+    unsigned int cell_ix = ptrset_probe(set, key, &found);
+    if (found) {
+        return true;
+    }
+    if (set->count >= (unsigned int)(set->cell_capacity * (double)DICT_DEFAULT_MAX_LOAD_FACTOR)) {
+        if (set->cell_capacity > UINT_MAX / 2 || ptrset_resize(set, set->cell_capacity * 2) == false) {
+            return false;
+        }
+        cell_ix = ptrset_probe(set, key, &found);
+    }
+    set->cells[cell_ix] = key;
+    set->count++;
+    return true;
+}
+
+static bool ptrset_resize(ptrset_t_ *set, unsigned int cell_capacity) {
+    ptrset_t_ prev = *set;
+    if (ptrset_init(set, cell_capacity) == false) {
+        *set = prev;
+        return false;
+    }
+    unsigned int mask = cell_capacity - 1;
+    for (unsigned int i = 0; i < prev.cell_capacity; i++) {
+        if (prev.cells[i] == NULL) {
+            continue;
+        }
+        unsigned int cell_ix = ptrdict_hash_key(prev.cells[i]) & mask;
+        while (set->cells[cell_ix]) {
+            cell_ix = (cell_ix + 1) & mask;
+        }
+        set->cells[cell_ix] = prev.cells[i];
+    }
+    set->count = prev.count;
+    collections_free(set->allocator, prev.cells);
+    return true;
+}
+
+// Same as strset_add_members, prefetching home cells of a batch before probing them.
+static bool ptrset_add_members(ptrset_t_ *dest, const ptrset_t_ *source, const ptrset_t_ *filter, bool in_filter) {
+    void *keys[DICT_BATCH_SIZE];
+    const ptrset_t_ *probed = filter ? filter : dest;
+    unsigned int cell_ix = 0;
+    while (cell_ix < source->cell_capacity) {
+        unsigned int batch_count = 0;
+        for (; cell_ix < source->cell_capacity && batch_count < DICT_BATCH_SIZE; cell_ix++) {
+            void *key = source->cells[cell_ix];
+            if (key == NULL) {
+                continue;
+            }
+            keys[batch_count++] = key;
+            COLLECTIONS_PREFETCH(probed->cells + (ptrdict_hash_key(key) & (probed->cell_capacity - 1)));
+        }
+        for (unsigned int i = 0; i < batch_count; i++) {
+            if (filter && ptrset_contains(filter, keys[i]) != in_filter) {
+                continue;
+            }
+            if (ptrset_add_internal(dest, keys[i]) == false) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Concurrent dictionary
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef SRWLOCK cdict_lock_t;
+#define cdict_lock_init(lock) (InitializeSRWLock(lock), true)
+#define cdict_lock_deinit(lock) ((void)(lock))
+#define cdict_lock_read(lock) AcquireSRWLockShared(lock)
+#define cdict_unlock_read(lock) ReleaseSRWLockShared(lock)
+#define cdict_lock_write(lock) AcquireSRWLockExclusive(lock)
+#define cdict_unlock_write(lock) ReleaseSRWLockExclusive(lock)
+#else
+#include <pthread.h>
+typedef pthread_rwlock_t cdict_lock_t;
+#define cdict_lock_init(lock) (pthread_rwlock_init(lock, NULL) == 0)
+#define cdict_lock_deinit(lock) pthread_rwlock_destroy(lock)
+#define cdict_lock_read(lock) pthread_rwlock_rdlock(lock)
+#define cdict_unlock_read(lock) pthread_rwlock_unlock(lock)
+#define cdict_lock_write(lock) pthread_rwlock_wrlock(lock)
+#define cdict_unlock_write(lock) pthread_rwlock_unlock(lock)
+#endif
+
+#define CDICT_DEFAULT_SHARD_COUNT 64
+
+typedef struct {
+    cdict_lock_t lock;
+    dict_t_ *dict;
+    char padding[64]; // keeps locks of neighbouring shards on separate cache lines
+} cdict_shard_t;
+
+typedef struct cdict_ {
+    cdict_shard_t *shards;
+    unsigned int shard_count;
+    const collections_allocator_t *allocator;
+} cdict_t_;
+
+// Private declarations
+static cdict_shard_t *cdict_get_shard(const cdict_t_ *cd, const dict_key_t *key);
+
+// Public
+cdict_t_* cdict_make(unsigned int shard_count) {
+    return cdict_make_with_allocator(shard_count, NULL);
+}
+
+cdict_t_* cdict_make_with_allocator(unsigned int shard_count, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    if (shard_count == 0) {
+        shard_count = CDICT_DEFAULT_SHARD_COUNT;
+    }
+    unsigned int rounded_shard_count = 1;
+    while (rounded_shard_count < shard_count) {
+        if (rounded_shard_count > UINT_MAX / 2) {
+            return NULL;
+        }
+        rounded_shard_count *= 2;
+    }
+    cdict_t_ *dict = collections_alloc(allocator, sizeof(cdict_t_));
+    if (dict == NULL) {
+        return NULL;
+    }
+    dict->shard_count = 0;
+    dict->allocator = allocator;
+    dict->shards = collections_calloc(allocator, rounded_shard_count, sizeof(cdict_shard_t));
+    if (dict->shards == NULL) {
+        collections_free(allocator, dict);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < rounded_shard_count; i++) {
+        cdict_shard_t *shard = &dict->shards[i];
+        shard->dict = dict_make_with_allocator(0, allocator);
+        if (shard->dict == NULL) {
+            cdict_destroy(dict);
+            return NULL;
+        }
+        if (!cdict_lock_init(&shard->lock)) {
+            dict_destroy(shard->dict);
+            cdict_destroy(dict);
+            return NULL;
+        }
+        dict->shard_count++;
+    }
+    return dict;
+}
+
+void cdict_destroy(cdict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    for (unsigned int i = 0; i < dict->shard_count; i++) {
+        cdict_lock_deinit(&dict->shards[i].lock);
+        dict_destroy(dict->shards[i].dict);
+    }
+    collections_free(dict->allocator, dict->shards);
+    collections_free(dict->allocator, dict);
+}
+
+bool cdict_set(cdict_t_ *dict, const char *key, void *value) {
+    return cdict_setn(dict, key, strlen(key), value);
+}
+
+bool cdict_setn(cdict_t_ *dict, const char *key, size_t len, void *value) {
+    dict_key_t key_handle = dict_key_make(NULL, key, len);
+    return cdict_set_with_key(dict, &key_handle, value);
+}
+
+bool cdict_set_with_key(cdict_t_ *dict, const dict_key_t *key, void *value) {
+    cdict_shard_t *shard = cdict_get_shard(dict, key);
+    cdict_lock_write(&shard->lock);
+    bool succeeded = dict_set_with_key(shard->dict, key, value);
+    cdict_unlock_write(&shard->lock);
+    return succeeded;
+}
+
+void *cdict_get(const cdict_t_ *dict, const char *key) {
+    return cdict_getn(dict, key, strlen(key));
+}
+
+void *cdict_getn(const cdict_t_ *dict, const char *key, size_t len) {
+    dict_key_t key_handle = dict_key_make(NULL, key, len);
+    return cdict_get_with_key(dict, &key_handle);
+}
+
+void *cdict_get_with_key(const cdict_t_ *dict, const dict_key_t *key) {
+    cdict_shard_t *shard = cdict_get_shard(dict, key);
+    cdict_lock_read(&shard->lock);
+    void *value = dict_get_with_key(shard->dict, key);
+    cdict_unlock_read(&shard->lock);
+    return value;
+}
+
+collections_size_t cdict_count(const cdict_t_ *dict) {
+    collections_size_t count = 0;
+    for (unsigned int i = 0; i < dict->shard_count; i++) {
+        cdict_shard_t *shard = &dict->shards[i];
+        cdict_lock_read(&shard->lock);
+        count += dict_count(shard->dict);
+        cdict_unlock_read(&shard->lock);
+    }
+    return count;
+}
+
+bool cdict_remove(cdict_t_ *dict, const char *key) {
+    return cdict_removen(dict, key, strlen(key));
+}
+
+bool cdict_removen(cdict_t_ *dict, const char *key, size_t len) {
+    dict_key_t key_handle = dict_key_make(NULL, key, len);
+    return cdict_remove_with_key(dict, &key_handle);
+}
+
+bool cdict_remove_with_key(cdict_t_ *dict, const dict_key_t *key) {
+    cdict_shard_t *shard = cdict_get_shard(dict, key);
+    cdict_lock_write(&shard->lock);
+    bool removed = dict_remove_with_key(shard->dict, key);
+    cdict_unlock_write(&shard->lock);
+    return removed;
+}
+
+void cdict_clear(cdict_t_ *dict) {
+    for (unsigned int i = 0; i < dict->shard_count; i++) {
+        cdict_shard_t *shard = &dict->shards[i];
+        cdict_lock_write(&shard->lock);
+        dict_clear(shard->dict);
+        cdict_unlock_write(&shard->lock);
+    }
+}
+
+// Private definitions
+static cdict_shard_t *cdict_get_shard(const cdict_t_ *dict, const dict_key_t *key) {
+    unsigned long hash = key->hash;
+    if (key->hash_fn != dict_hash_wyhash || key->seed != dict_hash_default_seed()) {
+        hash = dict_hash_wyhash(key->ptr, key->len, dict_hash_default_seed());
+    }
+    // shards use the top bits of a fibonacci mix, cells in a shard use the low bits of hash
+    uint64_t mixed = (uint64_t)hash * 0x9e3779b97f4a7c15ull;
+    return &dict->shards[(unsigned int)(mixed >> 32) & (dict->shard_count - 1)];
+}
+
+//-----------------------------------------------------------------------------
+// Frozen dictionary
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+
+// Keys are hashed into buckets of FROZENDICT_BUCKET_SIZE on average. Every bucket
+// with more than one key gets a displacement that sends all of its keys to free
+// slots, buckets with a single key are put directly into the slots left over and
+// store -(slot + 1). There are exactly as many slots as keys.
+#define FROZENDICT_BUCKET_SIZE 3
+#define FROZENDICT_MAX_DISPLACEMENT (1 << 24)
+#define FROZENDICT_MAX_BUILD_ATTEMPTS 8
+#define FROZENDICT_MAX_COUNT INT_MAX // slots are stored as -(slot + 1) in int displacements
+
+// Everything a lookup needs after finding the slot is on one cache line.
+typedef struct {
+    unsigned int key_offset; // into key_data, keys are NUL terminated
+    unsigned int key_len;
+    void *value;
+} frozendict_slot_t;
+
+typedef struct frozendict_ {
+    int *displacements;
+    unsigned int bucket_count;
+    unsigned int count;
+    frozendict_slot_t *slots;
+    char *key_data;
+    size_t key_data_size;
+    dict_hash_fn hash_fn;
+    unsigned long seed;
+    const collections_allocator_t *allocator; // of everything but build temporaries
+} frozendict_t_;
+
+// Private declarations
+static bool frozendict_build(frozendict_t_ *fd, const uint64_t *hashes, unsigned int *out_slots);
+static frozendict_t_* frozendict_make_internal(const dict_t_ *source, bool wyhash_only, const collections_allocator_t *allocator);
+static unsigned int frozendict_bucket(unsigned int bucket_count, uint64_t hash);
+static unsigned int frozendict_slot_ix(unsigned int count, uint64_t hash, unsigned int displacement);
+static uint64_t frozendict_mix(unsigned long hash);
+
+// Public
+frozendict_t_* frozendict_make(const dict_t_ *source) {
+    return frozendict_make_internal(source, false, NULL);
+}
+
+frozendict_t_* frozendict_make_with_allocator(const dict_t_ *source, const collections_allocator_t *allocator) {
+    return frozendict_make_internal(source, false, allocator);
+}
+
+void frozendict_destroy(frozendict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    collections_free(dict->allocator, dict->displacements);
+    collections_free(dict->allocator, dict->slots);
+    collections_free(dict->allocator, dict->key_data);
+    collections_free(dict->allocator, dict);
+}
+
+void *frozendict_get(const frozendict_t_ *dict, const char *key) {
+    return frozendict_getn(dict, key, strlen(key));
+}
+
+void *frozendict_getn(const frozendict_t_ *dict, const char *key, size_t len) {
+    if (dict->count == 0) {
+        return NULL;
+    }
+    uint64_t hash = frozendict_mix(dict->hash_fn(key, len, dict->seed));
+    int displacement = dict->displacements[frozendict_bucket(dict->bucket_count, hash)];
+    unsigned int slot_ix = 0;
+    if (displacement < 0) {
+        slot_ix = (unsigned int)(-(displacement + 1));
+    } else {
+        slot_ix = frozendict_slot_ix(dict->count, hash, (unsigned int)displacement);
+    }
+    const frozendict_slot_t *slot = &dict->slots[slot_ix];
+    if (slot->key_len != len || memcmp(dict->key_data + slot->key_offset, key, len) != 0) {
+        return NULL;
+    }
+    return slot->value;
+}
+
+void *frozendict_get_value_at(const frozendict_t_ *dict, unsigned int ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict->slots[ix].value;
+}
+
+const char *frozendict_get_key_at(const frozendict_t_ *dict, unsigned int ix) {
+    if (ix >= dict->count) {
+        return NULL;
+    }
+    return dict->key_data + dict->slots[ix].key_offset;
+}
+
+unsigned int frozendict_count(const frozendict_t_ *dict) {
+    if (!dict) {
+        return 0;
+    }
+    return dict->count;
+}
+
+void frozendict_get_stats(const frozendict_t_ *dict, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = dict->count;
+    out_stats->item_capacity = dict->count;
+    out_stats->cell_capacity = dict->count;
+    out_stats->load_factor = dict->count > 0 ? 1.0f : 0.0f;
+    out_stats->displacement_histogram[0] = dict->count;
+    // displacements stand in for cells, slots hold key offsets and values
+    out_stats->cells_bytes = dict->bucket_count * sizeof(*dict->displacements);
+    out_stats->keys_bytes = (dict->count + 1) * sizeof(*dict->slots);
+    out_stats->key_data_bytes = dict->key_data_size;
+    out_stats->total_bytes = sizeof(frozendict_t_)
+                           + out_stats->cells_bytes + out_stats->keys_bytes
+                           + out_stats->key_data_bytes;
+}
+
+// Private definitions
+static frozendict_t_* frozendict_make_internal(const dict_t_ *source, bool wyhash_only, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    if (source->count > FROZENDICT_MAX_COUNT) {
+        return NULL;
+    }
+    frozendict_t_ *dict = collections_alloc(allocator, sizeof(frozendict_t_));
+    if (dict == NULL) {
+        return NULL;
+    }
+    memset(dict, 0, sizeof(frozendict_t_));
+    dict->allocator = allocator;
+    dict->count = (unsigned int)source->count;
+    dict->bucket_count = source->count / FROZENDICT_BUCKET_SIZE + 1;
+    dict->hash_fn = source->hash_fn;
+    dict->seed = source->seed;
+
+    size_t key_data_size = 0;
+    for (unsigned int i = 0; i < source->count; i++) {
+        key_data_size += strlen(dict_item_key(source, i)) + 1;
+    }
+    uint64_t *hashes = malloc((source->count + 1) * sizeof(uint64_t));
+    unsigned int *slots = malloc((source->count + 1) * sizeof(unsigned int));
+    dict->displacements = collections_alloc(allocator, dict->bucket_count * sizeof(*dict->displacements));
+    dict->slots = collections_alloc(allocator, (dict->count + 1) * sizeof(*dict->slots));
+    dict->key_data = collections_alloc(allocator, key_data_size + 1);
+    dict->key_data_size = key_data_size;
+    if (hashes == NULL
+        || slots == NULL
+        || dict->displacements == NULL
+        || dict->slots == NULL
+        || dict->key_data == NULL
+        || key_data_size > UINT_MAX) {
+        goto error;
+    }
+
+    // source's cached hashes are reused, only a failed build (e.g. colliding hashes) rehashes keys.
+    // Compact dicts only keep 32 bits of them.
+    bool reuse_hashes = (wyhash_only == false || source->hash_fn == dict_hash_wyhash) && source->compact == false;
+    bool built = false;
+    for (unsigned int attempt = 0; attempt < FROZENDICT_MAX_BUILD_ATTEMPTS && built == false; attempt++) {
+        if (attempt > 0 || reuse_hashes == false) {
+            dict->hash_fn = dict_hash_wyhash;
+            dict->seed = source->seed + attempt;
+        }
+        for (unsigned int i = 0; i < source->count; i++) {
+            unsigned long hash;
+            if (reuse_hashes && dict->hash_fn == source->hash_fn && dict->seed == source->seed) {
+                hash = source->hashes[i];
+            } else {
+                const char *key = dict_item_key(source, i);
+                hash = dict->hash_fn(key, strlen(key), dict->seed);
+            }
+            hashes[i] = frozendict_mix(hash);
+        }
+        built = frozendict_build(dict, hashes, slots);
+    }
+    if (built == false) {
+        goto error;
+    }
+
+    unsigned int *item_ixs = (unsigned int*)hashes; // hashes aren't needed anymore
+    for (unsigned int i = 0; i < source->count; i++) {
+        item_ixs[slots[i]] = i;
+    }
+    unsigned int offset = 0;
+    for (unsigned int slot_ix = 0; slot_ix < dict->count; slot_ix++) {
+        const char *key = dict_item_key(source, item_ixs[slot_ix]);
+        size_t len = strlen(key);
+        memcpy(dict->key_data + offset, key, len + 1);
+        dict->slots[slot_ix].key_offset = offset;
+        dict->slots[slot_ix].key_len = (unsigned int)len;
+        dict->slots[slot_ix].value = source->values[item_ixs[slot_ix]];
+        offset += (unsigned int)len + 1;
+    }
+    free(hashes);
+    free(slots);
+    return dict;
+error:
+    free(hashes);
+    free(slots);
+    frozendict_destroy(dict);
+    return NULL;
+}
+
+static bool frozendict_build(frozendict_t_ *dict, const uint64_t *hashes, unsigned int *out_slots) {
+    bool succeeded = false;
+    unsigned int *bucket_sizes = calloc(dict->bucket_count, sizeof(unsigned int));
+    unsigned int *bucket_starts = malloc((dict->bucket_count + 1) * sizeof(unsigned int));
+    unsigned int *bucket_items = malloc((dict->count + 1) * sizeof(unsigned int));
+    unsigned int *bucket_order = malloc(dict->bucket_count * sizeof(unsigned int));
+    bool *taken = calloc(dict->count + 1, sizeof(bool));
+    if (bucket_sizes == NULL
+        || bucket_starts == NULL
+        || bucket_items == NULL
+        || bucket_order == NULL
+        || taken == NULL) {
+        goto end;
+    }
+
+    // group items by bucket
+    unsigned int max_bucket_size = 0;
+    for (unsigned int i = 0; i < dict->count; i++) {
+        unsigned int bucket = frozendict_bucket(dict->bucket_count, hashes[i]);
+        bucket_sizes[bucket]++;
+        if (bucket_sizes[bucket] > max_bucket_size) {
+            max_bucket_size = bucket_sizes[bucket];
+        }
+    }
+    bucket_starts[0] = 0;
+    for (unsigned int b = 0; b < dict->bucket_count; b++) {
+        bucket_starts[b + 1] = bucket_starts[b] + bucket_sizes[b];
+        bucket_sizes[b] = 0;
+    }
+    for (unsigned int i = 0; i < dict->count; i++) {
+        unsigned int bucket = frozendict_bucket(dict->bucket_count, hashes[i]);
+        bucket_items[bucket_starts[bucket] + bucket_sizes[bucket]] = i;
+        bucket_sizes[bucket]++;
+    }
+
+    // largest buckets first, while there are still many free slots
+    unsigned int order_count = 0;
+    for (unsigned int size = max_bucket_size; size >= 1; size--) {
+        for (unsigned int b = 0; b < dict->bucket_count; b++) {
+            if (bucket_sizes[b] == size) {
+                bucket_order[order_count++] = b;
+            }
+        }
+    }
+
+    unsigned int next_free_slot = 0;
+    for (unsigned int o = 0; o < order_count; o++) {
+        unsigned int b = bucket_order[o];
+        const unsigned int *items = bucket_items + bucket_starts[b];
+        unsigned int size = bucket_sizes[b];
+        if (size == 1) {
+            while (taken[next_free_slot]) {
+                next_free_slot++;
+            }
+            taken[next_free_slot] = true;
+            out_slots[items[0]] = next_free_slot;
+            dict->displacements[b] = -(int)next_free_slot - 1;
+            continue;
+        }
+        for (unsigned int i = 0; i < size; i++) {
+            for (unsigned int j = i + 1; j < size; j++) {
+                if (hashes[items[i]] == hashes[items[j]]) {
+                    goto end; // no displacement separates them
+                }
+            }
+        }
+        unsigned int displacement = 0;
+        for (; displacement < FROZENDICT_MAX_DISPLACEMENT; displacement++) {
+            unsigned int placed = 0;
+            for (; placed < size; placed++) {
+                unsigned int slot = frozendict_slot_ix(dict->count, hashes[items[placed]], displacement);
+                if (taken[slot]) {
+                    break;
+                }
+                taken[slot] = true;
+                out_slots[items[placed]] = slot;
+            }
+            if (placed == size) {
+                break;
+            }
+            for (unsigned int i = 0; i < placed; i++) {
+                taken[out_slots[items[i]]] = false;
+            }
+        }
+        if (displacement == FROZENDICT_MAX_DISPLACEMENT) {
+            goto end;
+        }
+        dict->displacements[b] = (int)displacement;
+    }
+    for (unsigned int b = 0; b < dict->bucket_count; b++) {
+        if (bucket_sizes[b] == 0) {
+            dict->displacements[b] = 0;
+        }
+    }
+    succeeded = true;
+end:
+    free(bucket_sizes);
+    free(bucket_starts);
+    free(bucket_items);
+    free(bucket_order);
+    free(taken);
+    return succeeded;
+}
+
+static unsigned int frozendict_bucket(unsigned int bucket_count, uint64_t hash) {
+    return (unsigned int)(((hash >> 32) * bucket_count) >> 32);
+}
+
+static unsigned int frozendict_slot_ix(unsigned int count, uint64_t hash, unsigned int displacement) {
+    uint64_t x = wyhash_mix(hash ^ (displacement * 0x9e3779b97f4a7c15ull), 0xe7037ed1a0b428dbull);
+    return (unsigned int)(((x & 0xffffffff) * count) >> 32);
+}
+
+static uint64_t frozendict_mix(unsigned long hash) {
+    // spreads hashes of any width (and quality) over 64 bits
+    return wyhash_mix((uint64_t)hash ^ 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull);
+}
+
+//-----------------------------------------------------------------------------
+// Dictionary snapshot
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DICT_SNAPSHOT_MMAP
+#endif
+
+// File layout, all offsets are from the start of the file and sections are 8 byte aligned:
+// header | displacements (int32 per bucket) | slots | key data | value data
+// Lookups hash keys with dict_hash_wyhash and the stored seed, then probe exactly like frozendict.
+#define DICT_SNAPSHOT_MAGIC "DICTSNAP"
+#define DICT_SNAPSHOT_VERSION 1
+#define DICT_SNAPSHOT_ENDIANNESS 0x01020304
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianness;
+    uint32_t count;
+    uint32_t bucket_count;
+    uint32_t hash_bits; // width of unsigned long on the writing platform
+    uint32_t reserved;
+    uint64_t seed;
+    uint64_t displacements_offset;
+    uint64_t slots_offset;
+    uint64_t key_data_offset;
+    uint64_t value_data_offset;
+    uint64_t file_size;
+} dict_snapshot_header_t;
+
+typedef struct {
+    uint64_t value_offset; // from value_data_offset, values are 8 byte aligned
+    uint32_t value_size;
+    uint32_t key_offset; // from key_data_offset, keys are NUL terminated
+    uint32_t key_len;
+    uint32_t reserved;
+} dict_snapshot_slot_t;
+
+typedef struct dict_snapshot_ {
+    const unsigned char *data;
+    size_t size;
+    bool mapped;
+    const dict_snapshot_header_t *header;
+    const int32_t *displacements;
+    const dict_snapshot_slot_t *slots;
+    const char *key_data;
+    const unsigned char *value_data;
+    const collections_allocator_t *allocator; // of snapshot and data read without mmap
+} dict_snapshot_t;
+
+// Private declarations
+static const void *dict_snapshot_string_value(void *value, size_t *out_size, void *ctx);
+static bool dict_snapshot_write_padding(FILE *fp, uint64_t *offset);
+static bool dict_snapshot_load(dict_snapshot_t *snapshot);
+
+// Public
+bool dict_snapshot_write(const dict_t_ *dict, const char *path, dict_snapshot_value_fn value_fn, void *ctx) {
+    if (value_fn == NULL) {
+        value_fn = dict_snapshot_string_value;
+    }
+    // hash has to be reproducible in other processes, so it can't be a function pointer
+    frozendict_t_ *frozen = frozendict_make_internal(dict, true, NULL);
+    if (frozen == NULL) {
+        return false;
+    }
+    bool succeeded = false;
+    dict_snapshot_slot_t *slots = calloc(frozen->count + 1, sizeof(dict_snapshot_slot_t));
+    int32_t *displacements = malloc((frozen->bucket_count + 1) * sizeof(int32_t));
+    // written next to path and renamed over it, so readers mapping the old file keep
+    // valid pages and a failed write leaves the old file alone
+    size_t tmp_path_size = strlen(path) + 32;
+    char *tmp_path = malloc(tmp_path_size);
+    FILE *fp = NULL;
+    if (slots == NULL || displacements == NULL || tmp_path == NULL) {
+        goto end;
+    }
+#ifdef DICT_SNAPSHOT_MMAP
+    snprintf(tmp_path, tmp_path_size, "%s.tmp.%ld", path, (long)getpid());
+#else
+    snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+#endif
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        goto end;
+    }
+
+    uint64_t value_data_size = 0;
+    for (unsigned int i = 0; i < frozen->count; i++) {
+        size_t value_size = 0;
+        value_fn(frozen->slots[i].value, &value_size, ctx);
+        if (value_size > UINT32_MAX) {
+            goto end;
+        }
+        slots[i].value_offset = value_data_size;
+        slots[i].value_size = (uint32_t)value_size;
+        slots[i].key_offset = frozen->slots[i].key_offset;
+        slots[i].key_len = frozen->slots[i].key_len;
+        value_data_size += (value_size + 7) & ~(uint64_t)7;
+    }
+
+    dict_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DICT_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = DICT_SNAPSHOT_VERSION;
+    header.endianness = DICT_SNAPSHOT_ENDIANNESS;
+    header.count = frozen->count;
+    header.bucket_count = frozen->bucket_count;
+    header.hash_bits = sizeof(unsigned long) * CHAR_BIT;
+    header.seed = frozen->seed;
+    header.displacements_offset = sizeof(header);
+    header.slots_offset = (header.displacements_offset + frozen->bucket_count * sizeof(int32_t) + 7) & ~(uint64_t)7;
+    header.key_data_offset = header.slots_offset + frozen->count * sizeof(dict_snapshot_slot_t);
+    header.value_data_offset = (header.key_data_offset + frozen->key_data_size + 7) & ~(uint64_t)7;
+    header.file_size = header.value_data_offset + value_data_size;
+
+    uint64_t offset = 0;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        goto end;
+    }
+    offset += sizeof(header);
+    for (unsigned int i = 0; i < frozen->bucket_count; i++) {
+        displacements[i] = frozen->displacements[i];
+    }
+    if (fwrite(displacements, sizeof(int32_t), frozen->bucket_count, fp) != frozen->bucket_count) {
+        goto end;
+    }
+    offset += frozen->bucket_count * sizeof(int32_t);
+    if (!dict_snapshot_write_padding(fp, &offset)
+        || fwrite(slots, sizeof(dict_snapshot_slot_t), frozen->count, fp) != frozen->count
+        || fwrite(frozen->key_data, 1, frozen->key_data_size, fp) != frozen->key_data_size) {
+        goto end;
+    }
+    offset += frozen->count * sizeof(dict_snapshot_slot_t) + frozen->key_data_size;
+    for (unsigned int i = 0; i < frozen->count; i++) {
+        if (!dict_snapshot_write_padding(fp, &offset)) {
+            goto end;
+        }
+        size_t value_size = 0;
+        const void *value = value_fn(frozen->slots[i].value, &value_size, ctx);
+        if (value_size > 0 && fwrite(value, 1, value_size, fp) != value_size) {
+            goto end;
+        }
+        offset += value_size;
+    }
+    succeeded = dict_snapshot_write_padding(fp, &offset) && offset == header.file_size && fflush(fp) == 0;
+#ifdef DICT_SNAPSHOT_MMAP
+    succeeded = succeeded && fsync(fileno(fp)) == 0;
+#endif
+end:
+    if (fp && fclose(fp) != 0) {
+        succeeded = false;
+    }
+    if (fp && succeeded) {
+#ifndef DICT_SNAPSHOT_MMAP
+        remove(path); // rename doesn't replace existing files everywhere
+#endif
+        succeeded = rename(tmp_path, path) == 0;
+    }
+    if (fp && !succeeded) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(slots);
+    free(displacements);
+    frozendict_destroy(frozen);
+    return succeeded;
+}
+
+dict_snapshot_t* dict_snapshot_open(const char *path) {
+    return dict_snapshot_open_with_allocator(path, NULL);
+}
+
+dict_snapshot_t* dict_snapshot_open_with_allocator(const char *path, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    dict_snapshot_t *snapshot = collections_alloc(allocator, sizeof(dict_snapshot_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    memset(snapshot, 0, sizeof(dict_snapshot_t));
+    snapshot->allocator = allocator;
+#ifdef DICT_SNAPSHOT_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        collections_free(allocator, snapshot);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        collections_free(allocator, snapshot);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // mapping keeps the file alive
+    if (data == MAP_FAILED) {
+        collections_free(allocator, snapshot);
+        return NULL;
+    }
+    snapshot->data = data;
+    snapshot->size = (size_t)st.st_size;
+    snapshot->mapped = true;
+#else
+    // no mmap, file is read into memory instead
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        collections_free(allocator, snapshot);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = size > 0 ? collections_alloc(allocator, (size_t)size) : NULL;
+    if (data == NULL || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        collections_free(allocator, data);
+        fclose(fp);
+        collections_free(allocator, snapshot);
+        return NULL;
+    }
+    fclose(fp);
+    snapshot->data = data;
+    snapshot->size = (size_t)size;
+    snapshot->mapped = false;
+#endif
+    if (dict_snapshot_load(snapshot) == false) {
+        dict_snapshot_close(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+void dict_snapshot_close(dict_snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+#ifdef DICT_SNAPSHOT_MMAP
+    if (snapshot->mapped) {
+        munmap((void*)snapshot->data, snapshot->size);
+    }
+#endif
+    if (snapshot->mapped == false) {
+        collections_free(snapshot->allocator, (void*)snapshot->data);
+    }
+    collections_free(snapshot->allocator, snapshot);
+}
+
+const void *dict_snapshot_get(const dict_snapshot_t *snapshot, const char *key) {
+    return dict_snapshot_getn(snapshot, key, strlen(key), NULL);
+}
+
+const void *dict_snapshot_getn(const dict_snapshot_t *snapshot, const char *key, size_t len, size_t *out_size) {
+    const dict_snapshot_header_t *header = snapshot->header;
+    if (header->count == 0) {
+        return NULL;
+    }
+    uint64_t hash = frozendict_mix(dict_hash_wyhash(key, len, (unsigned long)header->seed));
+    int32_t displacement = snapshot->displacements[frozendict_bucket(header->bucket_count, hash)];
+    unsigned int slot_ix = 0;
+    if (displacement < 0) {
+        slot_ix = (unsigned int)(-(displacement + 1));
+    } else {
+        slot_ix = frozendict_slot_ix(header->count, hash, (unsigned int)displacement);
+    }
+    const dict_snapshot_slot_t *slot = &snapshot->slots[slot_ix];
+    if (slot->key_len != len || memcmp(snapshot->key_data + slot->key_offset, key, len) != 0) {
+        return NULL;
+    }
+    if (out_size) {
+        *out_size = slot->value_size;
+    }
+    if (slot->value_size == 0) {
+        return NULL; // NULL values are stored without bytes, value_offset is the next value's
+    }
+    return snapshot->value_data + slot->value_offset;
+}
+
+const void *dict_snapshot_get_value_at(const dict_snapshot_t *snapshot, unsigned int ix) {
+    if (ix >= snapshot->header->count) {
+        return NULL;
+    }
+    if (snapshot->slots[ix].value_size == 0) {
+        return NULL;
+    }
+    return snapshot->value_data + snapshot->slots[ix].value_offset;
+}
+
+const char *dict_snapshot_get_key_at(const dict_snapshot_t *snapshot, unsigned int ix) {
+    if (ix >= snapshot->header->count) {
+        return NULL;
+    }
+    return snapshot->key_data + snapshot->slots[ix].key_offset;
+}
+
+unsigned int dict_snapshot_count(const dict_snapshot_t *snapshot) {
+    if (!snapshot) {
+        return 0;
+    }
+    return snapshot->header->count;
+}
+
+// Private definitions
+static const void *dict_snapshot_string_value(void *value, size_t *out_size, void *ctx) {
+    (void)ctx;
+    *out_size = value ? strlen(value) + 1 : 0;
+    return value;
+}
+
+static bool dict_snapshot_write_padding(FILE *fp, uint64_t *offset) {
+    static const char zeros[8] = {0};
+    size_t padding = (size_t)((8 - (*offset & 7)) & 7);
+    if (padding > 0 && fwrite(zeros, 1, padding, fp) != padding) {
+        return false;
+    }
+    *offset += padding;
+    return true;
+}
+
+static bool dict_snapshot_load(dict_snapshot_t *snapshot) {
+    // only the layout is validated, contents of sections are trusted
+    if (snapshot->size < sizeof(dict_snapshot_header_t)) {
+        return false;
+    }
+    const dict_snapshot_header_t *header = (const dict_snapshot_header_t*)snapshot->data;
+    if (memcmp(header->magic, DICT_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != DICT_SNAPSHOT_VERSION
+        || header->endianness != DICT_SNAPSHOT_ENDIANNESS
+        || header->hash_bits != sizeof(unsigned long) * CHAR_BIT
+        || header->file_size != snapshot->size
+        || header->displacements_offset + (uint64_t)header->bucket_count * sizeof(int32_t) > header->slots_offset
+        || header->slots_offset + (uint64_t)header->count * sizeof(dict_snapshot_slot_t) > header->key_data_offset
+        || header->key_data_offset > header->value_data_offset
+        || header->value_data_offset > header->file_size) {
+        return false;
+    }
+    snapshot->header = header;
+    snapshot->displacements = (const int32_t*)(snapshot->data + header->displacements_offset);
+    snapshot->slots = (const dict_snapshot_slot_t*)(snapshot->data + header->slots_offset);
+    snapshot->key_data = (const char*)(snapshot->data + header->key_data_offset);
+    snapshot->value_data = snapshot->data + header->value_data_offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Persistent dictionary
+//-----------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+typedef volatile long pdict_refs_t;
+#define pdict_refs_inc(refs) InterlockedIncrement(refs)
+#define pdict_refs_dec(refs) InterlockedDecrement(refs)
+#define pdict_refs_load(refs) InterlockedCompareExchange(refs, 0, 0)
+#else
+typedef unsigned int pdict_refs_t;
+#define pdict_refs_inc(refs) __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED)
+#define pdict_refs_dec(refs) __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL)
+#define pdict_refs_load(refs) __atomic_load_n(refs, __ATOMIC_ACQUIRE)
+#endif
+
+// Hash array mapped trie, every level indexes a node with the next PDICT_BITS
+// bits of a key's hash. Nodes and keys are reference counted and shared between
+// snapshots. Writers modify a node in place only if it's exclusively owned, as is
+// then every node above it, and copy shared ones first, so a set or remove copies
+// at most one node per level. Keys whose hashes are equal end up in a collision
+// node past the last level, which keeps its entry count in data_map.
+#define PDICT_BITS 5
+#define PDICT_HASH_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define PDICT_MAX_DEPTH (PDICT_HASH_BITS / PDICT_BITS + 2)
+
+typedef struct {
+    pdict_refs_t refs;
+    unsigned long hash;
+    size_t len;
+    char data[];
+} pdict_key_t;
+
+// slots hold a (key, value) pair per bit of data_map followed by a child per bit of node_map
+typedef struct pdict_node_ {
+    pdict_refs_t refs;
+    uint32_t data_map;
+    uint32_t node_map;
+    void *slots[];
+} pdict_node_t;
+
+typedef struct pdict_ {
+    pdict_node_t *root;
+    unsigned int count;
+    unsigned long seed;
+    const collections_allocator_t *allocator; // shared with snapshots
+} pdict_t_;
+
+// Private declarations
+static pdict_t_* pdict_make_handle(const collections_allocator_t *allocator, pdict_node_t *root, unsigned int count, unsigned long seed);
+static pdict_key_t *pdict_key_make(const collections_allocator_t *allocator, const char *key, size_t len, unsigned long hash);
+static bool pdict_key_equals(const pdict_key_t *pkey, const char *key, size_t len, unsigned long hash);
+static void pdict_key_release(const collections_allocator_t *allocator, pdict_key_t *pkey);
+static pdict_node_t *pdict_node_alloc(const collections_allocator_t *allocator, unsigned int data_count, unsigned int node_count);
+static pdict_node_t *pdict_node_copy(const collections_allocator_t *allocator, const pdict_node_t *node, unsigned int shift);
+static void pdict_node_release(const collections_allocator_t *allocator, pdict_node_t *node, unsigned int shift);
+static void pdict_node_free_shells(const collections_allocator_t *allocator, pdict_node_t *node, unsigned int shift);
+static pdict_node_t *pdict_node_make_pair(const collections_allocator_t *allocator, pdict_key_t *key_a, void *value_a, pdict_key_t *key_b, void *value_b, unsigned int shift);
+static pdict_node_t *pdict_own(const collections_allocator_t *allocator, pdict_node_t **ref, unsigned int shift);
+static bool pdict_find(const pdict_t_ *pd, const char *key, size_t len, unsigned long hash, void **out_value);
+static void pdict_compact_path(const collections_allocator_t *allocator, pdict_node_t ***refs, unsigned int depth);
+static void pdict_node_foreach(const pdict_node_t *node, unsigned int shift, pdict_item_fn fn, void *ctx);
+static void pdict_node_add_stats(const pdict_node_t *node, unsigned int shift, dict_stats_t *stats);
+static unsigned int pdict_data_count(const pdict_node_t *node, unsigned int shift);
+static unsigned int pdict_node_count(const pdict_node_t *node);
+static uint32_t pdict_hash_bit(unsigned long hash, unsigned int shift);
+static unsigned int pdict_popcount(uint32_t x);
+
+// Public
+pdict_t_* pdict_make(void) {
+    return pdict_make_with_allocator(NULL);
+}
+
+pdict_t_* pdict_make_with_allocator(const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    pdict_node_t *root = pdict_node_alloc(allocator, 0, 0);
+    if (root == NULL) {
+        return NULL;
+    }
+    pdict_t_ *dict = pdict_make_handle(allocator, root, 0, dict_hash_default_seed());
+    if (dict == NULL) {
+        collections_free(allocator, root);
+        return NULL;
+    }
+    return dict;
+}
+
+pdict_t_* pdict_make_from_dict(const dict_t_ *source) {
+    if (dict_count(source) > UINT_MAX) {
+        return NULL;
+    }
+    pdict_t_ *dict = pdict_make();
+    if (dict == NULL) {
+        return NULL;
+    }
+    for (collections_size_t i = 0; i < dict_count(source); i++) {
+        if (pdict_set(dict, dict_get_key_at(source, i), dict_get_value_at(source, i)) == false) {
+            pdict_destroy(dict);
+            return NULL;
+        }
+    }
+    return dict;
+}
+
+pdict_t_* pdict_snapshot(const pdict_t_ *dict) {
+    pdict_t_ *snapshot = pdict_make_handle(dict->allocator, dict->root, dict->count, dict->seed);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    pdict_refs_inc(&dict->root->refs);
+    return snapshot;
+}
+
+void pdict_destroy(pdict_t_ *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    pdict_node_release(dict->allocator, dict->root, 0);
+    collections_free(dict->allocator, dict);
+}
+
+bool pdict_set(pdict_t_ *dict, const char *key, void *value) {
+    return pdict_setn(dict, key, strlen(key), value);
+}
+
+bool pdict_setn(pdict_t_ *dict, const char *key, size_t len, void *value) {
+    unsigned long hash = dict_hash_wyhash(key, len, dict->seed);
+    pdict_node_t **ref = &dict->root;
+    for (unsigned int shift = 0; ; shift += PDICT_BITS) {
+        pdict_node_t *node = pdict_own(dict->allocator, ref, shift);
+        if (node == NULL) {
+            return false;
+        }
+        unsigned int data_count = pdict_data_count(node, shift);
+        unsigned int node_count = pdict_node_count(node);
+        unsigned int data_ix = 0;
+        uint32_t bit = 0;
+        if (shift >= PDICT_HASH_BITS) {
+            for (data_ix = 0; data_ix < data_count; data_ix++) {
+                if (pdict_key_equals(node->slots[data_ix * 2], key, len, hash)) {
+                    node->slots[data_ix * 2 + 1] = value;
+                    return true;
+                }
+            }
+        } else {
+            bit = pdict_hash_bit(hash, shift);
+            data_ix = pdict_popcount(node->data_map & (bit - 1));
+            if (node->node_map & bit) {
+                ref = (pdict_node_t**)&node->slots[data_count * 2 + pdict_popcount(node->node_map & (bit - 1))];
+                continue;
+            }
+            if ((node->data_map & bit) && pdict_key_equals(node->slots[data_ix * 2], key, len, hash)) {
+                node->slots[data_ix * 2 + 1] = value;
+                return true;
+            }
+        }
+
+        pdict_key_t *new_key = pdict_key_make(dict->allocator, key, len, hash);
+        if (new_key == NULL) {
+            return false;
+        }
+        pdict_node_t *new_node = NULL;
+        if (bit && (node->data_map & bit)) {
+            // slot is taken by another key, both move to a new child
+            pdict_node_t *child = pdict_node_make_pair(dict->allocator, node->slots[data_ix * 2], node->slots[data_ix * 2 + 1],
+                                                       new_key, value, shift + PDICT_BITS);
+            new_node = child ? pdict_node_alloc(dict->allocator, data_count - 1, node_count + 1) : NULL;
+            if (new_node == NULL) {
+                pdict_node_free_shells(dict->allocator, child, shift + PDICT_BITS);
+                pdict_key_release(dict->allocator, new_key);
+                return false;
+            }
+            unsigned int child_ix = pdict_popcount(node->node_map & (bit - 1));
+            void **dst = new_node->slots;
+            memcpy(dst, node->slots, data_ix * 2 * sizeof(void*));
+            memcpy(dst + data_ix * 2, node->slots + (data_ix + 1) * 2, (data_count - data_ix - 1) * 2 * sizeof(void*));
+            dst += (data_count - 1) * 2;
+            memcpy(dst, node->slots + data_count * 2, child_ix * sizeof(void*));
+            dst[child_ix] = child;
+            memcpy(dst + child_ix + 1, node->slots + data_count * 2 + child_ix, (node_count - child_ix) * sizeof(void*));
+            new_node->data_map = node->data_map & ~bit;
+            new_node->node_map = node->node_map | bit;
+        } else {
+            new_node = pdict_node_alloc(dict->allocator, data_count + 1, node_count);
+            if (new_node == NULL) {
+                pdict_key_release(dict->allocator, new_key);
+                return false;
+            }
+            memcpy(new_node->slots, node->slots, data_ix * 2 * sizeof(void*));
+            new_node->slots[data_ix * 2] = new_key;
+            new_node->slots[data_ix * 2 + 1] = value;
+            memcpy(new_node->slots + (data_ix + 1) * 2, node->slots + data_ix * 2,
+                   ((data_count - data_ix) * 2 + node_count) * sizeof(void*));
+            new_node->data_map = bit ? node->data_map | bit : data_count + 1;
+            new_node->node_map = node->node_map;
+        }
+        // node is exclusively owned, its keys and children moved to new_node
+        collections_free(dict->allocator, node);
+        *ref = new_node;
+        dict->count++;
+        return true;
+    }
+}
+
+void *pdict_get(const pdict_t_ *dict, const char *key) {
+    return pdict_getn(dict, key, strlen(key));
+}
+
+void *pdict_getn(const pdict_t_ *dict, const char *key, size_t len) {
+    void *value = NULL;
+    pdict_find(dict, key, len, dict_hash_wyhash(key, len, dict->seed), &value);
+    return value;
+}
+
+bool pdict_contains(const pdict_t_ *dict, const char *key) {
+    size_t len = strlen(key);
+    return pdict_find(dict, key, len, dict_hash_wyhash(key, len, dict->seed), NULL);
+}
+
+unsigned int pdict_count(const pdict_t_ *dict) {
+    if (!dict) {
+        return 0;
+    }
+    return dict->count;
+}
+
+bool pdict_remove(pdict_t_ *dict, const char *key) {
+    return pdict_removen(dict, key, strlen(key));
+}
+
+bool pdict_removen(pdict_t_ *dict, const char *key, size_t len) {
+    unsigned long hash = dict_hash_wyhash(key, len, dict->seed);
+    if (pdict_find(dict, key, len, hash, NULL) == false) {
+        return false; // nothing is copied for missing keys
+    }
+    pdict_node_t **refs[PDICT_MAX_DEPTH];
+    refs[0] = &dict->root;
+    for (unsigned int depth = 0, shift = 0; ; depth++, shift += PDICT_BITS) {
+        pdict_node_t *node = pdict_own(dict->allocator, refs[depth], shift);
+        if (node == NULL) {
+            return false;
+        }
+        unsigned int data_count = pdict_data_count(node, shift);
+        unsigned int data_ix = 0;
+        if (shift >= PDICT_HASH_BITS) {
+            while (pdict_key_equals(node->slots[data_ix * 2], key, len, hash) == false) {
+                data_ix++;
+            }
+            node->data_map--;
+        } else {
+            uint32_t bit = pdict_hash_bit(hash, shift);
+            if (node->node_map & bit) {
+                refs[depth + 1] = (pdict_node_t**)&node->slots[data_count * 2 + pdict_popcount(node->node_map & (bit - 1))];
+                continue;
+            }
+            data_ix = pdict_popcount(node->data_map & (bit - 1));
+            node->data_map &= ~bit;
+        }
+        // removed in place, the node just keeps the unused space
+        pdict_key_release(dict->allocator, node->slots[data_ix * 2]);
+        memmove(node->slots + data_ix * 2, node->slots + (data_ix + 1) * 2,
+                ((data_count - data_ix - 1) * 2 + pdict_node_count(node)) * sizeof(void*));
+        dict->count--;
+        pdict_compact_path(dict->allocator, refs, depth);
+        return true;
+    }
+}
+
+void pdict_foreach(const pdict_t_ *dict, pdict_item_fn fn, void *ctx) {
+    pdict_node_foreach(dict->root, 0, fn, ctx);
+}
 
-// Public
-dict_t_* dict_make(void) {
-    dict_t_ *dict = malloc(sizeof(dict_t_));
+void pdict_get_stats(const pdict_t_ *dict, dict_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->count = dict->count;
+    pdict_node_add_stats(dict->root, 0, out_stats);
+    out_stats->total_bytes = sizeof(pdict_t_) + out_stats->cells_bytes + out_stats->keys_bytes + out_stats->key_data_bytes;
+}
+
+// Private definitions
+static pdict_t_* pdict_make_handle(const collections_allocator_t *allocator, pdict_node_t *root, unsigned int count, unsigned long seed) {
+    pdict_t_ *dict = collections_alloc(allocator, sizeof(pdict_t_));
     if (dict == NULL) {
         return NULL;
     }
-    bool succeeded = dict_init(dict, 16);
-    if (succeeded == false) {
-        free(dict);
-        return NULL;
-    }
+    dict->root = root;
+    dict->count = count;
+    dict->seed = seed;
+    dict->allocator = allocator;
     return dict;
 }
 
-void dict_destroy(dict_t_ *dict) {
-    if (dict == NULL) {
-        return;
+static pdict_key_t *pdict_key_make(const collections_allocator_t *allocator, const char *key, size_t len, unsigned long hash) {
+    pdict_key_t *pkey = collections_alloc(allocator, sizeof(pdict_key_t) + len + 1);
+    if (pkey == NULL) {
+        return NULL;
     }
-    dict_deinit(dict, true);
-    free(dict);
+    pkey->refs = 1;
+    pkey->hash = hash;
+    pkey->len = len;
+    memcpy(pkey->data, key, len);
+    pkey->data[len] = '\0';
+    return pkey;
 }
 
-bool dict_set(dict_t_ *dict, const char *key, void *value) {
-    return dict_set_internal(dict, key, NULL, value);
+static bool pdict_key_equals(const pdict_key_t *pkey, const char *key, size_t len, unsigned long hash) {
+    return pkey->hash == hash && pkey->len == len && memcmp(pkey->data, key, len) == 0;
 }
 
-void *dict_get(const dict_t_ *dict, const char *key) {
-    unsigned long hash = hash_string(key);
-    bool found = false;
-    unsigned long cell_ix = dict_get_cell_ix(dict, key, hash, &found);
-    if (found == false) {
-        return NULL;
+static void pdict_key_release(const collections_allocator_t *allocator, pdict_key_t *pkey) {
+    if (pdict_refs_dec(&pkey->refs) == 0) {
+        collections_free(allocator, pkey);
     }
-    unsigned int item_ix = dict->cells[cell_ix];
-    return dict->values[item_ix];
 }
 
-void *dict_get_value_at(const dict_t_ *dict, unsigned int ix) {
-    if (ix >= dict->count) {
+static pdict_node_t *pdict_node_alloc(const collections_allocator_t *allocator, unsigned int data_count, unsigned int node_count) {
+    pdict_node_t *node = collections_alloc(allocator, sizeof(pdict_node_t) + (data_count * 2 + node_count) * sizeof(void*));
+    if (node == NULL) {
         return NULL;
     }
-    return dict->values[ix];
+    node->refs = 1;
+    node->data_map = 0;
+    node->node_map = 0;
+    return node;
 }
 
-const char *dict_get_key_at(const dict_t_ *dict, unsigned int ix) {
-    if (ix >= dict->count) {
+static pdict_node_t *pdict_node_copy(const collections_allocator_t *allocator, const pdict_node_t *node, unsigned int shift) {
+    unsigned int data_count = pdict_data_count(node, shift);
+    unsigned int node_count = pdict_node_count(node);
+    pdict_node_t *copy = pdict_node_alloc(allocator, data_count, node_count);
+    if (copy == NULL) {
         return NULL;
     }
-    return dict->keys[ix];
+    copy->data_map = node->data_map;
+    copy->node_map = node->node_map;
+    memcpy(copy->slots, node->slots, (data_count * 2 + node_count) * sizeof(void*));
+    for (unsigned int i = 0; i < data_count; i++) {
+        pdict_key_t *pkey = copy->slots[i * 2];
+        pdict_refs_inc(&pkey->refs);
+    }
+    for (unsigned int i = 0; i < node_count; i++) {
+        pdict_node_t *child = copy->slots[data_count * 2 + i];
+        pdict_refs_inc(&child->refs);
+    }
+    return copy;
 }
 
-unsigned int dict_count(const dict_t_ *dict) {
-    if (!dict) {
-        return 0;
+static void pdict_node_release(const collections_allocator_t *allocator, pdict_node_t *node, unsigned int shift) {
+    if (pdict_refs_dec(&node->refs) != 0) {
+        return;
     }
-    return dict->count;
+    unsigned int data_count = pdict_data_count(node, shift);
+    for (unsigned int i = 0; i < data_count; i++) {
+        pdict_key_release(allocator, node->slots[i * 2]);
+    }
+    for (unsigned int i = 0; i < pdict_node_count(node); i++) {
+        pdict_node_release(allocator, node->slots[data_count * 2 + i], shift + PDICT_BITS);
+    }
+    collections_free(allocator, node);
 }
 
-bool dict_remove(dict_t_ *dict, const char *key) {
-    unsigned long hash = hash_string(key);
-    bool found = false;
-    unsigned int cell = dict_get_cell_ix(dict, key, hash, &found);
-    if (!found) {
-        return false;
+// Frees a chain made by pdict_node_make_pair, without releasing keys it doesn't own.
+static void pdict_node_free_shells(const collections_allocator_t *allocator, pdict_node_t *node, unsigned int shift) {
+    if (node == NULL) {
+        return;
     }
-
-    unsigned int item_ix = dict->cells[cell];
-    free(dict->keys[item_ix]);
-    unsigned int last_item_ix = dict->count - 1;
-    if (item_ix < last_item_ix) {
-        dict->keys[item_ix] = dict->keys[last_item_ix];
-        dict->values[item_ix] = dict->values[last_item_ix];
-        dict->cell_ixs[item_ix] = dict->cell_ixs[last_item_ix];
-        dict->hashes[item_ix] = dict->hashes[last_item_ix];
-        dict->cells[dict->cell_ixs[item_ix]] = item_ix;
+    if (pdict_node_count(node) > 0) {
+        pdict_node_free_shells(allocator, node->slots[pdict_data_count(node, shift) * 2], shift + PDICT_BITS);
     }
-    dict->count--;
+    collections_free(allocator, node);
+}
 
-    unsigned int i = cell;
-    unsigned int j = i;
-    for (unsigned int x = 0; x < (dict->cell_capacity - 1); x++) {
-        j = (j + 1) & (dict->cell_capacity - 1);
-        if (dict->cells[j] == DICT_INVALID_IX) {
-            break;
-        }
-        unsigned int k = dict->hashes[dict->cells[j]] & (dict->cell_capacity - 1);
-        if ((j > i && (k <= i || k > j))
-            || (j < i && (k <= i && k > j))) {
-            dict->cell_ixs[dict->cells[j]] = i;
-            dict->cells[i] = dict->cells[j];
-            i = j;
+static pdict_node_t *pdict_node_make_pair(const collections_allocator_t *allocator, pdict_key_t *key_a, void *value_a, pdict_key_t *key_b, void *value_b, unsigned int shift) {
+    if (shift >= PDICT_HASH_BITS) {
+        pdict_node_t *node = pdict_node_alloc(allocator, 2, 0);
+        if (node == NULL) {
+            return NULL;
         }
+        node->data_map = 2;
+        node->slots[0] = key_a;
+        node->slots[1] = value_a;
+        node->slots[2] = key_b;
+        node->slots[3] = value_b;
+        return node;
     }
-    dict->cells[i] = DICT_INVALID_IX;
-    return true;
-}
-
-void dict_clear(dict_t_ *dict) {
-    for (unsigned int i = 0; i < dict->count; i++) {
-        free(dict->keys[i]);
+    uint32_t bit_a = pdict_hash_bit(key_a->hash, shift);
+    uint32_t bit_b = pdict_hash_bit(key_b->hash, shift);
+    if (bit_a == bit_b) {
+        pdict_node_t *child = pdict_node_make_pair(allocator, key_a, value_a, key_b, value_b, shift + PDICT_BITS);
+        pdict_node_t *node = child ? pdict_node_alloc(allocator, 0, 1) : NULL;
+        if (node == NULL) {
+            pdict_node_free_shells(allocator, child, shift + PDICT_BITS);
+            return NULL;
+        }
+        node->node_map = bit_a;
+        node->slots[0] = child;
+        return node;
     }
-    dict->count = 0;
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        dict->cells[i] = DICT_INVALID_IX;
+    pdict_node_t *node = pdict_node_alloc(allocator, 2, 0);
+    if (node == NULL) {
+        return NULL;
     }
+    node->data_map = bit_a | bit_b;
+    unsigned int a_ix = bit_a < bit_b ? 0 : 1;
+    node->slots[a_ix * 2] = key_a;
+    node->slots[a_ix * 2 + 1] = value_a;
+    node->slots[(1 - a_ix) * 2] = key_b;
+    node->slots[(1 - a_ix) * 2 + 1] = value_b;
+    return node;
 }
 
-// Private definitions
-static bool dict_init(dict_t_ *dict, unsigned int initial_capacity) {
-    // todo: check initial capacity is a power of 2
-    dict->cells = NULL;
-    dict->keys = NULL;
-    dict->values = NULL;
-    dict->cell_ixs = NULL;
-    dict->hashes = NULL;
-
-    dict->count = 0;
-    dict->cell_capacity = initial_capacity;
-    dict->item_capacity = (unsigned int)(initial_capacity * 0.7f);
-
-    dict->cells = malloc(dict->cell_capacity * sizeof(*dict->cells));
-    dict->keys = malloc(dict->item_capacity * sizeof(*dict->keys));
-    dict->values = malloc(dict->item_capacity * sizeof(*dict->values));
-    dict->cell_ixs = malloc(dict->item_capacity * sizeof(*dict->cell_ixs));
-    dict->hashes = malloc(dict->item_capacity * sizeof(*dict->hashes));
-    if (dict->cells == NULL
-        || dict->keys == NULL
-        || dict->values == NULL
-        || dict->cell_ixs == NULL
-        || dict->hashes == NULL) {
-        goto error;
+// Makes node referenced by ref exclusively owned, copying it if it's shared.
+// Node holding ref has to be exclusively owned already.
+static pdict_node_t *pdict_own(const collections_allocator_t *allocator, pdict_node_t **ref, unsigned int shift) {
+    pdict_node_t *node = *ref;
+    if (pdict_refs_load(&node->refs) == 1) {
+        return node;
     }
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        dict->cells[i] = DICT_INVALID_IX;
+    pdict_node_t *copy = pdict_node_copy(allocator, node, shift);
+    if (copy == NULL) {
+        return NULL;
     }
-    return true;
-error:
-    free(dict->cells);
-    free(dict->keys);
-    free(dict->values);
-    free(dict->cell_ixs);
-    free(dict->hashes);
-    return false;
+    *ref = copy;
+    pdict_node_release(allocator, node, shift);
+    return copy;
 }
 
-static void dict_deinit(dict_t_ *dict, bool free_keys) {
-    if (free_keys) {
-        for (unsigned int i = 0; i < dict->count; i++) {
-            free(dict->keys[i]);
+static bool pdict_find(const pdict_t_ *dict, const char *key, size_t len, unsigned long hash, void **out_value) {
+    const pdict_node_t *node = dict->root;
+    for (unsigned int shift = 0; ; shift += PDICT_BITS) {
+        unsigned int data_count = pdict_data_count(node, shift);
+        if (shift >= PDICT_HASH_BITS) {
+            for (unsigned int i = 0; i < data_count; i++) {
+                if (pdict_key_equals(node->slots[i * 2], key, len, hash)) {
+                    if (out_value) {
+                        *out_value = node->slots[i * 2 + 1];
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+        uint32_t bit = pdict_hash_bit(hash, shift);
+        if (node->data_map & bit) {
+            unsigned int ix = pdict_popcount(node->data_map & (bit - 1));
+            if (pdict_key_equals(node->slots[ix * 2], key, len, hash) == false) {
+                return false;
+            }
+            if (out_value) {
+                *out_value = node->slots[ix * 2 + 1];
+            }
+            return true;
+        }
+        if ((node->node_map & bit) == 0) {
+            return false;
         }
+        node = node->slots[data_count * 2 + pdict_popcount(node->node_map & (bit - 1))];
     }
-    dict->count = 0;
-    dict->item_capacity = 0;
-    dict->cell_capacity = 0;
-
-    free(dict->cells);
-    free(dict->keys);
-    free(dict->values);
-    free(dict->cell_ixs);
-    free(dict->hashes);
-
-    dict->cells = NULL;
-    dict->keys = NULL;
-    dict->values = NULL;
-    dict->cell_ixs = NULL;
-    dict->hashes = NULL;
 }
 
-static unsigned int dict_get_cell_ix(const dict_t_ *dict,
-                                     const char *key,
-                                     unsigned long hash,
-                                     bool *out_found)
-{
-    *out_found = false;
-    unsigned int cell_ix = hash & (dict->cell_capacity - 1);
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        unsigned int ix = (cell_ix + i) & (dict->cell_capacity - 1);
-        unsigned int cell = dict->cells[ix];
-        if (cell == DICT_INVALID_IX) {
-            return ix;
+// After a remove from the node at depth, drops emptied nodes and moves single
+// remaining entries up, so the trie stays as shallow as if they were never split.
+static void pdict_compact_path(const collections_allocator_t *allocator, pdict_node_t ***refs, unsigned int depth) {
+    for (; depth > 0; depth--) {
+        pdict_node_t *node = *refs[depth];
+        unsigned int shift = depth * PDICT_BITS;
+        unsigned int data_count = pdict_data_count(node, shift);
+        if (pdict_node_count(node) > 0 || data_count > 1) {
+            return;
+        }
+        pdict_node_t *parent = *refs[depth - 1];
+        unsigned int parent_data_count = pdict_popcount(parent->data_map);
+        unsigned int parent_node_count = pdict_node_count(parent);
+        unsigned int child_ix = (unsigned int)((void**)refs[depth] - (parent->slots + parent_data_count * 2));
+        uint32_t bit = parent->node_map;
+        for (unsigned int i = 0; i < child_ix; i++) {
+            bit &= bit - 1;
         }
-        unsigned long hash_to_check = dict->hashes[cell];
-        if (hash != hash_to_check) {
+        bit &= ~bit + 1; // lowest remaining bit is the child's
+        if (data_count == 0) {
+            memmove(parent->slots + parent_data_count * 2 + child_ix, parent->slots + parent_data_count * 2 + child_ix + 1,
+                    (parent_node_count - child_ix - 1) * sizeof(void*));
+            parent->node_map &= ~bit;
+            collections_free(allocator, node);
             continue;
         }
-        const char *key_to_check = dict->keys[cell];
-        if (strcmp(key, key_to_check) == 0) {
-            *out_found = true;
-            return ix;
+        pdict_node_t *new_parent = pdict_node_alloc(allocator, parent_data_count + 1, parent_node_count - 1);
+        if (new_parent == NULL) {
+            return; // stays deeper than needed
         }
+        unsigned int data_ix = pdict_popcount(parent->data_map & (bit - 1));
+        void **dst = new_parent->slots;
+        memcpy(dst, parent->slots, data_ix * 2 * sizeof(void*));
+        dst[data_ix * 2] = node->slots[0];
+        dst[data_ix * 2 + 1] = node->slots[1];
+        memcpy(dst + (data_ix + 1) * 2, parent->slots + data_ix * 2, (parent_data_count - data_ix) * 2 * sizeof(void*));
+        dst += (parent_data_count + 1) * 2;
+        memcpy(dst, parent->slots + parent_data_count * 2, child_ix * sizeof(void*));
+        memcpy(dst + child_ix, parent->slots + parent_data_count * 2 + child_ix + 1,
+               (parent_node_count - child_ix - 1) * sizeof(void*));
+        new_parent->data_map = parent->data_map | bit;
+        new_parent->node_map = parent->node_map & ~bit;
+        collections_free(allocator, node);
+        collections_free(allocator, parent);
+        *refs[depth - 1] = new_parent;
     }
-    return DICT_INVALID_IX;
 }
 
-static unsigned long hash_string(const char *str) { /* djb2 */
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + (unsigned long)c; /* hash * 33 + c */
+static void pdict_node_foreach(const pdict_node_t *node, unsigned int shift, pdict_item_fn fn, void *ctx) {
+    unsigned int data_count = pdict_data_count(node, shift);
+    for (unsigned int i = 0; i < data_count; i++) {
+        const pdict_key_t *pkey = node->slots[i * 2];
+        fn(pkey->data, node->slots[i * 2 + 1], ctx);
+    }
+    for (unsigned int i = 0; i < pdict_node_count(node); i++) {
+        pdict_node_foreach(node->slots[data_count * 2 + i], shift + PDICT_BITS, fn, ctx);
     }
-    return hash;
 }
 
-static bool dict_grow_and_rehash(dict_t_ *dict) {
-    dict_t_ new_hd;
-    bool succeeded = dict_init(&new_hd, dict->cell_capacity * 2);
-    if (succeeded == false) {
-        return false;
+static void pdict_node_add_stats(const pdict_node_t *node, unsigned int shift, dict_stats_t *stats) {
+    unsigned int data_count = pdict_data_count(node, shift);
+    unsigned int node_count = pdict_node_count(node);
+    stats->cells_bytes += sizeof(pdict_node_t) + (data_count * 2 + node_count) * sizeof(void*);
+    for (unsigned int i = 0; i < data_count; i++) {
+        const pdict_key_t *pkey = node->slots[i * 2];
+        stats->keys_bytes += sizeof(pdict_key_t);
+        stats->key_data_bytes += pkey->len + 1;
+        unsigned int depth = shift / PDICT_BITS;
+        stats->max_displacement = depth > stats->max_displacement ? depth : stats->max_displacement;
     }
-    for (unsigned int i = 0; i < dict->count; i++) {
-        char *key = dict->keys[i];
-        void *value = dict->values[i];
-        succeeded = dict_set_internal(&new_hd, key, key, value);
-        if (succeeded == false) {
-            dict_deinit(&new_hd, false);
-            return false;
-        }
+    for (unsigned int i = 0; i < node_count; i++) {
+        pdict_node_add_stats(node->slots[data_count * 2 + i], shift + PDICT_BITS, stats);
     }
-    dict_deinit(dict, false);
-    *dict = new_hd;
-    return true;
 }
 
-static bool dict_set_internal(dict_t_ *dict, const char *ckey, char *mkey, void *value) {
-    unsigned long hash = hash_string(ckey);
-    bool found = false;
-    unsigned int cell_ix = dict_get_cell_ix(dict, ckey, hash, &found);
-    if (found) {
-        unsigned int item_ix = dict->cells[cell_ix];
-        dict->values[item_ix] = value;
-        return true;
-    }
-    if (dict->count >= dict->item_capacity) {
-        bool succeeded = dict_grow_and_rehash(dict);
-        if (succeeded == false) {
-            return false;
-        }
-        cell_ix = dict_get_cell_ix(dict, ckey, hash, &found);
+static unsigned int pdict_data_count(const pdict_node_t *node, unsigned int shift) {
+    return shift >= PDICT_HASH_BITS ? node->data_map : pdict_popcount(node->data_map);
+}
+
+static unsigned int pdict_node_count(const pdict_node_t *node) {
+    return pdict_popcount(node->node_map);
+}
+
+static uint32_t pdict_hash_bit(unsigned long hash, unsigned int shift) {
+    return (uint32_t)1 << ((hash >> shift) & ((1 << PDICT_BITS) - 1));
+}
+
+static unsigned int pdict_popcount(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_popcount(x);
+#elif defined(_MSC_VER)
+    return (unsigned int)__popcnt(x);
+#else
+    unsigned int count = 0;
+    for (; x; x &= x - 1) {
+        count++;
     }
-    dict->cells[cell_ix] = dict->count;
-    dict->keys[dict->count] = mkey != NULL ? mkey : strdup(ckey);
-    dict->values[dict->count] = value;
-    dict->cell_ixs[dict->count] = cell_ix;
-    dict->hashes[dict->count] = hash;
-    dict->count++;
-    return true;
+    return count;
+#endif
 }
 
 //-----------------------------------------------------------------------------
-// Pointer dictionary
+// Cache
 //-----------------------------------------------------------------------------
 #include <stdbool.h>
-#include <stdint.h>
-#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define PTRDICT_INVALID_IX UINT_MAX
-
-typedef struct ptrdict_ {
-    unsigned int *cells;
-    void **keys;
-    void **values;
-    unsigned int *cell_ixs;
-    unsigned int count;
-    unsigned int item_capacity;
-    unsigned int cell_capacity;
-} ptrdict_t_;
+// CLOCK eviction over the dict's dense item arrays. referenced and sizes are
+// parallel to the dict's keys and values, so they follow its removes, which
+// move the last item into the removed one's place. The hand sweeps item
+// indices, giving referenced items a second chance.
+typedef struct cache_ {
+    dict_t_ *dict;
+    unsigned char *referenced;
+    size_t *sizes; // NULL without byte budget
+    collections_size_t meta_capacity;
+    collections_size_t max_count;
+    size_t max_bytes;
+    size_t bytes;
+    collections_size_t hand;
+    cache_evict_fn evict_fn;
+    void *evict_ctx;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    const collections_allocator_t *allocator;
+} cache_t_;
 
 // Private declarations
-static bool ptrdict_init(ptrdict_t_ *pd, unsigned int initial_capacity);
-static void ptrdict_deinit(ptrdict_t_ *pd);
-static unsigned int ptrdict_get_cell_ix(const ptrdict_t_ *pd, void *key, bool *out_found);
-static bool ptrdict_grow_and_rehash(ptrdict_t_ *pd);
-static bool ptrdict_set_internal(ptrdict_t_ *pd, void *key, void *value);
+static bool cache_reserve_meta(cache_t_ *cache);
+static void cache_remove_item(cache_t_ *cache, collections_size_t item_ix);
+static void cache_evict(cache_t_ *cache);
 
 // Public
-ptrdict_t_* ptrdict_make(void) {
-    ptrdict_t_ *dict = malloc(sizeof(ptrdict_t_));
-    if (dict == NULL) {
+cache_t_* cache_make(collections_size_t max_count, size_t max_bytes) {
+    return cache_make_with_allocator(max_count, max_bytes, NULL);
+}
+
+cache_t_* cache_make_with_allocator(collections_size_t max_count, size_t max_bytes, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    if (max_count == 0 && max_bytes == 0) {
         return NULL;
     }
-    bool succeeded = ptrdict_init(dict, 16);
-    if (succeeded == false) {
-        free(dict);
+    cache_t_ *cache = collections_alloc(allocator, sizeof(cache_t_));
+    if (cache == NULL) {
         return NULL;
     }
-    return dict;
+    memset(cache, 0, sizeof(cache_t_));
+    cache->allocator = allocator;
+    cache->dict = dict_make_with_allocator(max_count, allocator);
+    cache->max_count = max_count;
+    cache->max_bytes = max_bytes;
+    if (cache->dict == NULL || cache_reserve_meta(cache) == false) {
+        cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
 }
 
-void ptrdict_destroy(ptrdict_t_ *dict) {
-    if (dict == NULL) {
+void cache_destroy(cache_t_ *cache) {
+    if (cache == NULL) {
         return;
     }
-    ptrdict_deinit(dict);
-    free(dict);
+    if (cache->dict) {
+        cache_clear(cache);
+    }
+    dict_destroy(cache->dict);
+    collections_free(cache->allocator, cache->referenced);
+    collections_free(cache->allocator, cache->sizes);
+    collections_free(cache->allocator, cache);
 }
 
-bool ptrdict_set(ptrdict_t_ *dict, void *key, void *value) {
-    return ptrdict_set_internal(dict, key, value);
+void cache_set_evict_fn(cache_t_ *cache, cache_evict_fn evict_fn, void *ctx) {
+    cache->evict_fn = evict_fn;
+    cache->evict_ctx = ctx;
 }
 
-void *ptrdict_get(const ptrdict_t_ *dict, void *key) {
-    bool found = false;
-    unsigned long cell_ix = ptrdict_get_cell_ix(dict, key, &found);
-    if (found == false) {
-        return NULL;
-    }
-    unsigned int item_ix = dict->cells[cell_ix];
-    return dict->values[item_ix];
+bool cache_set(cache_t_ *cache, const char *key, void *value, size_t size) {
+    return cache_setn(cache, key, strlen(key), value, size);
 }
 
-void *ptrdict_get_value_at(const ptrdict_t_ *dict, unsigned int ix) {
-    if (ix >= dict->count) {
-        return NULL;
+bool cache_setn(cache_t_ *cache, const char *key, size_t len, void *value, size_t size) {
+    if (cache->max_bytes && size > cache->max_bytes) {
+        return false;
     }
-    return dict->values[ix];
-}
-
-void *ptrdict_get_key_at(const ptrdict_t_ *dict, unsigned int ix) {
-    if (ix >= dict->count) {
-        return NULL;
+    dict_t_ *dict = cache->dict;
+    unsigned long hash = dict_hash_key(dict, key, len);
+    collections_size_t item_ix = dict_get_item_ix(dict, key, len, hash);
+    if (item_ix != DICT_INVALID_IX) {
+        if (cache->evict_fn && dict->values[item_ix] != value) {
+            cache->evict_fn(dict_item_key(dict, item_ix), dict->values[item_ix], cache->evict_ctx);
+        }
+        dict->values[item_ix] = value;
+        cache->referenced[item_ix] = 1;
+        if (cache->sizes) {
+            cache->bytes = cache->bytes - cache->sizes[item_ix] + size;
+            cache->sizes[item_ix] = size;
+        }
+        while (cache->sizes && cache->bytes > cache->max_bytes) {
+            cache_evict(cache);
+        }
+        return true;
     }
-    return dict->keys[ix];
-}
 
-unsigned int ptrdict_count(const ptrdict_t_ *dict) {
-    if (!dict) {
-        return 0;
+    while ((cache->max_count && dict->count >= cache->max_count)
+           || (cache->sizes && cache->bytes + size > cache->max_bytes)) {
+        cache_evict(cache);
     }
-    return dict->count;
-}
-
-bool ptrdict_remove(ptrdict_t_ *dict, void *key) {
-    bool found = false;
-    unsigned int cell = ptrdict_get_cell_ix(dict, key, &found);
-    if (!found) {
+    bool added = false;
+    item_ix = dict_upsert(dict, key, len, hash, &added);
+    if (item_ix == DICT_INVALID_IX) {
         return false;
     }
-
-    unsigned int item_ix = dict->cells[cell];
-    free(dict->keys[item_ix]);
-    unsigned int last_item_ix = dict->count - 1;
-    if (item_ix < last_item_ix) {
-        dict->keys[item_ix] = dict->keys[last_item_ix];
-        dict->values[item_ix] = dict->values[last_item_ix];
-        dict->cell_ixs[item_ix] = dict->cell_ixs[last_item_ix];
-        dict->cells[dict->cell_ixs[item_ix]] = item_ix;
+    if (cache_reserve_meta(cache) == false) {
+        dict_remove_item(dict, item_ix);
+        return false;
     }
-    dict->count--;
-
-    unsigned int i = cell;
-    unsigned int j = i;
-    for (unsigned int x = 0; x < (dict->cell_capacity - 1); x++) {
-        j = (j + 1) & (dict->cell_capacity - 1);
-        if (dict->cells[j] == PTRDICT_INVALID_IX) {
-            break;
-        }
-        unsigned int k = (uintptr_t)(dict->keys[dict->cells[j]]) & (dict->cell_capacity - 1);
-        if ((j > i && (k <= i || k > j))
-            || (j < i && (k <= i && k > j))) {
-            dict->cell_ixs[dict->cells[j]] = i;
-            dict->cells[i] = dict->cells[j];
-            i = j;
-        }
+    dict->values[item_ix] = value;
+    cache->referenced[item_ix] = 0;
+    if (cache->sizes) {
+        cache->sizes[item_ix] = size;
+        cache->bytes += size;
     }
-    dict->cells[i] = PTRDICT_INVALID_IX;
     return true;
 }
 
-void ptrdict_clear(ptrdict_t_ *dict) {
-    for (unsigned int i = 0; i < dict->count; i++) {
-        free(dict->keys[i]);
-    }
-    dict->count = 0;
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        dict->cells[i] = PTRDICT_INVALID_IX;
-    }
+void *cache_get(cache_t_ *cache, const char *key) {
+    return cache_getn(cache, key, strlen(key));
 }
 
-// Private definitions
-static bool ptrdict_init(ptrdict_t_ *dict, unsigned int initial_capacity) {
-    // todo: check initial capacity is a power of 2
-    dict->cells = NULL;
-    dict->keys = NULL;
-    dict->values = NULL;
-    dict->cell_ixs = NULL;
-
-    dict->count = 0;
-    dict->cell_capacity = initial_capacity;
-    dict->item_capacity = (unsigned int)(initial_capacity * 0.7f);
-
-    dict->cells = malloc(dict->cell_capacity * sizeof(*dict->cells));
-    dict->keys = malloc(dict->item_capacity * sizeof(*dict->keys));
-    dict->values = malloc(dict->item_capacity * sizeof(*dict->values));
-    dict->cell_ixs = malloc(dict->item_capacity * sizeof(*dict->cell_ixs));
-    if (dict->cells == NULL
-        || dict->keys == NULL
-        || dict->values == NULL
-        || dict->cell_ixs == NULL) {
-        goto error;
-    }
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        dict->cells[i] = PTRDICT_INVALID_IX;
+void *cache_getn(cache_t_ *cache, const char *key, size_t len) {
+    dict_t_ *dict = cache->dict;
+    collections_size_t item_ix = dict_get_item_ix(dict, key, len, dict_hash_key(dict, key, len));
+    if (item_ix == DICT_INVALID_IX) {
+        cache->misses++;
+        return NULL;
     }
-    return true;
-error:
-    free(dict->cells);
-    free(dict->keys);
-    free(dict->values);
-    free(dict->cell_ixs);
-    return false;
+    cache->hits++;
+    cache->referenced[item_ix] = 1;
+    return dict->values[item_ix];
 }
 
-static void ptrdict_deinit(ptrdict_t_ *dict) {
-    dict->count = 0;
-    dict->item_capacity = 0;
-    dict->cell_capacity = 0;
+void *cache_peek(const cache_t_ *cache, const char *key) {
+    return dict_get(cache->dict, key);
+}
+
+bool cache_remove(cache_t_ *cache, const char *key) {
+    dict_t_ *dict = cache->dict;
+    size_t len = strlen(key);
+    collections_size_t item_ix = dict_get_item_ix(dict, key, len, dict_hash_key(dict, key, len));
+    if (item_ix == DICT_INVALID_IX) {
+        return false;
+    }
+    if (cache->evict_fn) {
+        cache->evict_fn(dict_item_key(dict, item_ix), dict->values[item_ix], cache->evict_ctx);
+    }
+    cache_remove_item(cache, item_ix);
+    return true;
+}
 
-    free(dict->cells);
-    free(dict->keys);
-    free(dict->values);
-    free(dict->cell_ixs);
+collections_size_t cache_count(const cache_t_ *cache) {
+    return cache->dict->count;
+}
 
-    dict->cells = NULL;
-    dict->keys = NULL;
-    dict->values = NULL;
-    dict->cell_ixs = NULL;
+size_t cache_bytes(const cache_t_ *cache) {
+    return cache->bytes;
 }
 
-static unsigned int ptrdict_get_cell_ix(const ptrdict_t_ *dict, void *key, bool *out_found) {
-    *out_found = false;
-    unsigned int cell_ix = (uintptr_t)key & (dict->cell_capacity - 1);
-    for (unsigned int i = 0; i < dict->cell_capacity; i++) {
-        unsigned int ix = (cell_ix + i) & (dict->cell_capacity - 1);
-        unsigned int cell = dict->cells[ix];
-        if (cell == PTRDICT_INVALID_IX) {
-            return ix;
-        }
-        void *key_to_check = dict->keys[cell];
-        if (key == key_to_check) {
-            *out_found = true;
-            return ix;
+void cache_clear(cache_t_ *cache) {
+    dict_t_ *dict = cache->dict;
+    if (cache->evict_fn) {
+        for (collections_size_t i = 0; i < dict->count; i++) {
+            cache->evict_fn(dict_item_key(dict, i), dict->values[i], cache->evict_ctx);
         }
     }
-    return PTRDICT_INVALID_IX;
+    dict_clear(dict);
+    cache->bytes = 0;
+    cache->hand = 0;
 }
 
-static bool ptrdict_grow_and_rehash(ptrdict_t_ *dict) {
-    ptrdict_t_ new_hd;
-    bool succeeded = ptrdict_init(&new_hd, dict->cell_capacity * 2);
-    if (succeeded == false) {
+void cache_get_stats(const cache_t_ *cache, cache_stats_t *out_stats) {
+    out_stats->count = cache->dict->count;
+    out_stats->bytes = cache->bytes;
+    out_stats->hits = cache->hits;
+    out_stats->misses = cache->misses;
+    out_stats->evictions = cache->evictions;
+    out_stats->hit_ratio = cache->hits + cache->misses ? (double)cache->hits / (cache->hits + cache->misses) : 0.0;
+}
+
+// Private definitions
+static bool cache_reserve_meta(cache_t_ *cache) {
+    collections_size_t capacity = cache->dict->item_capacity;
+    if (capacity <= cache->meta_capacity) {
+        return true;
+    }
+    unsigned char *referenced = collections_realloc(cache->allocator, cache->referenced, cache->meta_capacity, capacity);
+    if (referenced == NULL) {
         return false;
     }
-    for (unsigned int i = 0; i < dict->count; i++) {
-        void *key = dict->keys[i];
-        void *value = dict->values[i];
-        succeeded = ptrdict_set_internal(&new_hd, key, value);
-        if (succeeded == false) {
-            ptrdict_deinit(&new_hd);
+    cache->referenced = referenced;
+    if (cache->max_bytes) {
+        size_t *sizes = collections_realloc(cache->allocator, cache->sizes, (size_t)cache->meta_capacity * sizeof(size_t),
+                                            (size_t)capacity * sizeof(size_t));
+        if (sizes == NULL) {
             return false;
         }
+        cache->sizes = sizes;
     }
-    ptrdict_deinit(dict);
-    *dict = new_hd;
+    cache->meta_capacity = capacity;
     return true;
 }
 
-static bool ptrdict_set_internal(ptrdict_t_ *dict, void *key, void *value) {
-    bool found = false;
-    unsigned int cell_ix = ptrdict_get_cell_ix(dict, key, &found);
-    if (found) {
-        unsigned int item_ix = dict->cells[cell_ix];
-        dict->values[item_ix] = value;
-        return true;
+static void cache_remove_item(cache_t_ *cache, collections_size_t item_ix) {
+    collections_size_t last_item_ix = cache->dict->count - 1;
+    if (cache->sizes) {
+        cache->bytes -= cache->sizes[item_ix];
+        cache->sizes[item_ix] = cache->sizes[last_item_ix];
     }
-    if (dict->count >= dict->item_capacity) {
-        bool succeeded = ptrdict_grow_and_rehash(dict);
-        if (succeeded == false) {
-            return false;
+    cache->referenced[item_ix] = cache->referenced[last_item_ix];
+    dict_remove_item(cache->dict, item_ix);
+}
+
+static void cache_evict(cache_t_ *cache) {
+    dict_t_ *dict = cache->dict;
+    // terminates within two sweeps, the first one clears every referenced bit
+    for (;;) {
+        if (cache->hand >= dict->count) {
+            cache->hand = 0;
+        }
+        if (cache->referenced[cache->hand] == 0) {
+            break;
         }
-        cell_ix = ptrdict_get_cell_ix(dict, key, &found);
+        cache->referenced[cache->hand] = 0;
+        cache->hand++;
     }
-    dict->cells[cell_ix] = dict->count;
-    dict->keys[dict->count] = key;
-    dict->values[dict->count] = value;
-    dict->cell_ixs[dict->count] = cell_ix;
-    dict->count++;
-    return true;
+    if (cache->evict_fn) {
+        cache->evict_fn(dict_item_key(dict, cache->hand), dict->values[cache->hand], cache->evict_ctx);
+    }
+    cache_remove_item(cache, cache->hand); // hand now points at the item moved in its place
+    cache->evictions++;
 }
 
 //-----------------------------------------------------------------------------
 // Array
 //-----------------------------------------------------------------------------
 
+#define ARRAY_DEFAULT_GROWTH_FACTOR 2.0f
+#define ARRAY_PAGE_SIZE 4096
+
 typedef struct array_ {
     unsigned char *data;
-    unsigned int count;
-    unsigned int capacity;
+    collections_size_t count;
+    collections_size_t capacity;
     size_t element_size;
     bool lock_capacity;
+    float growth_factor;
+    size_t growth_max_step; // bytes, 0 for no limit
+    bool growth_page_granular;
+    const collections_allocator_t *allocator;
 } array_t_;
 
-static bool array_init_with_capacity(array_t_ *arr, unsigned int capacity, size_t element_size);
+static bool array_init_with_capacity(array_t_ *arr,
+                                     collections_size_t capacity,
+                                     size_t element_size,
+                                     const collections_allocator_t *allocator);
 static void array_deinit(array_t_ *arr);
+static bool array_grow(array_t_ *arr, collections_size_t n);
+static bool array_set_capacity(array_t_ *arr, collections_size_t capacity);
+static size_t array_data_offset(const array_t_ *arr, const void *ptr);
 
 array_t_* array_make_(size_t element_size) {
     return array_make_with_capacity(0, element_size);
 }
 
-array_t_* array_make_with_capacity(unsigned int capacity, size_t element_size) {
-    array_t_ *arr = malloc(sizeof(array_t_));
+array_t_* array_make_with_capacity(collections_size_t capacity, size_t element_size) {
+    return array_make_with_allocator(capacity, element_size, NULL);
+}
+
+array_t_* array_make_with_allocator(collections_size_t capacity, size_t element_size, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    array_t_ *arr = collections_alloc(allocator, sizeof(array_t_));
     if (arr == NULL) {
         return NULL;
     }
-    bool succeeded = array_init_with_capacity(arr, capacity, element_size);
+    bool succeeded = array_init_with_capacity(arr, capacity, element_size, allocator);
     if (succeeded == false) {
-        free(arr);
+        collections_free(allocator, arr);
         return NULL;
     }
     return arr;
@@ -581,24 +5292,15 @@ void array_destroy(array_t_ *arr) {
         return;
     }
     array_deinit(arr);
-    free(arr);
+    collections_free(arr->allocator, arr);
 }
 
 bool array_add(array_t_ *arr, const void *value) {
     if (arr->count >= arr->capacity) {
-        assert(!arr->lock_capacity);
-        if (arr->lock_capacity) {
-            return false;
-        }
-        unsigned int new_capacity = arr->capacity > 0 ? arr->capacity * 2 : 1;
-        unsigned char *new_data = malloc(new_capacity * arr->element_size);
-        if (new_data == NULL) {
+        bool ok = array_grow(arr, 1);
+        if (!ok) {
             return false;
         }
-        memcpy(new_data, arr->data, arr->count * arr->element_size);
-        free(arr->data);
-        arr->data = new_data;
-        arr->capacity = new_capacity;
     }
     if (value) {
         memcpy(arr->data + (arr->count * arr->element_size), value, arr->element_size);
@@ -607,35 +5309,85 @@ bool array_add(array_t_ *arr, const void *value) {
     return true;
 }
 
-bool array_addn(array_t_ *arr, const void *values, unsigned int n) {
-    for (int i = 0; i < n; i++) {
-        unsigned char *value = NULL;
-        if (values) {
-            value = (unsigned char*)values + (i * arr->element_size);
-        }
-        bool ok = array_add(arr, value);
+bool array_addn(array_t_ *arr, const void *values, collections_size_t n) {
+    return array_insertn(arr, arr->count, values, n);
+}
+
+bool array_add_array(array_t_ *dest, const array_t_ *source) {
+    assert(dest->element_size == source->element_size);
+    if (dest->element_size != source->element_size) {
+        return false;
+    }
+    return array_insertn(dest, dest->count, source->data, source->count);
+}
+
+bool array_insertn(array_t_ *arr, collections_size_t ix, const void *values, collections_size_t n) {
+    if (ix > arr->count) {
+        assert(false);
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    // values can point into the array itself, so they're found again by offset after growing and moving
+    size_t src_offset = array_data_offset(arr, values);
+    if (arr->capacity - arr->count < n) {
+        bool ok = array_grow(arr, n);
         if (!ok) {
             return false;
         }
     }
+    size_t offset = ix * arr->element_size;
+    size_t size = n * arr->element_size;
+    unsigned char *dest = arr->data + offset;
+    memmove(dest + size, dest, (arr->count - ix) * arr->element_size);
+    if (src_offset != SIZE_MAX) {
+        size_t before = src_offset < offset ? offset - src_offset : 0; // part of values in front of ix didn't move
+        before = before < size ? before : size;
+        memcpy(dest, arr->data + src_offset, before);
+        memcpy(dest + before, arr->data + src_offset + before + size, size - before);
+    } else if (values) {
+        memcpy(dest, values, size);
+    }
+    arr->count += n;
     return true;
 }
 
-bool array_add_array(array_t_ *dest, const array_t_ *source) {
-    assert(dest->element_size == source->element_size);
-    if (dest->element_size != source->element_size) {
+bool array_removen(array_t_ *arr, collections_size_t ix, collections_size_t n) {
+    if (ix > arr->count || n > arr->count - ix) {
         return false;
     }
-    for (int i = 0; i < array_count(source); i++) {
-        void *item = array_get(source, i);
-        bool ok = array_add(dest, item);
+    if (n == 0) {
+        return true;
+    }
+    size_t offset = ix * arr->element_size;
+    size_t size = n * arr->element_size;
+    memmove(arr->data + offset, arr->data + offset + size, (arr->count - ix - n) * arr->element_size);
+    arr->count -= n;
+    return true;
+}
+
+bool array_resize(array_t_ *arr, collections_size_t count) {
+    if (count > arr->capacity) {
+        bool ok = array_grow(arr, count - arr->count);
         if (!ok) {
             return false;
         }
     }
+    if (count > arr->count) {
+        memset(arr->data + arr->count * arr->element_size, 0, (count - arr->count) * arr->element_size);
+    }
+    arr->count = count;
     return true;
 }
 
+bool array_reserve(array_t_ *arr, collections_size_t capacity) {
+    if (capacity <= arr->capacity) {
+        return true;
+    }
+    return array_set_capacity(arr, capacity);
+}
+
 bool array_push(array_t_ *arr, const void *value) {
     return array_add(arr, value);
 }
@@ -652,7 +5404,7 @@ bool array_pop(array_t_ *arr, void *out_value) {
     return true;
 }
 
-bool array_set(array_t_ *arr, unsigned int ix, void *value) {
+bool array_set(array_t_ *arr, collections_size_t ix, void *value) {
     if (ix >= arr->count) {
         assert(false);
         return false;
@@ -662,26 +5414,30 @@ bool array_set(array_t_ *arr, unsigned int ix, void *value) {
     return true;
 }
 
-bool array_setn(array_t_ *arr, unsigned int ix, void *values, unsigned int n) {
-    for (int i = 0; i < n; i++) {
-        unsigned int dest_ix = ix + i;
-        unsigned char *value = (unsigned char*)values + (i * arr->element_size);
-        if (dest_ix < array_count(arr)) {
-            bool ok = array_set(arr, dest_ix, value);
-            if (!ok) {
-                return false;
-            }
-        } else {
-            bool ok = array_add(arr, value);
-            if (!ok) {
-                return false;
-            }
+bool array_setn(array_t_ *arr, collections_size_t ix, void *values, collections_size_t n) {
+    if (ix > arr->count) {
+        assert(false);
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    size_t src_offset = array_data_offset(arr, values);
+    if (arr->capacity - ix < n) {
+        bool ok = array_grow(arr, n - (arr->count - ix));
+        if (!ok) {
+            return false;
         }
     }
+    const unsigned char *src = src_offset != SIZE_MAX ? arr->data + src_offset : values;
+    memmove(arr->data + ix * arr->element_size, src, n * arr->element_size);
+    if (ix + n > arr->count) {
+        arr->count = ix + n;
+    }
     return true;
 }
 
-void * array_get(const array_t_ *arr, unsigned int ix) {
+void * array_get(const array_t_ *arr, collections_size_t ix) {
     if (ix >= arr->count) {
         assert(false);
         return NULL;
@@ -697,27 +5453,15 @@ void * array_get_last(const array_t_ *arr) {
     return array_get(arr, arr->count - 1);
 }
 
-unsigned int array_count(const array_t_ *arr) {
+collections_size_t array_count(const array_t_ *arr) {
     if (!arr) {
         return 0;
     }
     return arr->count;
 }
 
-bool array_remove(array_t_ *arr, unsigned int ix) {
-    if (ix >= arr->count) {
-        return false;
-    }
-    if (ix == (arr->count - 1)) {
-        arr->count--;
-        return true;
-    }
-    size_t to_move_bytes = (arr->count - 1 - ix) * arr->element_size;
-    void *dest = arr->data + (ix * arr->element_size);
-    void *src = arr->data + ((ix + 1) * arr->element_size);
-    memmove(dest, src, to_move_bytes);
-    arr->count--;
-    return true;
+bool array_remove(array_t_ *arr, collections_size_t ix) {
+    return array_removen(arr, ix, 1);
 }
 
 void array_clear(array_t_ *arr) {
@@ -729,7 +5473,7 @@ void array_lock_capacity(array_t_ *arr) {
 }
 
 int array_get_index(const array_t_ *arr, void *ptr) {
-    for (int i = 0; i < array_count(arr); i++) {
+    for (collections_size_t i = 0; i < array_count(arr); i++) {
         if (array_get(arr, i) == ptr) {
             return i;
         }
@@ -745,24 +5489,104 @@ const void*  array_const_data(const array_t_ *arr) {
     return arr->data;
 }
 
-bool array_orphan_data(array_t_ *arr) {
-    return array_init_with_capacity(arr, 0, arr->element_size);
+bool array_set_growth(array_t_ *arr, float factor, size_t max_step_bytes, bool page_granular) {
+    if (!(factor > 1.0f)) {
+        return false;
+    }
+    arr->growth_factor = factor;
+    arr->growth_max_step = max_step_bytes;
+    arr->growth_page_granular = page_granular;
+    return true;
 }
 
-static bool array_init_with_capacity(array_t_ *arr, unsigned int capacity, size_t element_size) {
-    arr->data = malloc(capacity * element_size);
-    if (arr->data == NULL) {
+bool array_orphan_data(array_t_ *arr) {
+    array_t_ policy = *arr;
+    if (array_init_with_capacity(arr, 0, arr->element_size, arr->allocator) == false) {
         return false;
     }
+    array_set_growth(arr, policy.growth_factor, policy.growth_max_step, policy.growth_page_granular);
+    return true;
+}
+
+static bool array_init_with_capacity(array_t_ *arr,
+                                     collections_size_t capacity,
+                                     size_t element_size,
+                                     const collections_allocator_t *allocator)
+{
+    arr->data = NULL; // empty arrays don't allocate until the first add
+    if (capacity > 0) {
+        arr->data = collections_alloc(allocator, capacity * element_size);
+        if (arr->data == NULL) {
+            return false;
+        }
+        collections_advise_huge_pages(arr->data, capacity * element_size);
+    }
     arr->capacity = capacity;
     arr->count = 0;
     arr->element_size = element_size;
     arr->lock_capacity = false;
+    arr->growth_factor = ARRAY_DEFAULT_GROWTH_FACTOR;
+    arr->growth_max_step = 0;
+    arr->growth_page_granular = false;
+    arr->allocator = allocator;
     return true;
 }
 
 static void array_deinit(array_t_ *arr) {
-    free(arr->data);
+    collections_free(arr->allocator, arr->data);
+}
+
+// Grows capacity to fit n more items than count, multiplying it by growth_factor
+// in steps of at most growth_max_step bytes, rounded up to whole pages if page granular.
+static bool array_grow(array_t_ *arr, collections_size_t n) {
+    if (n > COLLECTIONS_SIZE_MAX - arr->count) {
+        return false;
+    }
+    collections_size_t max_step = arr->growth_max_step / arr->element_size;
+    max_step = max_step > 0 ? max_step : 1;
+    collections_size_t capacity = arr->capacity > 0 ? arr->capacity : 1;
+    while (capacity < arr->count + n) {
+        double next = (double)capacity * arr->growth_factor;
+        collections_size_t step = next - capacity < COLLECTIONS_SIZE_MAX ? (collections_size_t)(next - capacity) : COLLECTIONS_SIZE_MAX;
+        step = step > 0 ? step : 1;
+        if (arr->growth_max_step && step > max_step) {
+            step = max_step;
+        }
+        capacity = step > COLLECTIONS_SIZE_MAX - capacity ? COLLECTIONS_SIZE_MAX : capacity + step;
+    }
+    size_t size = (size_t)capacity * arr->element_size;
+    if (arr->growth_page_granular && size >= ARRAY_PAGE_SIZE && size <= SIZE_MAX - ARRAY_PAGE_SIZE) {
+        // spare bytes of the last page would be allocated anyway
+        size = (size + ARRAY_PAGE_SIZE - 1) & ~(size_t)(ARRAY_PAGE_SIZE - 1);
+        capacity = size / arr->element_size <= COLLECTIONS_SIZE_MAX ? (collections_size_t)(size / arr->element_size) : capacity;
+    }
+    return array_set_capacity(arr, capacity);
+}
+
+static bool array_set_capacity(array_t_ *arr, collections_size_t capacity) {
+    assert(!arr->lock_capacity);
+    if (arr->lock_capacity || capacity > SIZE_MAX / arr->element_size) {
+        return false;
+    }
+    // realloc can often extend in place, large blocks are mmapped and moved with mremap
+    unsigned char *new_data = collections_realloc(arr->allocator, arr->data,
+                                                  arr->capacity * arr->element_size, capacity * arr->element_size);
+    if (new_data == NULL) {
+        return false;
+    }
+    collections_advise_huge_pages(new_data, capacity * arr->element_size);
+    arr->data = new_data;
+    arr->capacity = capacity;
+    return true;
+}
+
+// Byte offset of ptr in the used part of data, SIZE_MAX if it points elsewhere.
+static size_t array_data_offset(const array_t_ *arr, const void *ptr) {
+    const unsigned char *p = ptr;
+    if (p == NULL || arr->data == NULL || p < arr->data || p >= arr->data + arr->count * arr->element_size) {
+        return SIZE_MAX;
+    }
+    return (size_t)(p - arr->data);
 }
 
 //-----------------------------------------------------------------------------
@@ -778,13 +5602,20 @@ ptrarray_t_* ptrarray_make(void) {
 }
 
 ptrarray_t_* ptrarray_make_with_capacity(unsigned int capacity) {
-    ptrarray_t_ *ptrarr = malloc(sizeof(ptrarray_t_));
+    return ptrarray_make_with_allocator(capacity, NULL);
+}
+
+ptrarray_t_* ptrarray_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    ptrarray_t_ *ptrarr = collections_alloc(allocator, sizeof(ptrarray_t_));
     if (ptrarr == NULL) {
         return NULL;
     }
-    bool succeeded = array_init_with_capacity(&ptrarr->arr, capacity, sizeof(void*));
+    bool succeeded = array_init_with_capacity(&ptrarr->arr, capacity, sizeof(void*), allocator);
     if (succeeded == false) {
-        free(ptrarr);
+        collections_free(allocator, ptrarr);
         return NULL;
     }
     return ptrarr;
@@ -795,7 +5626,7 @@ void ptrarray_destroy(ptrarray_t_ *arr) {
         return;
     }
     array_deinit(&arr->arr);
-    free(arr);
+    collections_free(arr->arr.allocator, arr);
 }
 
 void ptrarray_destroy_with_items_(ptrarray_t_ *arr, ptrarray_item_destroy_fn destroy_fn){
@@ -921,6 +5752,214 @@ void ptrarray_reverse(ptrarray_t_ *arr) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Small array
+//-----------------------------------------------------------------------------
+
+static unsigned char *smallarray_items(const smallarray_t_ *arr);
+static bool smallarray_grow(smallarray_t_ *arr, collections_size_t n);
+static size_t smallarray_items_offset(const smallarray_t_ *arr, const void *ptr);
+
+void smallarray_init_(smallarray_t_ *arr, size_t element_size, collections_size_t inline_capacity,
+                      unsigned int inline_offset, const collections_allocator_t *allocator) {
+    arr->heap = NULL;
+    arr->count = 0;
+    arr->capacity = inline_capacity;
+    arr->inline_capacity = inline_capacity;
+    arr->inline_offset = inline_offset;
+    arr->element_size = element_size;
+    arr->allocator = allocator ? allocator : &collections_malloc_allocator;
+}
+
+void smallarray_deinit(smallarray_t_ *arr) {
+    if (arr == NULL) {
+        return;
+    }
+    collections_free(arr->allocator, arr->heap);
+    arr->heap = NULL;
+    arr->count = 0;
+    arr->capacity = arr->inline_capacity;
+}
+
+bool smallarray_add(smallarray_t_ *arr, const void *value) {
+    if (arr->count >= arr->capacity) {
+        bool ok = smallarray_grow(arr, 1);
+        if (!ok) {
+            return false;
+        }
+    }
+    if (value) {
+        memcpy(smallarray_items(arr) + arr->count * arr->element_size, value, arr->element_size);
+    }
+    arr->count++;
+    return true;
+}
+
+bool smallarray_addn(smallarray_t_ *arr, const void *values, collections_size_t n) {
+    return smallarray_insertn(arr, arr->count, values, n);
+}
+
+bool smallarray_insertn(smallarray_t_ *arr, collections_size_t ix, const void *values, collections_size_t n) {
+    if (ix > arr->count) {
+        assert(false);
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    // same as array_insertn, values can point into the array and spilling moves them
+    size_t src_offset = smallarray_items_offset(arr, values);
+    if (arr->capacity - arr->count < n) {
+        bool ok = smallarray_grow(arr, n);
+        if (!ok) {
+            return false;
+        }
+    }
+    unsigned char *items = smallarray_items(arr);
+    size_t offset = ix * arr->element_size;
+    size_t size = n * arr->element_size;
+    unsigned char *dest = items + offset;
+    memmove(dest + size, dest, (arr->count - ix) * arr->element_size);
+    if (src_offset != SIZE_MAX) {
+        size_t before = src_offset < offset ? offset - src_offset : 0;
+        before = before < size ? before : size;
+        memcpy(dest, items + src_offset, before);
+        memcpy(dest + before, items + src_offset + before + size, size - before);
+    } else if (values) {
+        memcpy(dest, values, size);
+    }
+    arr->count += n;
+    return true;
+}
+
+bool smallarray_pop(smallarray_t_ *arr, void *out_value) {
+    if (arr->count == 0) {
+        return false;
+    }
+    arr->count--;
+    if (out_value) {
+        memcpy(out_value, smallarray_items(arr) + arr->count * arr->element_size, arr->element_size);
+    }
+    return true;
+}
+
+bool smallarray_set(smallarray_t_ *arr, collections_size_t ix, const void *value) {
+    if (ix >= arr->count) {
+        assert(false);
+        return false;
+    }
+    memmove(smallarray_items(arr) + ix * arr->element_size, value, arr->element_size);
+    return true;
+}
+
+void * smallarray_get(const smallarray_t_ *arr, collections_size_t ix) {
+    if (ix >= arr->count) {
+        assert(false);
+        return NULL;
+    }
+    return smallarray_items(arr) + ix * arr->element_size;
+}
+
+void * smallarray_get_last(const smallarray_t_ *arr) {
+    if (arr->count == 0) {
+        return NULL;
+    }
+    return smallarray_get(arr, arr->count - 1);
+}
+
+collections_size_t smallarray_count(const smallarray_t_ *arr) {
+    if (!arr) {
+        return 0;
+    }
+    return arr->count;
+}
+
+bool smallarray_remove(smallarray_t_ *arr, collections_size_t ix) {
+    return smallarray_removen(arr, ix, 1);
+}
+
+bool smallarray_removen(smallarray_t_ *arr, collections_size_t ix, collections_size_t n) {
+    if (ix > arr->count || n > arr->count - ix) {
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    unsigned char *items = smallarray_items(arr);
+    size_t offset = ix * arr->element_size;
+    size_t size = n * arr->element_size;
+    memmove(items + offset, items + offset + size, (arr->count - ix - n) * arr->element_size);
+    arr->count -= n;
+    return true;
+}
+
+bool smallarray_reserve(smallarray_t_ *arr, collections_size_t capacity) {
+    if (capacity <= arr->capacity) {
+        return true;
+    }
+    return smallarray_grow(arr, capacity - arr->count);
+}
+
+void smallarray_clear(smallarray_t_ *arr) {
+    arr->count = 0;
+}
+
+bool smallarray_is_inline(const smallarray_t_ *arr) {
+    return arr->heap == NULL;
+}
+
+void* smallarray_data(smallarray_t_ *arr) {
+    return smallarray_items(arr);
+}
+
+static unsigned char *smallarray_items(const smallarray_t_ *arr) {
+    if (arr->heap) {
+        return arr->heap;
+    }
+    return (unsigned char*)arr + arr->inline_offset;
+}
+
+// Grows capacity to fit n more items than count, at least doubling it. The first
+// growth moves items from inline storage to the heap.
+static bool smallarray_grow(smallarray_t_ *arr, collections_size_t n) {
+    if (n > COLLECTIONS_SIZE_MAX - arr->count) {
+        return false;
+    }
+    collections_size_t capacity = arr->capacity > 0 ? arr->capacity : 1;
+    while (capacity < arr->count + n) {
+        capacity = capacity > COLLECTIONS_SIZE_MAX / 2 ? COLLECTIONS_SIZE_MAX : capacity * 2;
+    }
+    if (capacity > SIZE_MAX / arr->element_size) {
+        return false;
+    }
+    size_t size = (size_t)capacity * arr->element_size;
+    unsigned char *heap = NULL;
+    if (arr->heap) {
+        heap = collections_realloc(arr->allocator, arr->heap, arr->capacity * arr->element_size, size);
+    } else {
+        heap = collections_alloc(arr->allocator, size);
+        if (heap) {
+            memcpy(heap, smallarray_items(arr), arr->count * arr->element_size);
+        }
+    }
+    if (heap == NULL) {
+        return false;
+    }
+    arr->heap = heap;
+    arr->capacity = capacity;
+    return true;
+}
+
+// Byte offset of ptr in the used part of items, SIZE_MAX if it points elsewhere.
+static size_t smallarray_items_offset(const smallarray_t_ *arr, const void *ptr) {
+    const unsigned char *p = ptr;
+    const unsigned char *items = smallarray_items(arr);
+    if (p == NULL || p < items || p >= items + arr->count * arr->element_size) {
+        return SIZE_MAX;
+    }
+    return (size_t)(p - items);
+}
+
 //-----------------------------------------------------------------------------
 // String buffer
 //-----------------------------------------------------------------------------
@@ -935,13 +5974,20 @@ strbuf_t* strbuf_make(void) {
 }
 
 strbuf_t* strbuf_make_with_capacity(unsigned int capacity) {
-    strbuf_t *buf = malloc(sizeof(strbuf_t));
+    return strbuf_make_with_allocator(capacity, NULL);
+}
+
+strbuf_t* strbuf_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator) {
+    if (allocator == NULL) {
+        allocator = &collections_malloc_allocator;
+    }
+    strbuf_t *buf = collections_alloc(allocator, sizeof(strbuf_t));
     if (buf == NULL) {
         return NULL;
     }
-    bool succeeded = array_init_with_capacity(&buf->arr, capacity, sizeof(char));
+    bool succeeded = array_init_with_capacity(&buf->arr, capacity, sizeof(char), allocator);
     if (succeeded == false) {
-        free(buf);
+        collections_free(allocator, buf);
         return NULL;
     }
     char nul = '\0';
@@ -954,7 +6000,7 @@ void strbuf_destroy(strbuf_t *buf) {
         return;
     }
     array_deinit(&buf->arr);
-    free(buf);
+    collections_free(buf->arr.allocator, buf);
 }
 
 void strbuf_clear(strbuf_t *buf) {
@@ -989,12 +6035,16 @@ bool strbuf_appendf(strbuf_t *buf, const char *fmt, ...) {
     int to_write = vsnprintf(NULL, 0, fmt, args);
     va_end(args);
     va_start(args, fmt);
-    char *res = (char*)malloc(to_write + 1);
+    char *res = collections_alloc(buf->arr.allocator, to_write + 1);
+    if (res == NULL) {
+        va_end(args);
+        return false;
+    }
     int written = vsprintf(res, fmt, args);
     assert(written == to_write);
     va_end(args);
     bool ok = strbuf_append(buf, res);
-    free(res);
+    collections_free(buf->arr.allocator, res);
     return ok;
 }
 
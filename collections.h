@@ -29,23 +29,153 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+// Counts, indices and capacities of dict, ptrdict and array. Define
+// COLLECTIONS_LARGE_TABLES for 64 bit ones, so tables can have more than 2^32
+// cells, and to back their large arrays with transparent huge pages (Linux only,
+// unless COLLECTIONS_NO_HUGE_PAGES is defined).
+#ifdef COLLECTIONS_LARGE_TABLES
+typedef unsigned long long collections_size_t;
+#else
+typedef unsigned int collections_size_t;
+#endif
+
+//-----------------------------------------------------------------------------
+// Allocator
+//-----------------------------------------------------------------------------
+
+// Containers made with a *_with_allocator function take all their memory from
+// allocator, which has to outlive them. NULL allocator is collections_malloc_allocator.
+// Only temporaries freed before returning (bulk builds, freezing, snapshot writes) use malloc.
+// realloc is given the old size of the block, so allocators don't need to store it.
+typedef struct collections_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void  (*free)(void *ctx, void *ptr);
+    void *ctx;
+} collections_allocator_t;
+
+extern const collections_allocator_t collections_malloc_allocator;
+
+// Bump allocator, frees do nothing and memory is only given back all at once by
+// reset or destroy. Not thread safe.
+typedef struct collections_arena_ collections_arena_t_;
+
+collections_arena_t_*          collections_arena_make(size_t block_size); // 0 for default 64 KB
+void                           collections_arena_destroy(collections_arena_t_ *arena);
+void                           collections_arena_reset(collections_arena_t_ *arena); // invalidates everything allocated, keeps first block
+const collections_allocator_t* collections_arena_allocator(collections_arena_t_ *arena);
+size_t                         collections_arena_used(const collections_arena_t_ *arena);
+
+//-----------------------------------------------------------------------------
+// Bloom filter
+//-----------------------------------------------------------------------------
+
+// Blocked Bloom filter, checking a key reads a single cache line. May report keys
+// that weren't added, never misses added ones. Keys can't be removed.
+// *_hash functions take hashes made with dict_hash_wyhash or a dict's hash_fn.
+typedef struct bloom_ bloom_t_;
+
+bloom_t_*          bloom_make(collections_size_t capacity, unsigned int bits_per_key); // 0 bits_per_key for default 12 (~0.5% false positives)
+bloom_t_*          bloom_make_with_allocator(collections_size_t capacity, unsigned int bits_per_key, const collections_allocator_t *allocator);
+void               bloom_destroy(bloom_t_ *bloom);
+void               bloom_add(bloom_t_ *bloom, const char *key);
+void               bloom_addn(bloom_t_ *bloom, const char *key, size_t len);
+void               bloom_add_hash(bloom_t_ *bloom, unsigned long hash);
+bool               bloom_may_contain(const bloom_t_ *bloom, const char *key);
+bool               bloom_may_containn(const bloom_t_ *bloom, const char *key, size_t len);
+bool               bloom_may_contain_hash(const bloom_t_ *bloom, unsigned long hash);
+collections_size_t bloom_count(const bloom_t_ *bloom); // number of adds
+size_t             bloom_size_bytes(const bloom_t_ *bloom);
+void               bloom_clear(bloom_t_ *bloom);
+
 //-----------------------------------------------------------------------------
 // Dictionary
 //-----------------------------------------------------------------------------
 
 typedef struct dict_ dict_t_;
 
+// Hashes len bytes of key, seed lets each dict use a different hash of the same key.
+typedef unsigned long (*dict_hash_fn)(const char *key, size_t len, unsigned long seed);
+
 #define dict(TYPE) dict_t_
 
-dict_t_*     dict_make(void);
-void         dict_destroy(dict_t_ *dict);
-bool         dict_set(dict_t_ *dict, const char *key, void *value);
-void *       dict_get(const dict_t_ *dict, const char *key);
-void *       dict_get_value_at(const dict_t_ *dict, unsigned int ix);
-const char * dict_get_key_at(const dict_t_ *dict, unsigned int ix);
-unsigned int dict_count(const dict_t_ *dict);
-bool         dict_remove(dict_t_ *dict, const char *key);
-void         dict_clear(dict_t_ *dict);
+// Key handle, hashed once and reusable across dicts sharing hash_fn and seed
+// (others rehash it). ptr doesn't need to be NUL terminated, but must not contain NUL.
+typedef struct {
+    const char *ptr;
+    size_t len;
+    unsigned long hash;
+    dict_hash_fn hash_fn;
+    unsigned long seed;
+} dict_key_t;
+
+#define DICT_STATS_HISTOGRAM_SIZE 16
+
+// Shared by dict and ptrdict, fields that don't apply to ptrdict are 0.
+// Displacement is the distance of an item's cell from its home cell, so a lookup
+// of it probes displacement + 1 cells. Last histogram bucket counts all larger ones.
+typedef struct {
+    collections_size_t count;
+    collections_size_t item_capacity;
+    collections_size_t cell_capacity;
+    float load_factor;
+    double avg_displacement;
+    unsigned int max_displacement;
+    unsigned int displacement_histogram[DICT_STATS_HISTOGRAM_SIZE];
+    unsigned int rehash_count;
+    double rehash_seconds; // CPU time of full table rehashes
+    size_t cells_bytes;
+    size_t ctrl_bytes;
+    size_t keys_bytes;
+    size_t key_data_bytes;
+    size_t values_bytes;
+    size_t cell_ixs_bytes;
+    size_t hashes_bytes;
+    size_t bloom_bytes;
+    size_t old_table_bytes; // table being incrementally rehashed from
+    size_t total_bytes;
+    // Lookup counters, only collected when built with COLLECTIONS_DICT_COUNTERS defined
+    unsigned long long hits;
+    unsigned long long misses;
+} dict_stats_t;
+
+dict_t_*           dict_make(void);
+dict_t_*           dict_make_with_capacity(collections_size_t capacity); // holds capacity items without rehashing
+dict_t_*           dict_make_compact(collections_size_t capacity); // single allocation, 32 bit hashes, never rehashes incrementally; for many small dicts
+dict_t_*           dict_make_with_allocator(collections_size_t capacity, const collections_allocator_t *allocator);
+void               dict_destroy(dict_t_ *dict);
+bool               dict_reserve(dict_t_ *dict, collections_size_t capacity);
+bool               dict_shrink_to_fit(dict_t_ *dict);
+bool               dict_set_max_load_factor(dict_t_ *dict, float max_load_factor); // between 0 and 1, default 0.7
+void               dict_set_hash_fn(dict_t_ *dict, dict_hash_fn hash_fn, unsigned long seed); // rehashes if not empty
+void               dict_set_incremental_rehash(dict_t_ *dict, bool enabled); // spreads growth over subsequent sets/removes
+bool               dict_set_key_arena(dict_t_ *dict, bool enabled); // long keys are stored in blocks owned by dict
+bool               dict_compact_keys(dict_t_ *dict); // reclaims arena space of removed keys
+bool               dict_set_bloom_filter(dict_t_ *dict, bool enabled); // answers most misses from one cache line; ctrl bytes already filter most misses, measure first
+size_t             dict_key_arena_waste(const dict_t_ *dict);
+bool               dict_set(dict_t_ *dict, const char *key, void *value);
+bool               dict_setn(dict_t_ *dict, const char *key, size_t len, void *value);
+bool               dict_set_with_key(dict_t_ *dict, const dict_key_t *key, void *value);
+dict_t_*           dict_build_from_arrays(const char * const *keys, void * const *values, collections_size_t count); // sized once, long keys go to the key arena, later duplicates win
+dict_t_*           dict_build_from_arrays_parallel(const char * const *keys, void * const *values, collections_size_t count, unsigned int thread_count); // hashes keys on thread_count threads, 0 is 1
+bool               dict_merge(dict_t_ *dest, const dict_t_ *source); // sets all items of source, reusing its hashes; dest can be partially merged on failure
+void *             dict_get(const dict_t_ *dict, const char *key);
+void *             dict_getn(const dict_t_ *dict, const char *key, size_t len);
+void *             dict_get_with_key(const dict_t_ *dict, const dict_key_t *key);
+collections_size_t dict_get_many(const dict_t_ *dict, const char * const *keys, collections_size_t count, void **out_values); // returns number of keys found
+void *             dict_get_value_at(const dict_t_ *dict, collections_size_t ix);
+const char *       dict_get_key_at(const dict_t_ *dict, collections_size_t ix); // valid until dict is modified
+collections_size_t dict_count(const dict_t_ *dict);
+bool               dict_remove(dict_t_ *dict, const char *key);
+bool               dict_removen(dict_t_ *dict, const char *key, size_t len);
+bool               dict_remove_with_key(dict_t_ *dict, const dict_key_t *key);
+void               dict_clear(dict_t_ *dict);
+void               dict_get_stats(const dict_t_ *dict, dict_stats_t *out_stats); // walks all items
+
+dict_key_t         dict_key_make(const dict_t_ *dict, const char *ptr, size_t len); // dict can be NULL for default hash
+unsigned long      dict_hash_default_seed(void);
+unsigned long      dict_hash_wyhash(const char *key, size_t len, unsigned long seed); // default
+unsigned long      dict_hash_djb2(const char *key, size_t len, unsigned long seed);
 
 //-----------------------------------------------------------------------------
 // Pointer dictionary
@@ -55,15 +185,243 @@ typedef struct ptrdict_ ptrdict_t_;
 
 #define ptrdict(KEY_TYPE, VALUE_TYPE) ptrdict_t_
 
-ptrdict_t_*  ptrdict_make(void);
-void         ptrdict_destroy(ptrdict_t_ *dict);
-bool         ptrdict_set(ptrdict_t_ *dict, void *key, void *value);
-void *       ptrdict_get(const ptrdict_t_ *dict, void *key);
-void *       ptrdict_get_value_at(const ptrdict_t_ *dict, unsigned int ix);
-void *       ptrdict_get_key_at(const ptrdict_t_ *dict, unsigned int ix);
-unsigned int ptrdict_count(const ptrdict_t_ *dict);
-bool         ptrdict_remove(ptrdict_t_ *dict, void *key);
-void         ptrdict_clear(ptrdict_t_ *dict);
+ptrdict_t_*        ptrdict_make(void);
+ptrdict_t_*        ptrdict_make_with_capacity(collections_size_t capacity);
+ptrdict_t_*        ptrdict_make_with_allocator(collections_size_t capacity, const collections_allocator_t *allocator);
+void               ptrdict_destroy(ptrdict_t_ *dict);
+bool               ptrdict_reserve(ptrdict_t_ *dict, collections_size_t capacity);
+bool               ptrdict_shrink_to_fit(ptrdict_t_ *dict);
+bool               ptrdict_set_max_load_factor(ptrdict_t_ *dict, float max_load_factor);
+void               ptrdict_set_incremental_rehash(ptrdict_t_ *dict, bool enabled);
+bool               ptrdict_set(ptrdict_t_ *dict, void *key, void *value);
+void *             ptrdict_get(const ptrdict_t_ *dict, void *key);
+collections_size_t ptrdict_get_many(const ptrdict_t_ *dict, void * const *keys, collections_size_t count, void **out_values);
+void *             ptrdict_get_value_at(const ptrdict_t_ *dict, collections_size_t ix);
+void *             ptrdict_get_key_at(const ptrdict_t_ *dict, collections_size_t ix);
+collections_size_t ptrdict_count(const ptrdict_t_ *dict);
+bool               ptrdict_remove(ptrdict_t_ *dict, void *key);
+void               ptrdict_clear(ptrdict_t_ *dict);
+void               ptrdict_get_stats(const ptrdict_t_ *dict, dict_stats_t *out_stats);
+
+//-----------------------------------------------------------------------------
+// Value dictionary
+//-----------------------------------------------------------------------------
+
+// Dictionary with string keys and values of fixed size stored in the table,
+// so setting a value copies it and getting one returns a pointer to its slot.
+// Slot pointers are valid until the next set/remove.
+typedef struct valdict_ valdict_t_;
+
+#define valdict(TYPE) valdict_t_
+
+#define valdict_make(type) valdict_make_(sizeof(type))
+valdict_t_*        valdict_make_(size_t value_size);
+valdict_t_*        valdict_make_with_capacity(collections_size_t capacity, size_t value_size);
+valdict_t_*        valdict_make_with_allocator(collections_size_t capacity, size_t value_size, const collections_allocator_t *allocator);
+void               valdict_destroy(valdict_t_ *dict);
+bool               valdict_set(valdict_t_ *dict, const char *key, const void *value); // NULL value zeroes slot
+bool               valdict_setn(valdict_t_ *dict, const char *key, size_t len, const void *value);
+void *             valdict_get(const valdict_t_ *dict, const char *key);
+void *             valdict_getn(const valdict_t_ *dict, const char *key, size_t len);
+void *             valdict_get_or_add(valdict_t_ *dict, const char *key); // adds a zeroed value if key is absent
+void *             valdict_get_value_at(const valdict_t_ *dict, collections_size_t ix);
+const char *       valdict_get_key_at(const valdict_t_ *dict, collections_size_t ix);
+collections_size_t valdict_count(const valdict_t_ *dict);
+size_t             valdict_value_size(const valdict_t_ *dict);
+bool               valdict_remove(valdict_t_ *dict, const char *key);
+bool               valdict_removen(valdict_t_ *dict, const char *key, size_t len);
+void               valdict_clear(valdict_t_ *dict);
+void               valdict_get_stats(const valdict_t_ *dict, dict_stats_t *out_stats);
+
+//-----------------------------------------------------------------------------
+// String set
+//-----------------------------------------------------------------------------
+
+// Keys are stored in the hash table itself, without values or per item arrays.
+// Set operations return new sets sized for their result, NULL on failure.
+// Iterate with: unsigned int cursor = 0; while ((key = strset_next(set, &cursor))) {...}
+typedef struct strset_ strset_t_;
+
+strset_t_*   strset_make(void);
+strset_t_*   strset_make_with_capacity(unsigned int capacity);
+strset_t_*   strset_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator); // results of set operations use allocator of their first argument
+void         strset_destroy(strset_t_ *set);
+bool         strset_reserve(strset_t_ *set, unsigned int capacity);
+bool         strset_add(strset_t_ *set, const char *key);
+bool         strset_addn(strset_t_ *set, const char *key, size_t len);
+bool         strset_contains(const strset_t_ *set, const char *key);
+bool         strset_containsn(const strset_t_ *set, const char *key, size_t len);
+bool         strset_remove(strset_t_ *set, const char *key);
+unsigned int strset_count(const strset_t_ *set);
+const char * strset_next(const strset_t_ *set, unsigned int *cursor); // NULL when done
+void         strset_clear(strset_t_ *set);
+strset_t_*   strset_union(const strset_t_ *a, const strset_t_ *b);
+strset_t_*   strset_intersection(const strset_t_ *a, const strset_t_ *b);
+strset_t_*   strset_difference(const strset_t_ *a, const strset_t_ *b); // keys of a not in b
+void         strset_get_stats(const strset_t_ *set, dict_stats_t *out_stats); // walks all items
+
+//-----------------------------------------------------------------------------
+// Pointer set
+//-----------------------------------------------------------------------------
+
+// Same as strset for pointers, which aren't owned by the set. NULL can't be added.
+typedef struct ptrset_ ptrset_t_;
+
+ptrset_t_*   ptrset_make(void);
+ptrset_t_*   ptrset_make_with_capacity(unsigned int capacity);
+ptrset_t_*   ptrset_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator); // results of set operations use allocator of their first argument
+void         ptrset_destroy(ptrset_t_ *set);
+bool         ptrset_reserve(ptrset_t_ *set, unsigned int capacity);
+bool         ptrset_add(ptrset_t_ *set, void *key);
+bool         ptrset_contains(const ptrset_t_ *set, const void *key);
+bool         ptrset_remove(ptrset_t_ *set, const void *key);
+unsigned int ptrset_count(const ptrset_t_ *set);
+void *       ptrset_next(const ptrset_t_ *set, unsigned int *cursor); // NULL when done
+void         ptrset_clear(ptrset_t_ *set);
+ptrset_t_*   ptrset_union(const ptrset_t_ *a, const ptrset_t_ *b);
+ptrset_t_*   ptrset_intersection(const ptrset_t_ *a, const ptrset_t_ *b);
+ptrset_t_*   ptrset_difference(const ptrset_t_ *a, const ptrset_t_ *b); // pointers of a not in b
+void         ptrset_get_stats(const ptrset_t_ *set, dict_stats_t *out_stats); // walks all items
+
+//-----------------------------------------------------------------------------
+// Concurrent dictionary
+//-----------------------------------------------------------------------------
+
+// Keys are spread over independently locked dicts (shards), all functions
+// are thread safe. Readers only take their shard's read lock. Keys are hashed
+// once with default hash and seed, key handles made with dict_key_make(NULL, ...)
+// are used as is.
+typedef struct cdict_ cdict_t_;
+
+#define cdict(TYPE) cdict_t_
+
+cdict_t_*          cdict_make(unsigned int shard_count); // 0 picks default, rounded up to a power of 2
+cdict_t_*          cdict_make_with_allocator(unsigned int shard_count, const collections_allocator_t *allocator); // allocator has to be thread safe, arenas aren't
+void               cdict_destroy(cdict_t_ *dict);
+bool               cdict_set(cdict_t_ *dict, const char *key, void *value);
+bool               cdict_setn(cdict_t_ *dict, const char *key, size_t len, void *value);
+bool               cdict_set_with_key(cdict_t_ *dict, const dict_key_t *key, void *value);
+void *             cdict_get(const cdict_t_ *dict, const char *key);
+void *             cdict_getn(const cdict_t_ *dict, const char *key, size_t len);
+void *             cdict_get_with_key(const cdict_t_ *dict, const dict_key_t *key);
+collections_size_t cdict_count(const cdict_t_ *dict); // not atomic across shards
+bool               cdict_remove(cdict_t_ *dict, const char *key);
+bool               cdict_removen(cdict_t_ *dict, const char *key, size_t len);
+bool               cdict_remove_with_key(cdict_t_ *dict, const dict_key_t *key);
+void               cdict_clear(cdict_t_ *dict);
+
+//-----------------------------------------------------------------------------
+// Frozen dictionary
+//-----------------------------------------------------------------------------
+
+// Immutable copy of a dict using minimal perfect hashing, every lookup is one
+// probe and one key compare. Keys are packed and item order differs from source.
+typedef struct frozendict_ frozendict_t_;
+
+#define frozendict(TYPE) frozendict_t_
+
+frozendict_t_* frozendict_make(const dict_t_ *source); // freezes source, values are copied as is, NULL past INT_MAX items
+frozendict_t_* frozendict_make_with_allocator(const dict_t_ *source, const collections_allocator_t *allocator);
+void           frozendict_destroy(frozendict_t_ *dict);
+void *         frozendict_get(const frozendict_t_ *dict, const char *key);
+void *         frozendict_getn(const frozendict_t_ *dict, const char *key, size_t len);
+void *         frozendict_get_value_at(const frozendict_t_ *dict, unsigned int ix);
+const char *   frozendict_get_key_at(const frozendict_t_ *dict, unsigned int ix);
+unsigned int   frozendict_count(const frozendict_t_ *dict);
+void           frozendict_get_stats(const frozendict_t_ *dict, dict_stats_t *out_stats);
+
+//-----------------------------------------------------------------------------
+// Dictionary snapshot
+//-----------------------------------------------------------------------------
+
+// Position independent file with a frozen copy of a dict. Opening maps it read
+// only, so lookups read the page cache directly and processes share its memory.
+// Files are only portable between platforms of same endianness and long width.
+typedef struct dict_snapshot_ dict_snapshot_t;
+
+// Returns bytes to store for value, NULL value_fn stores values as C strings.
+// Values stored with 0 bytes are returned as NULL, like NULL values in dict_get.
+typedef const void* (*dict_snapshot_value_fn)(void *value, size_t *out_size, void *ctx);
+
+bool             dict_snapshot_write(const dict_t_ *dict, const char *path, dict_snapshot_value_fn value_fn, void *ctx);
+dict_snapshot_t* dict_snapshot_open(const char *path);
+dict_snapshot_t* dict_snapshot_open_with_allocator(const char *path, const collections_allocator_t *allocator); // mapped files only allocate the snapshot itself
+void             dict_snapshot_close(dict_snapshot_t *snapshot);
+const void *     dict_snapshot_get(const dict_snapshot_t *snapshot, const char *key);
+const void *     dict_snapshot_getn(const dict_snapshot_t *snapshot, const char *key, size_t len, size_t *out_size);
+const void *     dict_snapshot_get_value_at(const dict_snapshot_t *snapshot, unsigned int ix);
+const char *     dict_snapshot_get_key_at(const dict_snapshot_t *snapshot, unsigned int ix);
+unsigned int     dict_snapshot_count(const dict_snapshot_t *snapshot);
+
+//-----------------------------------------------------------------------------
+// Persistent dictionary
+//-----------------------------------------------------------------------------
+
+// Hash trie whose nodes are shared between a dict and its snapshots. Taking a
+// snapshot is O(1), sets and removes copy only the shared nodes on their path.
+// A snapshot can be handed to other threads, which read and destroy it without
+// locks while the dict it was taken from keeps being modified. A single
+// pdict_t_ isn't safe to read and modify concurrently.
+typedef struct pdict_ pdict_t_;
+
+typedef void (*pdict_item_fn)(const char *key, void *value, void *ctx);
+
+#define pdict(TYPE) pdict_t_
+
+pdict_t_*    pdict_make(void);
+pdict_t_*    pdict_make_with_allocator(const collections_allocator_t *allocator); // snapshots share it and free through it from whichever thread destroys them
+pdict_t_*    pdict_make_from_dict(const dict_t_ *source); // NULL past UINT_MAX items
+pdict_t_*    pdict_snapshot(const pdict_t_ *dict);
+void         pdict_destroy(pdict_t_ *dict);
+bool         pdict_set(pdict_t_ *dict, const char *key, void *value);
+bool         pdict_setn(pdict_t_ *dict, const char *key, size_t len, void *value);
+void *       pdict_get(const pdict_t_ *dict, const char *key);
+void *       pdict_getn(const pdict_t_ *dict, const char *key, size_t len);
+bool         pdict_contains(const pdict_t_ *dict, const char *key);
+unsigned int pdict_count(const pdict_t_ *dict);
+bool         pdict_remove(pdict_t_ *dict, const char *key);
+bool         pdict_removen(pdict_t_ *dict, const char *key, size_t len);
+void         pdict_foreach(const pdict_t_ *dict, pdict_item_fn fn, void *ctx); // in no particular order
+void         pdict_get_stats(const pdict_t_ *dict, dict_stats_t *out_stats); // max_displacement is trie depth, shared nodes are counted
+
+//-----------------------------------------------------------------------------
+// Cache
+//-----------------------------------------------------------------------------
+
+// Dictionary bounded by an item count and/or a byte budget, with sizes of
+// values given by the caller. Sets evict with CLOCK (second chance) when a
+// budget would be exceeded. Recency is a byte per item kept next to the dict's
+// item arrays. evict_fn is called for every value the cache drops: evicted,
+// replaced, removed, cleared or destroyed.
+typedef struct cache_ cache_t_;
+
+typedef void (*cache_evict_fn)(const char *key, void *value, void *ctx);
+
+typedef struct {
+    collections_size_t count;
+    size_t bytes;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    double hit_ratio;
+} cache_stats_t;
+
+#define cache(TYPE) cache_t_
+
+cache_t_*          cache_make(collections_size_t max_count, size_t max_bytes); // 0 for no limit, one must be set
+cache_t_*          cache_make_with_allocator(collections_size_t max_count, size_t max_bytes, const collections_allocator_t *allocator);
+void               cache_destroy(cache_t_ *cache);
+void               cache_set_evict_fn(cache_t_ *cache, cache_evict_fn evict_fn, void *ctx);
+bool               cache_set(cache_t_ *cache, const char *key, void *value, size_t size); // size only counts with max_bytes, false if larger
+bool               cache_setn(cache_t_ *cache, const char *key, size_t len, void *value, size_t size);
+void *             cache_get(cache_t_ *cache, const char *key); // marks key as recently used
+void *             cache_getn(cache_t_ *cache, const char *key, size_t len);
+void *             cache_peek(const cache_t_ *cache, const char *key); // doesn't mark key or count hits
+bool               cache_remove(cache_t_ *cache, const char *key);
+collections_size_t cache_count(const cache_t_ *cache);
+size_t             cache_bytes(const cache_t_ *cache);
+void               cache_clear(cache_t_ *cache);
+void               cache_get_stats(const cache_t_ *cache, cache_stats_t *out_stats);
 
 //-----------------------------------------------------------------------------
 // Array
@@ -74,26 +432,32 @@ typedef struct array_ array_t_;
 #define array(TYPE) array_t_
 
 #define array_make(type) array_make_(sizeof(type))
-array_t_*    array_make_(size_t element_size);
-array_t_*    array_make_with_capacity(unsigned int capacity, size_t element_size);
-void         array_destroy(array_t_ *arr);
-bool         array_add(array_t_ *arr, const void *value);
-bool         array_addn(array_t_ *arr, const void *values, unsigned int n);
-bool         array_add_array(array_t_ *dest, const array_t_ *source);
-bool         array_push(array_t_ *arr, const void *value);
-bool         array_pop(array_t_ *arr, void *out_value);
-bool         array_set(array_t_ *arr, unsigned int ix, void *value);
-bool         array_setn(array_t_ *arr, unsigned int ix, void *values, unsigned int n);
-void *       array_get(const array_t_ *arr, unsigned int ix);
-void *       array_get_last(const array_t_ *arr);
-unsigned int array_count(const array_t_ *arr);
-bool         array_remove(array_t_ *arr, unsigned int ix);
-void         array_clear(array_t_ *arr);
-void         array_lock_capacity(array_t_ *arr);
-int          array_get_index(const array_t_ *arr, void *ptr);
-void*        array_data(array_t_ *arr);
-const void*  array_const_data(const array_t_ *arr);
-bool         array_orphan_data(array_t_ *arr);
+array_t_*          array_make_(size_t element_size);
+array_t_*          array_make_with_capacity(collections_size_t capacity, size_t element_size);
+array_t_*          array_make_with_allocator(collections_size_t capacity, size_t element_size, const collections_allocator_t *allocator);
+void               array_destroy(array_t_ *arr);
+bool               array_add(array_t_ *arr, const void *value);
+bool               array_addn(array_t_ *arr, const void *values, collections_size_t n);
+bool               array_add_array(array_t_ *dest, const array_t_ *source);
+bool               array_insertn(array_t_ *arr, collections_size_t ix, const void *values, collections_size_t n); // NULL values leaves new items unset
+bool               array_push(array_t_ *arr, const void *value);
+bool               array_pop(array_t_ *arr, void *out_value);
+bool               array_set(array_t_ *arr, collections_size_t ix, void *value);
+bool               array_setn(array_t_ *arr, collections_size_t ix, void *values, collections_size_t n); // appends items past count
+void *             array_get(const array_t_ *arr, collections_size_t ix);
+void *             array_get_last(const array_t_ *arr);
+collections_size_t array_count(const array_t_ *arr);
+bool               array_remove(array_t_ *arr, collections_size_t ix);
+bool               array_removen(array_t_ *arr, collections_size_t ix, collections_size_t n);
+bool               array_resize(array_t_ *arr, collections_size_t count); // new items are zeroed
+bool               array_reserve(array_t_ *arr, collections_size_t capacity);
+bool               array_set_growth(array_t_ *arr, float factor, size_t max_step_bytes, bool page_granular); // factor > 1, default 2; 0 max_step_bytes for no limit; page_granular rounds capacities of a page or more up to whole pages
+void               array_clear(array_t_ *arr);
+void               array_lock_capacity(array_t_ *arr);
+int                array_get_index(const array_t_ *arr, void *ptr);
+void*              array_data(array_t_ *arr);
+const void*        array_const_data(const array_t_ *arr);
+bool               array_orphan_data(array_t_ *arr);
 
 //-----------------------------------------------------------------------------
 // Pointer Array
@@ -108,6 +472,7 @@ typedef struct ptrarray_ ptrarray_t_;
 
 ptrarray_t_* ptrarray_make(void);
 ptrarray_t_* ptrarray_make_with_capacity(unsigned int capacity);
+ptrarray_t_* ptrarray_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator);
 void         ptrarray_destroy(ptrarray_t_ *arr);
 void         ptrarray_destroy_with_items_(ptrarray_t_ *arr, ptrarray_item_destroy_fn destroy_fn);
 bool         ptrarray_add(ptrarray_t_ *arr, void *ptr);
@@ -127,6 +492,53 @@ void *       ptrarray_get_addr(ptrarray_t_ *arr, unsigned int ix);
 void*        ptrarray_data(ptrarray_t_ *arr);
 void         ptrarray_reverse(ptrarray_t_ *arr);
 
+//-----------------------------------------------------------------------------
+// Small array
+//-----------------------------------------------------------------------------
+
+// Keeps the first N items inline and only allocates once it outgrows them. Meant to be
+// embedded in other structs or declared on the stack, so its layout is public, but fields
+// shouldn't be used directly. Inline items are found by offset, so a struct holding a
+// small array can be copied or moved with memcpy (copies share spilled data).
+//   smallarray(int, 8) ints;
+//   smallarray_init(&ints);
+//   smallarray_add(&ints.base, &x);
+//   smallarray_deinit(&ints.base);
+// For pointers use smallarray(void*, N) and pass addresses of pointers, like array_t_.
+typedef struct smallarray_ {
+    void *heap; // NULL while items fit inline
+    collections_size_t count;
+    collections_size_t capacity;
+    collections_size_t inline_capacity;
+    unsigned int inline_offset;
+    size_t element_size;
+    const collections_allocator_t *allocator;
+} smallarray_t_;
+
+#define smallarray(TYPE, N) struct { smallarray_t_ base; TYPE items[N]; }
+#define smallarray_init(sarr) smallarray_init_with_allocator(sarr, NULL)
+#define smallarray_init_with_allocator(sarr, allocator) \
+    smallarray_init_(&(sarr)->base, sizeof((sarr)->items[0]), sizeof((sarr)->items) / sizeof((sarr)->items[0]), \
+                     (unsigned int)((char*)(sarr)->items - (char*)&(sarr)->base), allocator)
+
+void               smallarray_init_(smallarray_t_ *arr, size_t element_size, collections_size_t inline_capacity,
+                                    unsigned int inline_offset, const collections_allocator_t *allocator);
+void               smallarray_deinit(smallarray_t_ *arr); // frees spilled items, arr is empty and inline afterwards
+bool               smallarray_add(smallarray_t_ *arr, const void *value);
+bool               smallarray_addn(smallarray_t_ *arr, const void *values, collections_size_t n);
+bool               smallarray_insertn(smallarray_t_ *arr, collections_size_t ix, const void *values, collections_size_t n); // NULL values leaves new items unset
+bool               smallarray_pop(smallarray_t_ *arr, void *out_value);
+bool               smallarray_set(smallarray_t_ *arr, collections_size_t ix, const void *value);
+void *             smallarray_get(const smallarray_t_ *arr, collections_size_t ix);
+void *             smallarray_get_last(const smallarray_t_ *arr);
+collections_size_t smallarray_count(const smallarray_t_ *arr);
+bool               smallarray_remove(smallarray_t_ *arr, collections_size_t ix);
+bool               smallarray_removen(smallarray_t_ *arr, collections_size_t ix, collections_size_t n);
+bool               smallarray_reserve(smallarray_t_ *arr, collections_size_t capacity);
+void               smallarray_clear(smallarray_t_ *arr); // keeps spilled capacity
+bool               smallarray_is_inline(const smallarray_t_ *arr);
+void*              smallarray_data(smallarray_t_ *arr);
+
 //-----------------------------------------------------------------------------
 // String buffer
 //-----------------------------------------------------------------------------
@@ -135,6 +547,7 @@ typedef struct strbuf strbuf_t;
 
 strbuf_t* strbuf_make(void);
 strbuf_t* strbuf_make_with_capacity(unsigned int capacity);
+strbuf_t* strbuf_make_with_allocator(unsigned int capacity, const collections_allocator_t *allocator);
 void strbuf_destroy(strbuf_t *buf);
 void strbuf_clear(strbuf_t *buf);
 bool strbuf_append(strbuf_t *buf, const char *str);
@@ -0,0 +1,1221 @@
+/*
+    Copyright (c) 2019 Krzysztof Gabis
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "benchmarks_collections.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../collections.h"
+
+#define BENCH_ITEMS_COUNT (1024 * 1024)
+
+typedef struct {
+    const char *name;
+    dict_hash_fn fn;
+} bench_hash_t;
+
+typedef struct {
+    int kind;
+    ptrarray(void) *children;
+} bench_ptrarray_node_t;
+
+typedef struct {
+    int kind;
+    smallarray(void*, 8) children;
+} bench_smallarray_node_t;
+
+#define SCALING_KEYS_COUNT (256 * 1024)
+#define SCALING_OPS_PER_THREAD (1024 * 1024)
+#define SCALING_MAX_THREADS 32
+
+#define SMALL_DICTS_COUNT (16 * 1024)
+#define SMALL_DICT_ROUNDS 32
+#define SMALL_DICT_ITEMS_COUNT 8
+
+#ifndef LARGE_BENCH_ITEMS_COUNT
+#define LARGE_BENCH_ITEMS_COUNT 100000000ull
+#endif
+
+#define CACHE_KEYS_COUNT (1024 * 1024)
+
+#define ALLOCATOR_BENCH_REQUESTS (64 * 1024)
+#define ALLOCATOR_BENCH_ITEMS_PER_REQUEST 64
+
+#define SMALLARRAY_BENCH_NODES_COUNT (1024 * 1024)
+#define SMALLARRAY_BENCH_ROUNDS 8
+
+#define ARRAY_BENCH_ITEMS_COUNT (64 * 1024 * 1024)
+#define ARRAY_BENCH_CHUNK 4096
+
+#ifndef ARRAY_GROWTH_BENCH_BYTES
+#define ARRAY_GROWTH_BENCH_BYTES (1024ull * 1024 * 1024)
+#endif
+
+// Baseline for cache benchmarks, dict of nodes in a recency list
+typedef struct lru_node_ {
+    struct lru_node_ *prev;
+    struct lru_node_ *next;
+    const char *key;
+    void *value;
+} lru_node_t;
+
+typedef struct {
+    dict_t_ *dict;
+    lru_node_t *head;
+    lru_node_t *tail;
+    unsigned int max_count;
+} lru_cache_t;
+
+typedef struct {
+    cdict_t_ *cdict; // one of cdict or dict + mutex is set
+    dict_t_ *dict;
+    pthread_mutex_t *mutex;
+    char **keys;
+    unsigned long long seed;
+} scaling_thread_t;
+
+static void hash_benchmarks(void);
+static void rehash_latency_benchmarks(void);
+static void print_latencies(const char *name, double *latencies, int count);
+static void key_arena_benchmarks(void);
+static void batched_get_benchmarks(void);
+static void capacity_benchmarks(void);
+static void ptrdict_hash_benchmarks(void);
+static void cdict_scaling_benchmarks(void);
+static void frozendict_benchmarks(void);
+static void dict_snapshot_benchmarks(void);
+static void valdict_benchmarks(void);
+static void set_benchmarks(void);
+static void large_table_benchmarks(void);
+static void small_dict_benchmarks(void);
+static void bulk_build_benchmarks(void);
+static void pdict_benchmarks(void);
+static void bloom_benchmarks(void);
+static void cache_benchmarks(void);
+static void array_bulk_benchmarks(void);
+static void array_growth_benchmarks(void);
+static void allocator_benchmarks(void);
+static void smallarray_benchmarks(void);
+static void make_zipf_stream(double exponent, double *cdf, int *out_stream);
+static void *lru_cache_get(lru_cache_t *lru, const char *key);
+static void lru_cache_set(lru_cache_t *lru, const char *key);
+static void lru_cache_unlink(lru_cache_t *lru, lru_node_t *node);
+static void lru_cache_push_front(lru_cache_t *lru, lru_node_t *node);
+static void lru_cache_destroy(lru_cache_t *lru);
+static void *cdict_scaling_thread(void *arg);
+static char** make_numeric_keys(int count);
+static char** make_path_keys(int count);
+static void destroy_keys(char **keys, int count);
+static void shuffle_keys(char **keys, int count);
+static void bench_hash(const bench_hash_t *hash, const char *keys_name, char **keys, int count);
+static double now_seconds(void);
+
+void collections_benchmarks() {
+    hash_benchmarks();
+    rehash_latency_benchmarks();
+    key_arena_benchmarks();
+    batched_get_benchmarks();
+    capacity_benchmarks();
+    ptrdict_hash_benchmarks();
+    cdict_scaling_benchmarks();
+    frozendict_benchmarks();
+    dict_snapshot_benchmarks();
+    valdict_benchmarks();
+    set_benchmarks();
+    large_table_benchmarks();
+    small_dict_benchmarks();
+    bulk_build_benchmarks();
+    pdict_benchmarks();
+    bloom_benchmarks();
+    cache_benchmarks();
+    array_bulk_benchmarks();
+    array_growth_benchmarks();
+    allocator_benchmarks();
+    smallarray_benchmarks();
+}
+
+static void hash_benchmarks(void) {
+    puts("Running hash benchmarks:");
+    const bench_hash_t hashes[] = {
+        { "djb2", dict_hash_djb2 },
+        { "wyhash", dict_hash_wyhash },
+    };
+    char **numeric_keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    char **path_keys = make_path_keys(BENCH_ITEMS_COUNT);
+    for (unsigned int i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+        bench_hash(&hashes[i], "numeric", numeric_keys, BENCH_ITEMS_COUNT);
+        bench_hash(&hashes[i], "path", path_keys, BENCH_ITEMS_COUNT);
+    }
+    destroy_keys(numeric_keys, BENCH_ITEMS_COUNT);
+    destroy_keys(path_keys, BENCH_ITEMS_COUNT);
+}
+
+static void rehash_latency_benchmarks(void) {
+    puts("Running rehash latency benchmarks:");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    double *latencies = malloc(BENCH_ITEMS_COUNT * sizeof(double));
+    for (int incremental = 0; incremental < 2; incremental++) {
+        dict_t_ *dict = dict_make();
+        dict_set_incremental_rehash(dict, incremental);
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            double start = now_seconds();
+            dict_set(dict, keys[i], keys[i]);
+            latencies[i] = now_seconds() - start;
+        }
+        dict_destroy(dict);
+        print_latencies(incremental ? "dict incremental" : "dict full", latencies, BENCH_ITEMS_COUNT);
+
+        ptrdict_t_ *ptrdict = ptrdict_make();
+        ptrdict_set_incremental_rehash(ptrdict, incremental);
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            double start = now_seconds();
+            ptrdict_set(ptrdict, keys[i], keys[i]);
+            latencies[i] = now_seconds() - start;
+        }
+        ptrdict_destroy(ptrdict);
+        print_latencies(incremental ? "ptrdict incremental" : "ptrdict full", latencies, BENCH_ITEMS_COUNT);
+    }
+    free(latencies);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latencies(const char *name, double *latencies, int count) {
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        total += latencies[i];
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("%-20s set total: %6.1f ms, p99.99: %7.1f us, max: %8.1f us\n",
+           name, total * 1e3, latencies[(int)(count * 0.9999)] * 1e6, latencies[count - 1] * 1e6);
+}
+
+static void key_arena_benchmarks(void) {
+    puts("Running key arena benchmarks:");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    for (int arena = 0; arena < 2; arena++) {
+        double start = now_seconds();
+        dict_t_ *dict = dict_make();
+        dict_set_key_arena(dict, arena);
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(dict, keys[i], keys[i]);
+        }
+        double set_time = now_seconds() - start;
+        start = now_seconds();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i += 2) {
+            dict_remove(dict, keys[i]);
+        }
+        double remove_time = now_seconds() - start;
+        size_t waste = dict_key_arena_waste(dict);
+        start = now_seconds();
+        dict_destroy(dict);
+        double destroy_time = now_seconds() - start;
+        printf("%-8s set: %6.1f ms, remove half: %6.1f ms, destroy: %6.1f ms, waste: %zu bytes\n",
+               arena ? "arena" : "strdup", set_time * 1e3, remove_time * 1e3, destroy_time * 1e3, waste);
+    }
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void batched_get_benchmarks(void) {
+    puts("Running batched get benchmarks:");
+    const unsigned int batch_size = 4096;
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    char **lookup_keys = malloc(BENCH_ITEMS_COUNT * sizeof(char*));
+    void **values = malloc(BENCH_ITEMS_COUNT * sizeof(void*));
+    dict_t_ *dict = dict_make();
+    ptrdict_t_ *ptrdict = ptrdict_make();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        dict_set(dict, keys[i], keys[i]);
+        ptrdict_set(ptrdict, keys[i], keys[i]);
+        lookup_keys[i] = keys[i];
+    }
+    // random lookup order so consecutive keys don't share cache lines
+    shuffle_keys(lookup_keys, BENCH_ITEMS_COUNT);
+
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        values[i] = dict_get(dict, lookup_keys[i]);
+    }
+    double single_time = now_seconds() - start;
+    start = now_seconds();
+    for (unsigned int i = 0; i < BENCH_ITEMS_COUNT; i += batch_size) {
+        dict_get_many(dict, (const char * const *)lookup_keys + i, batch_size, values + i);
+    }
+    double batch_time = now_seconds() - start;
+    printf("dict     get: %6.1f ns/op, get_many: %6.1f ns/op\n",
+           single_time * 1e9 / BENCH_ITEMS_COUNT, batch_time * 1e9 / BENCH_ITEMS_COUNT);
+
+    start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        values[i] = ptrdict_get(ptrdict, lookup_keys[i]);
+    }
+    single_time = now_seconds() - start;
+    start = now_seconds();
+    for (unsigned int i = 0; i < BENCH_ITEMS_COUNT; i += batch_size) {
+        ptrdict_get_many(ptrdict, (void * const *)lookup_keys + i, batch_size, values + i);
+    }
+    batch_time = now_seconds() - start;
+    printf("ptrdict  get: %6.1f ns/op, get_many: %6.1f ns/op\n",
+           single_time * 1e9 / BENCH_ITEMS_COUNT, batch_time * 1e9 / BENCH_ITEMS_COUNT);
+
+    dict_destroy(dict);
+    ptrdict_destroy(ptrdict);
+    free(values);
+    free(lookup_keys);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void capacity_benchmarks(void) {
+    puts("Running capacity benchmarks:");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    for (int reserved = 0; reserved < 2; reserved++) {
+        double start = now_seconds();
+        dict_t_ *dict = reserved ? dict_make_with_capacity(BENCH_ITEMS_COUNT) : dict_make();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(dict, keys[i], keys[i]);
+        }
+        double set_time = now_seconds() - start;
+        dict_destroy(dict);
+
+        start = now_seconds();
+        ptrdict_t_ *ptrdict = reserved ? ptrdict_make_with_capacity(BENCH_ITEMS_COUNT) : ptrdict_make();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            ptrdict_set(ptrdict, keys[i], keys[i]);
+        }
+        double ptrdict_set_time = now_seconds() - start;
+        ptrdict_destroy(ptrdict);
+        printf("%-9s dict load: %6.1f ms, ptrdict load: %6.1f ms\n",
+               reserved ? "reserved" : "growing", set_time * 1e3, ptrdict_set_time * 1e3);
+    }
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void ptrdict_hash_benchmarks(void) {
+    puts("Running ptrdict hash benchmarks:");
+    void **ptrs = malloc(BENCH_ITEMS_COUNT * sizeof(void*));
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        ptrs[i] = malloc(16 + (i % 4) * 16);
+    }
+
+    // linear probing with unmixed pointers as home cells, as ptrdict used to do
+    unsigned int cell_capacity = 1;
+    while (cell_capacity * 0.7 < BENCH_ITEMS_COUNT) {
+        cell_capacity *= 2;
+    }
+    unsigned int mask = cell_capacity - 1;
+    unsigned char *cells = calloc(cell_capacity, 1);
+    unsigned long long total_probes = 0;
+    unsigned int max_probes = 0;
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        unsigned int probes = 1;
+        unsigned int ix = (unsigned int)((size_t)ptrs[i] & mask);
+        while (cells[ix]) {
+            ix = (ix + 1) & mask;
+            probes++;
+        }
+        cells[ix] = 1;
+        total_probes += probes;
+        max_probes = probes > max_probes ? probes : max_probes;
+    }
+    free(cells);
+    printf("identity probes avg: %7.2f max: %7u\n", (double)total_probes / BENCH_ITEMS_COUNT, max_probes);
+
+    ptrdict_t_ *dict = ptrdict_make();
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        ptrdict_set(dict, ptrs[i], ptrs[i]);
+    }
+    double set_time = now_seconds() - start;
+    start = now_seconds();
+    size_t acc = 0;
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        acc ^= (size_t)ptrdict_get(dict, ptrs[i]);
+    }
+    double get_time = now_seconds() - start;
+    dict_stats_t stats;
+    ptrdict_get_stats(dict, &stats);
+    printf("mixed    probes avg: %7.2f max: %7u, set: %6.1f ns/op, get: %6.1f ns/op (%zx)\n",
+           stats.avg_displacement + 1, stats.max_displacement + 1,
+           set_time * 1e9 / BENCH_ITEMS_COUNT, get_time * 1e9 / BENCH_ITEMS_COUNT, acc & 0xf);
+    ptrdict_destroy(dict);
+
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        free(ptrs[i]);
+    }
+    free(ptrs);
+}
+
+static void cdict_scaling_benchmarks(void) {
+    puts("Running cdict scaling benchmarks (90% get, 10% set):");
+    char **keys = make_numeric_keys(SCALING_KEYS_COUNT);
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cpu_count > SCALING_MAX_THREADS ? SCALING_MAX_THREADS : (cpu_count < 4 ? 4 : (int)cpu_count);
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    dict_t_ *dict = dict_make();
+    cdict_t_ *cdict = cdict_make(0);
+    for (int i = 0; i < SCALING_KEYS_COUNT; i++) {
+        dict_set(dict, keys[i], keys[i]);
+        cdict_set(cdict, keys[i], keys[i]);
+    }
+    for (int thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        double ops_per_sec[2];
+        for (int sharded = 0; sharded < 2; sharded++) {
+            pthread_t threads[SCALING_MAX_THREADS];
+            scaling_thread_t args[SCALING_MAX_THREADS];
+            double start = now_seconds();
+            for (int i = 0; i < thread_count; i++) {
+                args[i].cdict = sharded ? cdict : NULL;
+                args[i].dict = sharded ? NULL : dict;
+                args[i].mutex = &mutex;
+                args[i].keys = keys;
+                args[i].seed = 88172645463325252ull + i;
+                pthread_create(&threads[i], NULL, cdict_scaling_thread, &args[i]);
+            }
+            for (int i = 0; i < thread_count; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            ops_per_sec[sharded] = (double)thread_count * SCALING_OPS_PER_THREAD / (now_seconds() - start);
+        }
+        printf("%2d threads  dict + mutex: %6.2f Mops/s, cdict: %6.2f Mops/s\n",
+               thread_count, ops_per_sec[0] * 1e-6, ops_per_sec[1] * 1e-6);
+    }
+    dict_destroy(dict);
+    cdict_destroy(cdict);
+    destroy_keys(keys, SCALING_KEYS_COUNT);
+}
+
+static void *cdict_scaling_thread(void *arg) {
+    scaling_thread_t *thread = arg;
+    unsigned long long x = thread->seed;
+    for (int i = 0; i < SCALING_OPS_PER_THREAD; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        char *key = thread->keys[x % SCALING_KEYS_COUNT];
+        bool is_set = (x >> 32) % 10 == 0;
+        if (thread->cdict) {
+            if (is_set) {
+                cdict_set(thread->cdict, key, key);
+            } else {
+                cdict_get(thread->cdict, key);
+            }
+        } else {
+            pthread_mutex_lock(thread->mutex);
+            if (is_set) {
+                dict_set(thread->dict, key, key);
+            } else {
+                dict_get(thread->dict, key);
+            }
+            pthread_mutex_unlock(thread->mutex);
+        }
+    }
+    return NULL;
+}
+
+static void frozendict_benchmarks(void) {
+    puts("Running frozendict benchmarks:");
+    char **keys_sets[2] = { make_numeric_keys(BENCH_ITEMS_COUNT), make_path_keys(BENCH_ITEMS_COUNT) };
+    const char *keys_names[2] = { "numeric", "path" };
+    for (int k = 0; k < 2; k++) {
+        char **keys = keys_sets[k];
+        dict_t_ *dict = dict_make();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(dict, keys[i], keys[i]);
+        }
+        double start = now_seconds();
+        frozendict_t_ *frozen = frozendict_make(dict);
+        double build_time = now_seconds() - start;
+        shuffle_keys(keys, BENCH_ITEMS_COUNT);
+
+        size_t acc = 0;
+        start = now_seconds();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            acc ^= (size_t)dict_get(dict, keys[i]);
+        }
+        double dict_get_time = now_seconds() - start;
+        start = now_seconds();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            acc ^= (size_t)frozendict_get(frozen, keys[i]);
+        }
+        double frozen_get_time = now_seconds() - start;
+
+        dict_stats_t dict_stats;
+        dict_stats_t frozen_stats;
+        dict_get_stats(dict, &dict_stats);
+        frozendict_get_stats(frozen, &frozen_stats);
+        printf("%-8s build: %6.1f ms, get dict: %5.1f ns/op, frozen: %5.1f ns/op, "
+               "bytes dict: %5.1f MB, frozen: %5.1f MB (%zx)\n",
+               keys_names[k], build_time * 1e3,
+               dict_get_time * 1e9 / BENCH_ITEMS_COUNT, frozen_get_time * 1e9 / BENCH_ITEMS_COUNT,
+               dict_stats.total_bytes / (1024.0 * 1024.0), frozen_stats.total_bytes / (1024.0 * 1024.0), acc & 0xf);
+        frozendict_destroy(frozen);
+        dict_destroy(dict);
+        destroy_keys(keys, BENCH_ITEMS_COUNT);
+    }
+}
+
+static void dict_snapshot_benchmarks(void) {
+    puts("Running dict snapshot benchmarks:");
+    char path[128];
+    snprintf(path, sizeof(path), "/tmp/cutils_snapshot_bench_%d.bin", (int)getpid());
+    char **keys = make_path_keys(BENCH_ITEMS_COUNT);
+    double start = now_seconds();
+    dict_t_ *dict = dict_make();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        dict_set(dict, keys[i], keys[i]);
+    }
+    double build_time = now_seconds() - start;
+    start = now_seconds();
+    dict_snapshot_write(dict, path, NULL, NULL);
+    double write_time = now_seconds() - start;
+    dict_destroy(dict);
+    shuffle_keys(keys, BENCH_ITEMS_COUNT);
+
+    start = now_seconds();
+    dict_snapshot_t *snapshot = dict_snapshot_open(path);
+    double open_time = now_seconds() - start;
+    size_t acc = 0;
+    start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        acc ^= (size_t)dict_snapshot_get(snapshot, keys[i]);
+    }
+    double get_time = now_seconds() - start;
+    printf("build dict: %6.1f ms, write: %6.1f ms, open: %6.3f ms, get: %5.1f ns/op (%zx)\n",
+           build_time * 1e3, write_time * 1e3, open_time * 1e3,
+           get_time * 1e9 / BENCH_ITEMS_COUNT, acc & 0xf);
+    dict_snapshot_close(snapshot);
+    remove(path);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void valdict_benchmarks(void) {
+    puts("Running valdict benchmarks (counting every key 4 times):");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    shuffle_keys(keys, BENCH_ITEMS_COUNT);
+
+    double start = now_seconds();
+    dict_t_ *dict = dict_make();
+    for (int pass = 0; pass < 4; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            int *counter = dict_get(dict, keys[i]);
+            if (counter == NULL) {
+                counter = calloc(1, sizeof(int));
+                dict_set(dict, keys[i], counter);
+            }
+            (*counter)++;
+        }
+    }
+    double dict_count_time = now_seconds() - start;
+    shuffle_keys(keys, BENCH_ITEMS_COUNT);
+    long long sum = 0;
+    start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        sum += *(int*)dict_get(dict, keys[i]);
+    }
+    double dict_get_time = now_seconds() - start;
+    for (unsigned int i = 0; i < dict_count(dict); i++) {
+        free(dict_get_value_at(dict, i));
+    }
+    dict_destroy(dict);
+
+    start = now_seconds();
+    valdict_t_ *valdict = valdict_make(int);
+    for (int pass = 0; pass < 4; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            int *counter = valdict_get_or_add(valdict, keys[i]);
+            (*counter)++;
+        }
+    }
+    double valdict_count_time = now_seconds() - start;
+    shuffle_keys(keys, BENCH_ITEMS_COUNT);
+    start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        sum += *(int*)valdict_get(valdict, keys[i]);
+    }
+    double valdict_get_time = now_seconds() - start;
+    valdict_destroy(valdict);
+
+    printf("dict + malloc count: %6.1f ms, get: %5.1f ns/op, valdict count: %6.1f ms, get: %5.1f ns/op (%lld)\n",
+           dict_count_time * 1e3, dict_get_time * 1e9 / BENCH_ITEMS_COUNT,
+           valdict_count_time * 1e3, valdict_get_time * 1e9 / BENCH_ITEMS_COUNT, sum);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void set_benchmarks(void) {
+    puts("Running set benchmarks (dedup of 2x keys, intersection of halves):");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    int half = BENCH_ITEMS_COUNT / 2;
+
+    double start = now_seconds();
+    dict_t_ *dicts[2] = { dict_make(), dict_make() };
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(dicts[i < half], keys[i], keys[i]);
+        }
+    }
+    double dict_dedup_time = now_seconds() - start;
+    start = now_seconds();
+    dict_t_ *dict_common = dict_make();
+    for (unsigned int i = 0; i < dict_count(dicts[0]); i++) {
+        const char *key = dict_get_key_at(dicts[0], i);
+        if (dict_get(dicts[1], key)) {
+            dict_set(dict_common, key, (void*)key);
+        }
+    }
+    double dict_intersection_time = now_seconds() - start;
+    dict_stats_t dict_stats;
+    dict_get_stats(dicts[0], &dict_stats);
+
+    start = now_seconds();
+    strset_t_ *sets[2] = { strset_make(), strset_make() };
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            strset_add(sets[i < half], keys[i]);
+        }
+    }
+    double set_dedup_time = now_seconds() - start;
+    start = now_seconds();
+    strset_t_ *set_common = strset_intersection(sets[0], sets[1]);
+    double set_intersection_time = now_seconds() - start;
+    dict_stats_t set_stats;
+    strset_get_stats(sets[0], &set_stats);
+    printf("dict   dedup: %6.1f ms, intersection: %5.1f ms, bytes/item: %5.1f\n",
+           dict_dedup_time * 1e3, dict_intersection_time * 1e3, (double)dict_stats.total_bytes / dict_stats.count);
+    printf("strset dedup: %6.1f ms, intersection: %5.1f ms, bytes/item: %5.1f\n",
+           set_dedup_time * 1e3, set_intersection_time * 1e3, (double)set_stats.total_bytes / set_stats.count);
+
+    start = now_seconds();
+    ptrdict_t_ *ptrdict = ptrdict_make();
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            ptrdict_set(ptrdict, keys[i], keys[i]);
+        }
+    }
+    double ptrdict_dedup_time = now_seconds() - start;
+    ptrdict_get_stats(ptrdict, &dict_stats);
+    start = now_seconds();
+    ptrset_t_ *ptrset = ptrset_make();
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            ptrset_add(ptrset, keys[i]);
+        }
+    }
+    double ptrset_dedup_time = now_seconds() - start;
+    ptrset_get_stats(ptrset, &set_stats);
+    printf("ptrdict dedup: %6.1f ms, bytes/item: %5.1f, ptrset dedup: %6.1f ms, bytes/item: %5.1f\n",
+           ptrdict_dedup_time * 1e3, (double)dict_stats.total_bytes / dict_stats.count,
+           ptrset_dedup_time * 1e3, (double)set_stats.total_bytes / set_stats.count);
+
+    dict_destroy(dicts[0]);
+    dict_destroy(dicts[1]);
+    dict_destroy(dict_common);
+    strset_destroy(sets[0]);
+    strset_destroy(sets[1]);
+    strset_destroy(set_common);
+    ptrdict_destroy(ptrdict);
+    ptrset_destroy(ptrset);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void large_table_benchmarks(void) {
+#ifdef COLLECTIONS_LARGE_TABLES
+#ifdef COLLECTIONS_NO_HUGE_PAGES
+    const char *pages = "4K pages";
+#else
+    const char *pages = "huge pages";
+#endif
+    printf("Running large table benchmarks (%llu items, %s):\n", (unsigned long long)LARGE_BENCH_ITEMS_COUNT, pages);
+    ptrdict_t_ *dict = ptrdict_make_with_capacity(LARGE_BENCH_ITEMS_COUNT);
+    double start = now_seconds();
+    for (unsigned long long i = 1; i <= LARGE_BENCH_ITEMS_COUNT; i++) {
+        ptrdict_set(dict, (void*)(size_t)i, (void*)(size_t)i);
+    }
+    double set_time = now_seconds() - start;
+    unsigned long long x = 88172645463325252ull;
+    size_t acc = 0;
+    start = now_seconds();
+    for (unsigned long long i = 0; i < LARGE_BENCH_ITEMS_COUNT; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        acc ^= (size_t)ptrdict_get(dict, (void*)(size_t)(x % LARGE_BENCH_ITEMS_COUNT + 1));
+    }
+    double get_time = now_seconds() - start;
+    dict_stats_t stats;
+    ptrdict_get_stats(dict, &stats);
+    printf("ptrdict set: %6.1f ns/op, random get: %6.1f ns/op, cells: %llu, bytes/item: %5.1f (%zx)\n",
+           set_time * 1e9 / LARGE_BENCH_ITEMS_COUNT, get_time * 1e9 / LARGE_BENCH_ITEMS_COUNT,
+           (unsigned long long)stats.cell_capacity, (double)stats.total_bytes / stats.count, acc & 0xf);
+    ptrdict_destroy(dict);
+#endif
+}
+
+static void small_dict_benchmarks(void) {
+    printf("Running small dict benchmarks (%d rounds of %d dicts of %d items):\n",
+           SMALL_DICT_ROUNDS, SMALL_DICTS_COUNT, SMALL_DICT_ITEMS_COUNT);
+    char **keys = make_numeric_keys(SMALL_DICT_ITEMS_COUNT);
+    dict_t_ **dicts = malloc(SMALL_DICTS_COUNT * sizeof(dict_t_*));
+    for (int compact = 0; compact < 2; compact++) {
+        double make_time = 0, set_time = 0, destroy_time = 0;
+        size_t bytes = 0;
+        for (int round = 0; round < SMALL_DICT_ROUNDS; round++) {
+            double start = now_seconds();
+            for (int i = 0; i < SMALL_DICTS_COUNT; i++) {
+                dicts[i] = compact ? dict_make_compact(0) : dict_make();
+            }
+            make_time += now_seconds() - start;
+            start = now_seconds();
+            for (int i = 0; i < SMALL_DICTS_COUNT; i++) {
+                for (int j = 0; j < SMALL_DICT_ITEMS_COUNT; j++) {
+                    dict_set(dicts[i], keys[j], keys[j]);
+                }
+            }
+            set_time += now_seconds() - start;
+            dict_stats_t stats;
+            dict_get_stats(dicts[0], &stats);
+            bytes = stats.total_bytes;
+            start = now_seconds();
+            for (int i = 0; i < SMALL_DICTS_COUNT; i++) {
+                dict_destroy(dicts[i]);
+            }
+            destroy_time += now_seconds() - start;
+        }
+        double dict_count = (double)SMALL_DICT_ROUNDS * SMALL_DICTS_COUNT;
+        printf("%-7s make: %5.1f ns, set %d items: %6.1f ns, destroy: %5.1f ns, bytes: %zu (per dict)\n",
+               compact ? "compact" : "dict", make_time * 1e9 / dict_count, SMALL_DICT_ITEMS_COUNT,
+               set_time * 1e9 / dict_count, destroy_time * 1e9 / dict_count, bytes);
+    }
+    free(dicts);
+    destroy_keys(keys, SMALL_DICT_ITEMS_COUNT);
+}
+
+static void bulk_build_benchmarks(void) {
+    puts("Running bulk build benchmarks:");
+    char **key_sets[2] = { make_numeric_keys(BENCH_ITEMS_COUNT), make_path_keys(BENCH_ITEMS_COUNT) };
+    const char *key_set_names[2] = { "numeric", "path" };
+    int half = BENCH_ITEMS_COUNT / 2;
+    for (int k = 0; k < 2; k++) {
+        const char * const *keys = (const char * const *)key_sets[k];
+        double start = now_seconds();
+        dict_t_ *set_dict = dict_make();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(set_dict, keys[i], (void*)keys[i]);
+        }
+        double set_time = now_seconds() - start;
+        start = now_seconds();
+        dict_t_ *built_dict = dict_build_from_arrays(keys, (void**)keys, BENCH_ITEMS_COUNT);
+        double build_time = now_seconds() - start;
+        start = now_seconds();
+        dict_t_ *parallel_dict = dict_build_from_arrays_parallel(keys, (void**)keys, BENCH_ITEMS_COUNT, 4);
+        double parallel_time = now_seconds() - start;
+        printf("%-7s set: %6.1f ms, build: %6.1f ms, build on 4 threads: %6.1f ms\n",
+               key_set_names[k], set_time * 1e3, build_time * 1e3, parallel_time * 1e3);
+
+        dict_t_ *halves[2] = {
+            dict_build_from_arrays(keys, (void**)keys, half),
+            dict_build_from_arrays(keys + half, (void**)keys + half, BENCH_ITEMS_COUNT - half),
+        };
+        start = now_seconds();
+        for (unsigned int i = 0; i < dict_count(halves[1]); i++) {
+            dict_set(halves[0], dict_get_key_at(halves[1], i), dict_get_value_at(halves[1], i));
+        }
+        double set_merge_time = now_seconds() - start;
+        dict_destroy(halves[0]);
+        halves[0] = dict_build_from_arrays(keys, (void**)keys, half);
+        start = now_seconds();
+        dict_merge(halves[0], halves[1]);
+        double merge_time = now_seconds() - start;
+        printf("%-7s merge of halves with sets: %6.1f ms, dict_merge: %6.1f ms\n",
+               key_set_names[k], set_merge_time * 1e3, merge_time * 1e3);
+        dict_destroy(set_dict);
+        dict_destroy(built_dict);
+        dict_destroy(parallel_dict);
+        dict_destroy(halves[0]);
+        dict_destroy(halves[1]);
+        destroy_keys(key_sets[k], BENCH_ITEMS_COUNT);
+    }
+}
+
+static void pdict_benchmarks(void) {
+    puts("Running pdict benchmarks (snapshot, then update of 1000 keys):");
+    char **keys = make_numeric_keys(BENCH_ITEMS_COUNT);
+    shuffle_keys(keys, BENCH_ITEMS_COUNT);
+    dict_t_ *dict = dict_build_from_arrays((const char * const *)keys, (void**)keys, BENCH_ITEMS_COUNT);
+    double start = now_seconds();
+    dict_t_ *copy = dict_build_from_arrays((const char * const *)keys, (void**)keys, BENCH_ITEMS_COUNT);
+    for (int i = 0; i < 1000; i++) {
+        dict_set(copy, keys[i], NULL);
+    }
+    double copy_time = now_seconds() - start;
+    dict_stats_t stats;
+    dict_get_stats(copy, &stats);
+    size_t copy_bytes = stats.total_bytes;
+
+    pdict_t_ *pdict = pdict_make_from_dict(dict);
+    start = now_seconds();
+    pdict_t_ *snapshot = pdict_snapshot(pdict);
+    double snapshot_time = now_seconds() - start;
+    start = now_seconds();
+    for (int i = 0; i < 1000; i++) {
+        pdict_set(pdict, keys[i], NULL);
+    }
+    double update_time = now_seconds() - start;
+    pdict_destroy(snapshot);
+    pdict_get_stats(pdict, &stats);
+    printf("dict  copy + update: %7.2f ms, %6.1f MB copied\n", copy_time * 1e3, copy_bytes / 1e6);
+    printf("pdict snapshot: %5.3f us, update: %7.2f ms, %6.1f MB shared\n",
+           snapshot_time * 1e6, update_time * 1e3, stats.total_bytes / 1e6);
+
+    start = now_seconds();
+    size_t acc = 0;
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        acc ^= (size_t)dict_get(dict, keys[i]);
+    }
+    double dict_get_time = now_seconds() - start;
+    start = now_seconds();
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        acc ^= (size_t)pdict_get(pdict, keys[i]);
+    }
+    double pdict_get_time = now_seconds() - start;
+    printf("get dict: %5.1f ns/op, pdict: %5.1f ns/op, pdict depth: %u (%zx)\n",
+           dict_get_time * 1e9 / BENCH_ITEMS_COUNT, pdict_get_time * 1e9 / BENCH_ITEMS_COUNT,
+           stats.max_displacement, acc & 0xf);
+    pdict_destroy(pdict);
+    dict_destroy(copy);
+    dict_destroy(dict);
+    destroy_keys(keys, BENCH_ITEMS_COUNT);
+}
+
+static void bloom_benchmarks(void) {
+    puts("Running bloom filter benchmarks (gets of missing keys):");
+    char **keys = make_path_keys(BENCH_ITEMS_COUNT * 2);
+    shuffle_keys(keys, BENCH_ITEMS_COUNT * 2);
+    for (int config = 0; config < 4; config++) {
+        bool bloom = config % 2;
+        bool djb2 = config / 2; // weak hash, long probe chains
+        dict_t_ *dict = dict_make();
+        if (djb2) {
+            dict_set_hash_fn(dict, dict_hash_djb2, 0);
+        }
+        dict_set_bloom_filter(dict, bloom);
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            dict_set(dict, keys[i], keys[i]);
+        }
+        double start = now_seconds();
+        size_t acc = 0;
+        for (int i = BENCH_ITEMS_COUNT; i < BENCH_ITEMS_COUNT * 2; i++) {
+            acc ^= (size_t)dict_get(dict, keys[i]);
+        }
+        double miss_time = now_seconds() - start;
+        start = now_seconds();
+        for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+            acc ^= (size_t)dict_get(dict, keys[i]);
+        }
+        double hit_time = now_seconds() - start;
+        dict_stats_t stats;
+        dict_get_stats(dict, &stats);
+        printf("%-6s %-9s miss: %5.1f ns/op, hit: %5.1f ns/op, filter: %5.1f MB (%zx)\n",
+               djb2 ? "djb2" : "wyhash", bloom ? "bloom" : "no bloom", miss_time * 1e9 / BENCH_ITEMS_COUNT,
+               hit_time * 1e9 / BENCH_ITEMS_COUNT, stats.bloom_bytes / 1e6, acc & 0xf);
+        dict_destroy(dict);
+    }
+    destroy_keys(keys, BENCH_ITEMS_COUNT * 2);
+}
+
+static void cache_benchmarks(void) {
+    puts("Running cache benchmarks (zipfian gets, set on miss, 10% of keys fit):");
+    const double exponents[] = { 0.8, 0.99, 1.2 };
+    char **keys = make_numeric_keys(CACHE_KEYS_COUNT);
+    int *stream = malloc(BENCH_ITEMS_COUNT * sizeof(int));
+    double *cdf = malloc(CACHE_KEYS_COUNT * sizeof(double));
+    for (unsigned int e = 0; e < sizeof(exponents) / sizeof(exponents[0]); e++) {
+        make_zipf_stream(exponents[e], cdf, stream);
+        for (int impl = 0; impl < 2; impl++) {
+            cache_t_ *cache = impl == 0 ? cache_make(CACHE_KEYS_COUNT / 10, 0) : NULL;
+            lru_cache_t lru = { dict_make(), NULL, NULL, CACHE_KEYS_COUNT / 10 };
+            int hits = 0;
+            double start = now_seconds();
+            for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+                char *key = keys[stream[i]];
+                if (impl == 0) {
+                    if (cache_get(cache, key)) {
+                        hits++;
+                    } else {
+                        cache_set(cache, key, key, 0);
+                    }
+                } else {
+                    if (lru_cache_get(&lru, key)) {
+                        hits++;
+                    } else {
+                        lru_cache_set(&lru, key);
+                    }
+                }
+            }
+            double time = now_seconds() - start;
+            printf("zipf %.2f %-19s hit ratio: %5.1f%%, %6.2f Mops/s\n", exponents[e],
+                   impl == 0 ? "cache (clock):" : "dict + list (lru):",
+                   hits * 100.0 / BENCH_ITEMS_COUNT, BENCH_ITEMS_COUNT / time / 1e6);
+            cache_destroy(cache);
+            lru_cache_destroy(&lru);
+        }
+    }
+    free(cdf);
+    free(stream);
+    destroy_keys(keys, CACHE_KEYS_COUNT);
+}
+
+static void array_bulk_benchmarks(void) {
+    puts("Running array bulk benchmarks (appending ints in chunks of 4096):");
+    int *chunk = malloc(ARRAY_BENCH_CHUNK * sizeof(int));
+    for (int i = 0; i < ARRAY_BENCH_CHUNK; i++) {
+        chunk[i] = i;
+    }
+    for (int bulk = 0; bulk < 2; bulk++) {
+        array(int) *arr = array_make(int);
+        double start = now_seconds();
+        for (int c = 0; c < ARRAY_BENCH_ITEMS_COUNT / ARRAY_BENCH_CHUNK; c++) {
+            if (bulk) {
+                array_addn(arr, chunk, ARRAY_BENCH_CHUNK);
+            } else {
+                for (int i = 0; i < ARRAY_BENCH_CHUNK; i++) {
+                    array_add(arr, &chunk[i]);
+                }
+            }
+        }
+        double time = now_seconds() - start;
+        array(int) *copy = array_make(int);
+        start = now_seconds();
+        array_add_array(copy, arr);
+        double copy_time = now_seconds() - start;
+        printf("%-13s %7.1f M items/s, add_array: %6.2f ms\n", bulk ? "array_addn:" : "array_add:",
+               ARRAY_BENCH_ITEMS_COUNT / time / 1e6, copy_time * 1e3);
+        array_destroy(copy);
+        array_destroy(arr);
+    }
+    free(chunk);
+}
+
+static void array_growth_benchmarks(void) {
+    puts("Running array growth benchmarks (appending ints one by one up to 1 GB):");
+    const struct { const char *name; float factor; size_t max_step; bool page_granular; } policies[] = {
+        { "factor 2", 2.0f, 0, false },
+        { "factor 1.5", 1.5f, 0, false },
+        { "max step 64 MB", 2.0f, 64 * 1024 * 1024, false },
+        { "page granular", 2.0f, 64 * 1024 * 1024, true },
+    };
+    for (unsigned int p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        // every policy runs in its own process, so peak RSS is its own
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            array(int) *arr = array_make(int);
+            array_set_growth(arr, policies[p].factor, policies[p].max_step, policies[p].page_granular);
+            size_t count = ARRAY_GROWTH_BENCH_BYTES / sizeof(int);
+            double start = now_seconds();
+            for (size_t i = 0; i < count; i++) {
+                int value = (int)i;
+                array_add(arr, &value);
+            }
+            double time = now_seconds() - start;
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            printf("%-15s %6.1f M items/s, peak RSS: %6.1f MB\n", policies[p].name,
+                   count / time / 1e6, usage.ru_maxrss / 1024.0);
+            array_destroy(arr);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static void allocator_benchmarks(void) {
+    puts("Running allocator benchmarks (request-scoped dict + array + strbuf, 64 items each):");
+    char keys[ALLOCATOR_BENCH_ITEMS_PER_REQUEST][64];
+    for (int i = 0; i < ALLOCATOR_BENCH_ITEMS_PER_REQUEST; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "x-request-header-name-%d", i);
+    }
+    for (int use_arena = 0; use_arena < 2; use_arena++) {
+        collections_arena_t_ *arena = collections_arena_make(0);
+        const collections_allocator_t *allocator = use_arena ? collections_arena_allocator(arena) : NULL;
+        size_t total_length = 0;
+        double start = now_seconds();
+        for (int r = 0; r < ALLOCATOR_BENCH_REQUESTS; r++) {
+            dict(char) *headers = dict_make_with_allocator(0, allocator);
+            array(int) *ids = array_make_with_allocator(0, sizeof(int), allocator);
+            strbuf_t *response = strbuf_make_with_allocator(0, allocator);
+            for (int i = 0; i < ALLOCATOR_BENCH_ITEMS_PER_REQUEST; i++) {
+                dict_set(headers, keys[i], keys[i]);
+                array_add(ids, &i);
+                strbuf_append(response, keys[i]);
+                strbuf_append(response, ": ");
+                strbuf_append(response, dict_get(headers, keys[i]));
+                strbuf_append(response, "\n");
+            }
+            total_length += strlen(strbuf_get_string(response)) + array_count(ids);
+            dict_destroy(headers);
+            array_destroy(ids);
+            strbuf_destroy(response);
+            collections_arena_reset(arena);
+        }
+        double time = now_seconds() - start;
+        printf("%-7s %7.1f K requests/s (%zu bytes written)\n", use_arena ? "arena:" : "malloc:",
+               ALLOCATOR_BENCH_REQUESTS / time / 1e3, total_length);
+        collections_arena_destroy(arena);
+    }
+}
+
+static void smallarray_benchmarks(void) {
+    puts("Running smallarray benchmarks (1M nodes with 0-7 children, built and destroyed):");
+    bench_ptrarray_node_t *ptrarray_nodes = malloc(SMALLARRAY_BENCH_NODES_COUNT * sizeof(bench_ptrarray_node_t));
+    bench_smallarray_node_t *smallarray_nodes = malloc(SMALLARRAY_BENCH_NODES_COUNT * sizeof(bench_smallarray_node_t));
+    for (int impl = 0; impl < 2; impl++) {
+        size_t total_children = 0;
+        double start = now_seconds();
+        for (int r = 0; r < SMALLARRAY_BENCH_ROUNDS; r++) {
+            for (int i = 0; i < SMALLARRAY_BENCH_NODES_COUNT; i++) {
+                int children_count = (i * 7 + r) % 8;
+                if (impl == 0) {
+                    bench_ptrarray_node_t *node = &ptrarray_nodes[i];
+                    node->kind = i;
+                    node->children = ptrarray_make();
+                    for (int c = 0; c < children_count; c++) {
+                        ptrarray_add(node->children, &ptrarray_nodes[(i + c) % SMALLARRAY_BENCH_NODES_COUNT]);
+                    }
+                } else {
+                    bench_smallarray_node_t *node = &smallarray_nodes[i];
+                    node->kind = i;
+                    smallarray_init(&node->children);
+                    for (int c = 0; c < children_count; c++) {
+                        void *child = &smallarray_nodes[(i + c) % SMALLARRAY_BENCH_NODES_COUNT];
+                        smallarray_add(&node->children.base, &child);
+                    }
+                }
+            }
+            for (int i = 0; i < SMALLARRAY_BENCH_NODES_COUNT; i++) {
+                if (impl == 0) {
+                    total_children += ptrarray_count(ptrarray_nodes[i].children);
+                    ptrarray_destroy(ptrarray_nodes[i].children);
+                } else {
+                    total_children += smallarray_count(&smallarray_nodes[i].children.base);
+                    smallarray_deinit(&smallarray_nodes[i].children.base);
+                }
+            }
+        }
+        double time = now_seconds() - start;
+        printf("%-11s %7.1f M nodes/s (%zu children)\n", impl == 0 ? "ptrarray:" : "smallarray:",
+               (double)SMALLARRAY_BENCH_NODES_COUNT * SMALLARRAY_BENCH_ROUNDS / time / 1e6, total_children);
+    }
+    free(ptrarray_nodes);
+    free(smallarray_nodes);
+}
+
+static void make_zipf_stream(double exponent, double *cdf, int *out_stream) {
+    double sum = 0;
+    for (int i = 0; i < CACHE_KEYS_COUNT; i++) {
+        sum += 1.0 / pow(i + 1, exponent);
+        cdf[i] = sum;
+    }
+    unsigned long long x = 88172645463325252ull;
+    for (int i = 0; i < BENCH_ITEMS_COUNT; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        double target = (double)(x >> 11) / (double)(1ull << 53) * sum;
+        int lo = 0;
+        int hi = CACHE_KEYS_COUNT - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        out_stream[i] = (int)((unsigned long long)lo * 2654435761ull % CACHE_KEYS_COUNT); // hot keys aren't neighbors
+    }
+}
+
+static void *lru_cache_get(lru_cache_t *lru, const char *key) {
+    lru_node_t *node = dict_get(lru->dict, key);
+    if (node == NULL) {
+        return NULL;
+    }
+    lru_cache_unlink(lru, node);
+    lru_cache_push_front(lru, node);
+    return node->value;
+}
+
+static void lru_cache_set(lru_cache_t *lru, const char *key) {
+    if (dict_count(lru->dict) >= lru->max_count) {
+        lru_node_t *tail = lru->tail;
+        lru_cache_unlink(lru, tail);
+        dict_remove(lru->dict, tail->key);
+        free(tail);
+    }
+    lru_node_t *node = malloc(sizeof(lru_node_t));
+    node->key = key;
+    node->value = (void*)key;
+    lru_cache_push_front(lru, node);
+    dict_set(lru->dict, key, node);
+}
+
+static void lru_cache_unlink(lru_cache_t *lru, lru_node_t *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        lru->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        lru->tail = node->prev;
+    }
+}
+
+static void lru_cache_push_front(lru_cache_t *lru, lru_node_t *node) {
+    node->prev = NULL;
+    node->next = lru->head;
+    if (lru->head) {
+        lru->head->prev = node;
+    } else {
+        lru->tail = node;
+    }
+    lru->head = node;
+}
+
+static void lru_cache_destroy(lru_cache_t *lru) {
+    lru_node_t *node = lru->head;
+    while (node) {
+        lru_node_t *next = node->next;
+        free(node);
+        node = next;
+    }
+    dict_destroy(lru->dict);
+}
+
+static char** make_numeric_keys(int count) {
+    char **keys = malloc(count * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+static char** make_path_keys(int count) {
+    char **keys = malloc(count * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "/usr/local/share/projects/module_%d/src/components/file_%d.c", i % 97, i);
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+static void destroy_keys(char **keys, int count) {
+    for (int i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+static void shuffle_keys(char **keys, int count) {
+    unsigned long long x = 88172645463325252ull;
+    for (int i = count - 1; i > 0; i--) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int j = (int)(x % (i + 1));
+        char *tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+static void bench_hash(const bench_hash_t *hash, const char *keys_name, char **keys, int count) {
+    size_t *lens = malloc(count * sizeof(size_t));
+    size_t total_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        lens[i] = strlen(keys[i]);
+        total_bytes += lens[i];
+    }
+
+    unsigned long seed = dict_hash_default_seed();
+    unsigned long acc = 0;
+    double start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        acc ^= hash->fn(keys[i], lens[i], seed);
+    }
+    double hash_time = now_seconds() - start;
+
+    // linear probing at the dict's 0.7 max load factor
+    unsigned int cell_capacity = 1;
+    while (cell_capacity * 0.7 < count) {
+        cell_capacity *= 2;
+    }
+    unsigned int mask = cell_capacity - 1;
+    unsigned char *cells = calloc(cell_capacity, 1);
+    unsigned long long total_probes = 0;
+    unsigned int max_probes = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned long h = hash->fn(keys[i], lens[i], seed);
+        unsigned int probes = 1;
+        unsigned int ix = h & mask;
+        while (cells[ix]) {
+            ix = (ix + 1) & mask;
+            probes++;
+        }
+        cells[ix] = 1;
+        total_probes += probes;
+        max_probes = probes > max_probes ? probes : max_probes;
+    }
+    free(cells);
+
+    dict_t_ *dict = dict_make();
+    dict_set_hash_fn(dict, hash->fn, seed);
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        dict_set(dict, keys[i], keys[i]);
+    }
+    double set_time = now_seconds() - start;
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        acc ^= (unsigned long)(size_t)dict_get(dict, keys[i]);
+    }
+    double get_time = now_seconds() - start;
+    dict_destroy(dict);
+
+    printf("%-8s %-8s hash: %7.1f MB/s, probes avg: %5.2f max: %5u, dict set: %6.1f ns/op, get: %6.1f ns/op (%lx)\n",
+           hash->name, keys_name,
+           total_bytes / hash_time / (1024 * 1024),
+           (double)total_probes / count, max_probes,
+           set_time * 1e9 / count, get_time * 1e9 / count, acc & 0xf);
+    free(lens);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -22,21 +22,91 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 
 #include "../collections.h"
 
 #define TEST_ITEMS_COUNT (1024 * 1024)
 
+// same as the thread wrappers in collections.c, which aren't exported
+#if defined(_WIN32)
+#include <windows.h>
+typedef HANDLE test_thread_t;
+typedef DWORD test_thread_result_t;
+#define TEST_THREAD_CALL WINAPI
+#define test_thread_start(thread, fn, arg) ((*(thread) = CreateThread(NULL, 0, fn, arg, 0, NULL)) != NULL)
+#define test_thread_join(thread) (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+#else
+#include <pthread.h>
+typedef pthread_t test_thread_t;
+typedef void *test_thread_result_t;
+#define TEST_THREAD_CALL
+#define test_thread_start(thread, fn, arg) (pthread_create(thread, NULL, fn, arg) == 0)
+#define test_thread_join(thread) pthread_join(thread, NULL)
+#endif
+
 static void dict_tests(void);
+static void dict_incremental_rehash_tests(void);
+static void dict_key_arena_tests(void);
+static void dict_inline_key_tests(void);
+static unsigned long dict_inline_key_test_hash(const char *key, size_t len, unsigned long seed);
+static void dict_key_handle_tests(void);
+static void dict_capacity_tests(void);
+static void dict_stats_tests(void);
+static void dict_compact_tests(void);
+static void dict_bulk_tests(void);
+static void dict_bloom_tests(void);
 static void ptrdict_tests(void);
+static void ptrdict_incremental_rehash_tests(void);
+static void ptrdict_capacity_tests(void);
+static void valdict_tests(void);
+static void strset_tests(void);
+static void ptrset_tests(void);
+static void cdict_tests(void);
+static void frozendict_tests(void);
+static void dict_snapshot_tests(void);
+static void pdict_tests(void);
+static void cache_tests(void);
+static void cache_test_count_evicted(const char *key, void *value, void *ctx);
 static void array_tests(void);
+static void array_bulk_tests(void);
 static void ptrarray_tests(void);
+static void smallarray_tests(void);
+static void allocator_tests(void);
+static void *counting_alloc(void *ctx, size_t size);
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void counting_free(void *ctx, void *ptr);
 
 void collections_tests() {
     dict_tests();
+    dict_incremental_rehash_tests();
+    dict_key_arena_tests();
+    dict_inline_key_tests();
+    dict_key_handle_tests();
+    dict_capacity_tests();
+    dict_stats_tests();
+    dict_compact_tests();
+    dict_bulk_tests();
+    dict_bloom_tests();
     ptrdict_tests();
+    ptrdict_incremental_rehash_tests();
+    ptrdict_capacity_tests();
+    valdict_tests();
+    strset_tests();
+    ptrset_tests();
+    cdict_tests();
+    frozendict_tests();
+    dict_snapshot_tests();
+    pdict_tests();
+    cache_tests();
     array_tests();
+    array_bulk_tests();
     ptrarray_tests();
+    smallarray_tests();
+    allocator_tests();
 }
 
 static void dict_tests() {
@@ -55,9 +125,508 @@ static void dict_tests() {
         char *val = dict_get(dict, key);
         assert(strcmp(key, val) == 0);
     }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        free(dict_get(dict, buf));
+        succeeded = dict_remove(dict, buf);
+        assert(succeeded);
+    }
+    assert(dict_count(dict) == TEST_ITEMS_COUNT / 2);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        char *val = dict_get(dict, buf);
+        if (i % 2 == 0) {
+            assert(val == NULL);
+        } else {
+            assert(val && strcmp(buf, val) == 0);
+        }
+    }
+    dict_set_hash_fn(dict, dict_hash_djb2, 0);
+    for (int i = 1; i < TEST_ITEMS_COUNT; i += 2) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        char *val = dict_get(dict, buf);
+        assert(val && strcmp(buf, val) == 0);
+    }
+    static char key_bufs[100][16];
+    const char *batch_keys[100];
+    void *batch_values[100];
+    for (int i = 0; i < 100; i++) {
+        snprintf(key_bufs[i], sizeof(key_bufs[i]), "%d", i);
+        batch_keys[i] = key_bufs[i];
+    }
+    assert(dict_get_many(dict, batch_keys, 100, batch_values) == 50);
+    for (int i = 0; i < 100; i++) {
+        assert(batch_values[i] == dict_get(dict, batch_keys[i]));
+    }
     puts("dict tests: ok");
 }
 
+static void dict_incremental_rehash_tests(void) {
+    puts("Running dict incremental rehash tests:");
+    dict(int) *dict = dict_make();
+    dict_set_incremental_rehash(dict, true);
+    static int values[TEST_ITEMS_COUNT];
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        bool succeeded = dict_set(dict, buf, &values[i]);
+        assert(succeeded);
+        if (i % 3 == 0) {
+            // removes items that may still be in the table being migrated from
+            snprintf(buf, sizeof(buf), "%d", i / 2);
+            dict_remove(dict, buf);
+        }
+        snprintf(buf, sizeof(buf), "%d", i / 3);
+        int *val = dict_get(dict, buf);
+        assert(val == NULL || *val == i / 3);
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        int *val = dict_get(dict, buf);
+        bool removed = (2 * i) % 3 == 0 && 2 * i < TEST_ITEMS_COUNT;
+        removed = removed || ((2 * i + 1) % 3 == 0 && 2 * i + 1 < TEST_ITEMS_COUNT);
+        assert(removed ? val == NULL : (val && *val == i));
+    }
+    for (unsigned int i = 0; i < dict_count(dict); i++) {
+        const char *key = dict_get_key_at(dict, i);
+        assert(*(int*)dict_get(dict, key) == atoi(key));
+    }
+    dict_destroy(dict);
+    puts("dict incremental rehash tests: ok");
+}
+
+static void dict_key_arena_tests(void) {
+    puts("Running dict key arena tests:");
+    dict(int) *dict = dict_make();
+    dict_set(dict, "strdup'd before arena", NULL);
+    dict_set(dict, "short", NULL);
+    bool succeeded = dict_set_key_arena(dict, true);
+    assert(succeeded);
+    static int values[TEST_ITEMS_COUNT];
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "arena_test_key_%d", i);
+        values[i] = i;
+        succeeded = dict_set(dict, buf, &values[i]);
+        assert(succeeded);
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "arena_test_key_%d", i);
+        if (i % 4 != 0) {
+            succeeded = dict_remove(dict, buf);
+            assert(succeeded);
+        }
+    }
+    // removing 3/4 of keys triggers compaction at least once
+    assert(dict_key_arena_waste(dict) < TEST_ITEMS_COUNT * 4);
+    assert(dict_get(dict, "strdup'd before arena") == NULL);
+    assert(dict_count(dict) == TEST_ITEMS_COUNT / 4 + 2);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i += 4) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "arena_test_key_%d", i);
+        int *val = dict_get(dict, buf);
+        assert(val && *val == i);
+    }
+    succeeded = dict_set_key_arena(dict, false);
+    assert(succeeded);
+    assert(*(int*)dict_get(dict, "arena_test_key_4") == 4);
+    assert(dict_get(dict, "short") == NULL && dict_count(dict) == TEST_ITEMS_COUNT / 4 + 2);
+    dict_clear(dict);
+    assert(dict_count(dict) == 0);
+    dict_destroy(dict);
+    puts("dict key arena tests: ok");
+}
+
+static void dict_inline_key_tests(void) {
+    puts("Running dict inline key tests:");
+    bool succeeded = false;
+    // keys around the inline size limit, long ones sharing prefixes
+    const char *keys[] = {
+        "", "a", "fifteen_chars__", "sixteen_chars___", "sixteen_chars__x",
+        "sixteen_chars___ and then some", "sixteen_chars___ and then more",
+    };
+    int key_count = sizeof(keys) / sizeof(keys[0]);
+    static int values[8];
+    dict(int) *dict = dict_make();
+    for (int i = 0; i < key_count; i++) {
+        values[i] = i;
+        succeeded = dict_set(dict, keys[i], &values[i]);
+        assert(succeeded);
+    }
+    for (int i = 0; i < key_count; i++) {
+        assert(dict_get(dict, keys[i]) == &values[i]);
+        assert(strcmp(dict_get_key_at(dict, i), keys[i]) == 0);
+    }
+    assert(dict_get(dict, "fifteen_chars_") == NULL);
+    assert(dict_get(dict, "sixteen_chars____") == NULL);
+    assert(dict_get(dict, "sixteen_chars___ and then") == NULL);
+    assert(dict_getn(dict, "sixteen_chars___ and then some", 16) == &values[3]);
+    assert(dict_getn(dict, "fifteen_chars___", 15) == &values[2]);
+
+    dict_stats_t stats;
+    dict_get_stats(dict, &stats);
+    assert(stats.key_data_bytes == strlen(keys[3]) + strlen(keys[4]) + strlen(keys[5]) + strlen(keys[6]) + 4);
+
+    succeeded = dict_remove(dict, keys[0]) && dict_remove(dict, keys[5]);
+    assert(succeeded);
+    assert(dict_get(dict, keys[0]) == NULL && dict_get(dict, keys[5]) == NULL);
+    assert(dict_get(dict, keys[6]) == &values[6] && dict_get(dict, keys[1]) == &values[1]);
+    succeeded = dict_set_key_arena(dict, true);
+    assert(succeeded);
+    assert(dict_get(dict, keys[6]) == &values[6] && dict_get(dict, keys[2]) == &values[2]);
+    dict_destroy(dict);
+
+    // out of line slots start with pointer bytes, short keys must never match them,
+    // a constant hash makes every lookup compare against every key
+    for (int arena = 0; arena < 2; arena++) {
+        dict = dict_make();
+        dict_set_hash_fn(dict, dict_inline_key_test_hash, 0);
+        succeeded = dict_set_key_arena(dict, arena);
+        assert(succeeded);
+        for (int i = 0; i < 200; i++) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "long_key_only_dict_%d", i);
+            succeeded = dict_set(dict, buf, &values[0]);
+            assert(succeeded);
+        }
+        assert(dict_get(dict, "") == NULL && dict_get(dict, "a") == NULL && dict_getn(dict, "ab", 2) == NULL);
+        succeeded = dict_remove(dict, "");
+        assert(succeeded == false && dict_count(dict) == 200);
+        dict_destroy(dict);
+    }
+    puts("dict inline key tests: ok");
+}
+
+static unsigned long dict_inline_key_test_hash(const char *key, size_t len, unsigned long seed) {
+    (void)key;
+    (void)len;
+    (void)seed;
+    return 42;
+}
+
+static void dict_key_handle_tests(void) {
+    puts("Running dict key handle tests:");
+    bool succeeded = false;
+    dict(int) *a = dict_make();
+    dict(int) *b = dict_make();
+    dict(int) *c = dict_make();
+    dict_set_hash_fn(c, dict_hash_djb2, 7);
+    static int values[3] = {0, 1, 2};
+    const char *src = "alpha beta gamma";
+    // keys point into src without being copied out or NUL terminated
+    dict_key_t alpha = dict_key_make(NULL, src, 5);
+    dict_key_t beta = dict_key_make(a, src + 6, 4);
+    succeeded = dict_set_with_key(a, &alpha, &values[0]);
+    assert(succeeded);
+    succeeded = dict_set_with_key(b, &alpha, &values[0]);
+    assert(succeeded);
+    succeeded = dict_set_with_key(c, &alpha, &values[0]); // rehashed with djb2
+    assert(succeeded);
+    succeeded = dict_setn(a, src + 6, 4, &values[1]);
+    assert(succeeded);
+    succeeded = dict_setn(a, src + 11, 5, &values[2]);
+    assert(succeeded);
+    assert(dict_count(a) == 3);
+    assert(strcmp(dict_get_key_at(a, 1), "beta") == 0);
+    assert(dict_get(a, "alpha") == &values[0]);
+    assert(dict_get(c, "alpha") == &values[0]);
+    assert(dict_get_with_key(a, &beta) == &values[1]);
+    assert(dict_get_with_key(b, &beta) == NULL);
+    assert(dict_getn(a, src, 3) == NULL); // prefix of a stored key
+    assert(dict_getn(a, "gamma ray", 5) == &values[2]);
+    succeeded = dict_removen(a, "beta blocker", 4);
+    assert(succeeded);
+    succeeded = dict_remove_with_key(c, &alpha);
+    assert(succeeded);
+    assert(dict_get_with_key(a, &beta) == NULL);
+    assert(dict_count(a) == 2 && dict_count(c) == 0);
+    dict_destroy(a);
+    dict_destroy(b);
+    dict_destroy(c);
+    puts("dict key handle tests: ok");
+}
+
+static void dict_capacity_tests(void) {
+    puts("Running dict capacity tests:");
+    bool succeeded = false;
+    static int values[TEST_ITEMS_COUNT];
+    dict(int) *dict = dict_make_with_capacity(1000);
+    succeeded = dict_set_max_load_factor(dict, 0.0f);
+    assert(succeeded == false);
+    succeeded = dict_set_max_load_factor(dict, 1.0f);
+    assert(succeeded == false);
+    for (int i = 0; i < 1000; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        succeeded = dict_set(dict, buf, &values[i]);
+        assert(succeeded);
+    }
+    succeeded = dict_reserve(dict, TEST_ITEMS_COUNT);
+    assert(succeeded);
+    succeeded = dict_set_max_load_factor(dict, 0.9f);
+    assert(succeeded);
+    for (int i = 1000; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        succeeded = dict_set(dict, buf, &values[i]);
+        assert(succeeded);
+    }
+    for (int i = 100; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        succeeded = dict_remove(dict, buf);
+        assert(succeeded);
+    }
+    succeeded = dict_set_max_load_factor(dict, 0.3f);
+    assert(succeeded);
+    succeeded = dict_shrink_to_fit(dict);
+    assert(succeeded);
+    assert(dict_count(dict) == 100);
+    for (int i = 0; i < 200; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        int *val = dict_get(dict, buf);
+        assert(i < 100 ? (val && *val == i) : val == NULL);
+    }
+    dict_destroy(dict);
+    puts("dict capacity tests: ok");
+}
+
+static void dict_stats_tests(void) {
+    puts("Running dict stats tests:");
+    static int values[1000];
+    dict(int) *dict = dict_make();
+    ptrdict(int, int) *ptrdict = ptrdict_make();
+    for (int i = 0; i < 1000; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        dict_set(dict, buf, &values[i]);
+        ptrdict_set(ptrdict, &values[i], &values[i]);
+    }
+    dict_get(dict, "0");
+    dict_get(dict, "missing");
+    ptrdict_get(ptrdict, &values[1]);
+
+    dict_stats_t stats;
+    dict_get_stats(dict, &stats);
+    assert(stats.count == 1000);
+    assert(stats.cell_capacity == 2048 && stats.load_factor > 0.48f && stats.load_factor < 0.49f);
+    assert(stats.rehash_count == 7); // 16 -> 2048
+    unsigned int histogram_total = 0;
+    for (int i = 0; i < DICT_STATS_HISTOGRAM_SIZE; i++) {
+        histogram_total += stats.displacement_histogram[i];
+    }
+    assert(histogram_total == 1000);
+    assert(stats.avg_displacement <= stats.max_displacement);
+    assert(stats.cells_bytes == 2048 * sizeof(collections_size_t));
+    assert(stats.key_data_bytes == 0); // short keys are stored inline
+    assert(stats.total_bytes > stats.cells_bytes + stats.ctrl_bytes + stats.keys_bytes);
+#ifdef COLLECTIONS_DICT_COUNTERS
+    assert(stats.hits == 1 && stats.misses == 1);
+#endif
+
+    ptrdict_get_stats(ptrdict, &stats);
+    assert(stats.count == 1000 && stats.rehash_count == 7);
+    assert(stats.ctrl_bytes == 0 && stats.key_data_bytes == 0);
+#ifdef COLLECTIONS_DICT_COUNTERS
+    assert(stats.hits == 1 && stats.misses == 0);
+#endif
+    dict_destroy(dict);
+    ptrdict_destroy(ptrdict);
+    puts("dict stats tests: ok");
+}
+
+static void dict_compact_tests(void) {
+    puts("Running dict compact tests:");
+    bool succeeded = false;
+    char keys[1000][32];
+    dict(char) *dict = dict_make_compact(0);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(keys[i], i % 2 ? "%d" : "compact_test_long_key_%d", i);
+        succeeded = dict_set(dict, keys[i], keys[i]);
+        assert(succeeded);
+    }
+    assert(dict_count(dict) == 1000);
+    for (int i = 0; i < 1000; i++) {
+        assert(dict_get(dict, keys[i]) == keys[i]);
+    }
+    dict_stats_t stats;
+    dict_get_stats(dict, &stats);
+    assert(stats.hashes_bytes == stats.item_capacity * 4); // 32 bit hashes
+    assert(stats.rehash_count > 0);
+
+    for (int i = 0; i < 1000; i += 3) {
+        succeeded = dict_remove(dict, keys[i]);
+        assert(succeeded);
+    }
+    for (int i = 0; i < 1000; i++) {
+        assert(dict_get(dict, keys[i]) == (i % 3 ? keys[i] : NULL));
+    }
+    dict_key_t key = dict_key_make(NULL, keys[1], strlen(keys[1]));
+    assert(dict_get_with_key(dict, &key) == keys[1]);
+
+    dict_set_incremental_rehash(dict, true); // ignored
+    succeeded = dict_shrink_to_fit(dict);
+    assert(succeeded);
+    dict_set_hash_fn(dict, dict_hash_djb2, 7);
+    succeeded = dict_set_max_load_factor(dict, 0.5f);
+    assert(succeeded);
+    for (int i = 0; i < 1000; i++) {
+        assert(dict_get(dict, keys[i]) == (i % 3 ? keys[i] : NULL));
+    }
+    frozendict(char) *frozen = frozendict_make(dict);
+    assert(frozendict_get(frozen, keys[2]) == keys[2] && frozendict_get(frozen, keys[3]) == NULL);
+    frozendict_destroy(frozen);
+    dict_clear(dict);
+    assert(dict_count(dict) == 0 && dict_get(dict, keys[1]) == NULL);
+    dict_destroy(dict);
+
+    // never grows, stays in the allocation of the dict
+    dict = dict_make_compact(8);
+    for (int i = 0; i < 8; i++) {
+        succeeded = dict_set(dict, keys[i], keys[i]);
+        assert(succeeded);
+    }
+    dict_get_stats(dict, &stats);
+    assert(stats.rehash_count == 0);
+    succeeded = dict_remove(dict, keys[0]);
+    assert(succeeded && dict_get(dict, keys[7]) == keys[7]);
+    dict_destroy(dict);
+    puts("dict compact tests: ok");
+}
+
+static void dict_bulk_tests(void) {
+    puts("Running dict bulk tests:");
+    bool succeeded = false;
+    static char keys[20000][32];
+    static const char *key_ptrs[20000];
+    for (int i = 0; i < 20000; i++) {
+        sprintf(keys[i], i % 2 ? "%d" : "bulk_test_long_key_%d", i % 10000); // every key twice
+        key_ptrs[i] = keys[i];
+    }
+    dict(char) *dicts[2] = {
+        dict_build_from_arrays(key_ptrs, (void**)key_ptrs, 20000),
+        dict_build_from_arrays_parallel(key_ptrs, (void**)key_ptrs, 20000, 4),
+    };
+    for (int d = 0; d < 2; d++) {
+        assert(dicts[d] && dict_count(dicts[d]) == 10000);
+        for (int i = 0; i < 20000; i++) {
+            assert(dict_get(dicts[d], keys[i]) == (i < 10000 ? keys[i + 10000] : keys[i]));
+        }
+        dict_stats_t stats;
+        dict_get_stats(dicts[d], &stats);
+        assert(stats.rehash_count == 0);
+    }
+    dict_destroy(dicts[1]);
+    dict(char) *no_threads = dict_build_from_arrays_parallel(key_ptrs, (void**)key_ptrs, 2, 0);
+    assert(no_threads && dict_count(no_threads) == 2);
+    assert(dict_get(no_threads, keys[0]) == keys[0] && dict_get(no_threads, keys[1]) == keys[1]);
+    dict_destroy(no_threads);
+    dict_t_ *empty = dict_build_from_arrays(NULL, NULL, 0);
+    assert(empty && dict_count(empty) == 0);
+
+    // overlapping halves, with and without hashes of dest
+    dict(char) *dest = dict_make();
+    dict(char) *other_hash = dict_make();
+    dict_set_hash_fn(other_hash, dict_hash_djb2, 0);
+    dict(char) *compact = dict_make_compact(0);
+    for (int i = 0; i < 15000; i++) {
+        dict_set(i < 5000 ? dest : (i < 10000 ? other_hash : compact), keys[i], "x");
+    }
+    succeeded = dict_merge(dest, dicts[0]);
+    assert(succeeded && dict_count(dest) == 10000);
+    succeeded = dict_merge(dest, empty);
+    assert(succeeded && dict_count(dest) == 10000);
+    succeeded = dict_merge(other_hash, dest);
+    assert(succeeded && dict_count(other_hash) == 10000);
+    succeeded = dict_merge(compact, dest);
+    assert(succeeded && dict_count(compact) == 10000);
+    succeeded = dict_merge(empty, compact);
+    assert(succeeded && dict_count(empty) == 10000);
+    for (int i = 10000; i < 20000; i++) {
+        assert(dict_get(dest, keys[i]) == keys[i]);
+        assert(dict_get(other_hash, keys[i]) == keys[i]);
+        assert(dict_get(compact, keys[i]) == keys[i]);
+        assert(dict_get(empty, keys[i]) == keys[i]);
+    }
+    dict_destroy(dicts[0]);
+    dict_destroy(empty);
+    dict_destroy(dest);
+    dict_destroy(other_hash);
+    dict_destroy(compact);
+    puts("dict bulk tests: ok");
+}
+
+static void dict_bloom_tests(void) {
+    puts("Running dict bloom tests:");
+    bool succeeded = false;
+    static char keys[20000][32];
+    for (int i = 0; i < 20000; i++) {
+        sprintf(keys[i], "bloom_%d", i);
+    }
+    bloom_t_ *bloom = bloom_make(10000, 0);
+    for (int i = 0; i < 10000; i++) {
+        bloom_add(bloom, keys[i]);
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 20000; i++) {
+        bool maybe = bloom_may_contain(bloom, keys[i]);
+        assert(i >= 10000 || maybe);
+        false_positives += i >= 10000 && maybe;
+    }
+    assert(bloom_count(bloom) == 10000 && false_positives < 100);
+    bloom_clear(bloom);
+    assert(bloom_count(bloom) == 0 && bloom_may_contain(bloom, keys[0]) == false);
+    bloom_destroy(bloom);
+
+    for (int compact = 0; compact < 2; compact++) {
+        dict(char) *dict = compact ? dict_make_compact(16) : dict_make();
+        succeeded = dict_set(dict, keys[0], keys[0]);
+        assert(succeeded);
+        succeeded = dict_set_bloom_filter(dict, true); // enabling on a non empty dict
+        assert(succeeded);
+        for (int i = 0; i < 10000; i++) {
+            succeeded = dict_set(dict, keys[i], keys[i]); // grows filter with the table
+            assert(succeeded);
+        }
+        for (int i = 0; i < 20000; i++) {
+            assert(dict_get(dict, keys[i]) == (i < 10000 ? keys[i] : NULL));
+        }
+        for (int i = 0; i < 10000; i += 2) {
+            succeeded = dict_remove(dict, keys[i]); // rebuilds once removes outnumber items
+            assert(succeeded);
+        }
+        for (int i = 0; i < 20000; i++) {
+            assert(dict_get(dict, keys[i]) == (i < 10000 && i % 2 ? keys[i] : NULL));
+        }
+        dict_stats_t stats;
+        dict_get_stats(dict, &stats);
+        assert(stats.bloom_bytes > 0);
+        dict_set_hash_fn(dict, dict_hash_djb2, 0);
+        for (int i = 1; i < 10000; i += 2) {
+            assert(dict_get(dict, keys[i]) == keys[i]);
+        }
+        dict_clear(dict);
+        assert(dict_get(dict, keys[1]) == NULL);
+        succeeded = dict_set(dict, keys[1], keys[1]);
+        assert(succeeded && dict_get(dict, keys[1]) == keys[1]);
+        succeeded = dict_set_bloom_filter(dict, false);
+        assert(succeeded);
+        dict_get_stats(dict, &stats);
+        assert(stats.bloom_bytes == 0 && dict_get(dict, keys[1]) == keys[1]);
+        dict_destroy(dict);
+    }
+    puts("dict bloom tests: ok");
+}
+
 static void ptrdict_tests(void) {
     puts("Running ptrdict tests:");
     bool succeeded = false;
@@ -77,9 +646,649 @@ static void ptrdict_tests(void) {
         int val_int = atoi(val);
         assert(*key == val_int);
     }
+    void *batch_keys[1001];
+    void *batch_values[1001];
+    for (int i = 0; i < 1000; i++) {
+        batch_keys[i] = ptrdict_get_key_at(dict, i * 7);
+    }
+    batch_keys[1000] = &succeeded;
+    assert(ptrdict_get_many(dict, batch_keys, 1001, batch_values) == 1000);
+    for (int i = 0; i < 1000; i++) {
+        assert(batch_values[i] == ptrdict_get_value_at(dict, i * 7));
+    }
+    assert(batch_values[1000] == NULL);
     puts("ptrdict tests: ok");
 }
 
+static void ptrdict_incremental_rehash_tests(void) {
+    puts("Running ptrdict incremental rehash tests:");
+    ptrdict(int, int) *dict = ptrdict_make();
+    ptrdict_set_incremental_rehash(dict, true);
+    static int keys[TEST_ITEMS_COUNT];
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        keys[i] = i;
+        bool succeeded = ptrdict_set(dict, &keys[i], &keys[i]);
+        assert(succeeded);
+        if (i % 2 == 0) {
+            ptrdict_remove(dict, &keys[i / 2]);
+        }
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        int *val = ptrdict_get(dict, &keys[i]);
+        bool removed = i < TEST_ITEMS_COUNT / 2;
+        assert(removed ? val == NULL : val == &keys[i]);
+    }
+    assert(ptrdict_count(dict) == TEST_ITEMS_COUNT / 2);
+    ptrdict_destroy(dict);
+    puts("ptrdict incremental rehash tests: ok");
+}
+
+static void ptrdict_capacity_tests(void) {
+    puts("Running ptrdict capacity tests:");
+    bool succeeded = false;
+    static int keys[TEST_ITEMS_COUNT];
+    ptrdict(int, int) *dict = ptrdict_make_with_capacity(TEST_ITEMS_COUNT);
+    succeeded = ptrdict_set_max_load_factor(dict, 0.5f);
+    assert(succeeded);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        succeeded = ptrdict_set(dict, &keys[i], &keys[i]);
+        assert(succeeded);
+    }
+    for (int i = 10; i < TEST_ITEMS_COUNT; i++) {
+        succeeded = ptrdict_remove(dict, &keys[i]);
+        assert(succeeded);
+    }
+    succeeded = ptrdict_shrink_to_fit(dict);
+    assert(succeeded);
+    succeeded = ptrdict_reserve(dict, 5000);
+    assert(succeeded);
+    assert(ptrdict_count(dict) == 10);
+    for (int i = 0; i < 20; i++) {
+        void *val = ptrdict_get(dict, &keys[i]);
+        assert(i < 10 ? val == &keys[i] : val == NULL);
+    }
+    ptrdict_destroy(dict);
+    puts("ptrdict capacity tests: ok");
+}
+
+#define CDICT_TEST_THREADS 4
+#define CDICT_TEST_ITEMS_PER_THREAD 50000
+
+typedef struct {
+    cdict(int) *dict;
+    int thread_ix;
+} cdict_test_thread_t;
+
+static test_thread_result_t TEST_THREAD_CALL cdict_test_thread(void *arg) {
+    cdict_test_thread_t *thread = arg;
+    static int values[CDICT_TEST_THREADS * CDICT_TEST_ITEMS_PER_THREAD];
+    int first = thread->thread_ix * CDICT_TEST_ITEMS_PER_THREAD;
+    for (int i = first; i < first + CDICT_TEST_ITEMS_PER_THREAD; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        bool succeeded = cdict_set(thread->dict, buf, &values[i]);
+        assert(succeeded);
+        // read back keys written by every thread so far, including other threads
+        snprintf(buf, sizeof(buf), "%d", i % (first + 1));
+        int *val = cdict_get(thread->dict, buf);
+        assert(val == NULL || *val == i % (first + 1));
+    }
+    for (int i = first; i < first + CDICT_TEST_ITEMS_PER_THREAD; i += 2) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        bool succeeded = cdict_remove(thread->dict, buf);
+        assert(succeeded);
+    }
+    return 0;
+}
+
+typedef struct {
+    int id;
+    double score;
+    char name[12];
+} valdict_test_record_t;
+
+static void valdict_tests(void) {
+    puts("Running valdict tests:");
+    valdict(valdict_test_record_t) *dict = valdict_make(valdict_test_record_t);
+    assert(valdict_value_size(dict) == sizeof(valdict_test_record_t));
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        valdict_test_record_t record = { .id = i, .score = i * 0.5 };
+        snprintf(record.name, sizeof(record.name), "n%d", i);
+        bool succeeded = valdict_set(dict, buf, &record);
+        assert(succeeded);
+    }
+    assert(valdict_count(dict) == TEST_ITEMS_COUNT);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        bool succeeded = valdict_remove(dict, buf);
+        assert(succeeded);
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        valdict_test_record_t *record = valdict_get(dict, buf);
+        if (i % 2 == 0) {
+            assert(record == NULL);
+            continue;
+        }
+        char name[12];
+        snprintf(name, sizeof(name), "n%d", i);
+        assert(record && record->id == i && record->score == i * 0.5 && strcmp(record->name, name) == 0);
+    }
+    for (unsigned int i = 0; i < valdict_count(dict); i++) {
+        const valdict_test_record_t *record = valdict_get_value_at(dict, i);
+        assert(record->id == atoi(valdict_get_key_at(dict, i)));
+    }
+    valdict_test_record_t *record = valdict_get(dict, "1");
+    record->score = 42;
+    assert(((valdict_test_record_t*)valdict_get(dict, "1"))->score == 42);
+    valdict_set(dict, "1", NULL);
+    assert(((valdict_test_record_t*)valdict_get(dict, "1"))->id == 0);
+    valdict_destroy(dict);
+
+    valdict(int) *counters = valdict_make(int);
+    const char *words[] = { "a", "b", "a", "c", "a", "b" };
+    for (int i = 0; i < 6; i++) {
+        int *counter = valdict_get_or_add(counters, words[i]);
+        (*counter)++;
+    }
+    assert(valdict_count(counters) == 3);
+    assert(*(int*)valdict_get(counters, "a") == 3 && *(int*)valdict_get(counters, "b") == 2);
+    assert(*(int*)valdict_getn(counters, "cd", 1) == 1);
+    valdict_clear(counters);
+    assert(valdict_count(counters) == 0 && valdict_get(counters, "a") == NULL);
+    valdict_destroy(counters);
+    assert(valdict_make_(0) == NULL);
+    puts("valdict tests: ok");
+}
+
+static void strset_tests(void) {
+    puts("Running strset tests:");
+    bool succeeded = false;
+    strset_t_ *evens = strset_make();
+    strset_t_ *thirds = strset_make();
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), i % 2 ? "%d" : "a much longer key than inline ones %d", i);
+        if (i % 2 == 0) {
+            succeeded = strset_add(evens, buf);
+            assert(succeeded);
+        }
+        if (i % 3 == 0) {
+            succeeded = strset_add(thirds, buf) && strset_add(thirds, buf);
+            assert(succeeded);
+        }
+    }
+    assert(strset_count(evens) == TEST_ITEMS_COUNT / 2);
+    assert(strset_count(thirds) == (TEST_ITEMS_COUNT + 2) / 3);
+    assert(strset_contains(evens, "a much longer key than inline ones 0"));
+    assert(strset_containsn(thirds, "3 and more", 1));
+    assert(strset_contains(evens, "1") == false);
+
+    strset_t_ *united = strset_union(evens, thirds);
+    strset_t_ *common = strset_intersection(evens, thirds);
+    strset_t_ *only_evens = strset_difference(evens, thirds);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), i % 2 ? "%d" : "a much longer key than inline ones %d", i);
+        bool even = i % 2 == 0;
+        bool third = i % 3 == 0;
+        assert(strset_contains(united, buf) == (even || third));
+        assert(strset_contains(common, buf) == (even && third));
+        assert(strset_contains(only_evens, buf) == (even && !third));
+    }
+    unsigned int iterated = 0;
+    unsigned int cursor = 0;
+    const char *key = NULL;
+    while ((key = strset_next(common, &cursor))) {
+        assert(atoi(key + strlen("a much longer key than inline ones ")) % 6 == 0);
+        iterated++;
+    }
+    assert(iterated == strset_count(common));
+
+    // removal leaves tombstones, which rehashing in place has to drop
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "a much longer key than inline ones %d", i);
+            succeeded = strset_remove(evens, buf);
+            assert(succeeded);
+            succeeded = strset_remove(evens, buf);
+            assert(succeeded == false);
+            succeeded = strset_add(evens, buf);
+            assert(succeeded);
+        }
+    }
+    dict_stats_t stats;
+    strset_get_stats(evens, &stats);
+    assert(stats.count == TEST_ITEMS_COUNT / 2 && stats.values_bytes == 0 && stats.cell_ixs_bytes == 0);
+    assert(stats.cell_capacity <= 2 * (unsigned int)(TEST_ITEMS_COUNT / 2 / 0.7f));
+    strset_clear(evens);
+    assert(strset_count(evens) == 0 && strset_contains(evens, "a much longer key than inline ones 0") == false);
+
+    strset_destroy(evens);
+    strset_destroy(thirds);
+    strset_destroy(united);
+    strset_destroy(common);
+    strset_destroy(only_evens);
+    puts("strset tests: ok");
+}
+
+static void ptrset_tests(void) {
+    puts("Running ptrset tests:");
+    bool succeeded = false;
+    static int items[TEST_ITEMS_COUNT];
+    ptrset_t_ *evens = ptrset_make();
+    ptrset_t_ *thirds = ptrset_make_with_capacity(TEST_ITEMS_COUNT / 3);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        if (i % 2 == 0) {
+            succeeded = ptrset_add(evens, &items[i]);
+            assert(succeeded);
+        }
+        if (i % 3 == 0) {
+            succeeded = ptrset_add(thirds, &items[i]) && ptrset_add(thirds, &items[i]);
+            assert(succeeded);
+        }
+    }
+    succeeded = ptrset_add(evens, NULL);
+    assert(succeeded == false && ptrset_contains(evens, NULL) == false);
+    assert(ptrset_count(evens) == TEST_ITEMS_COUNT / 2);
+    ptrset_t_ *united = ptrset_union(evens, thirds);
+    ptrset_t_ *common = ptrset_intersection(evens, thirds);
+    ptrset_t_ *only_evens = ptrset_difference(evens, thirds);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        bool even = i % 2 == 0;
+        bool third = i % 3 == 0;
+        assert(ptrset_contains(united, &items[i]) == (even || third));
+        assert(ptrset_contains(common, &items[i]) == (even && third));
+        assert(ptrset_contains(only_evens, &items[i]) == (even && !third));
+    }
+    unsigned int iterated = 0;
+    unsigned int cursor = 0;
+    int *item = NULL;
+    while ((item = ptrset_next(common, &cursor))) {
+        assert((item - items) % 6 == 0);
+        iterated++;
+    }
+    assert(iterated == ptrset_count(common));
+    for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+        if (i % 4 == 0) {
+            succeeded = ptrset_remove(evens, &items[i]);
+            assert(succeeded);
+        }
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+        assert(ptrset_contains(evens, &items[i]) == (i % 4 != 0));
+    }
+    dict_stats_t stats;
+    ptrset_get_stats(evens, &stats);
+    assert(stats.count == ptrset_count(evens) && stats.total_bytes > stats.cells_bytes);
+    ptrset_destroy(evens);
+    ptrset_destroy(thirds);
+    ptrset_destroy(united);
+    ptrset_destroy(common);
+    ptrset_destroy(only_evens);
+    puts("ptrset tests: ok");
+}
+
+static void cdict_tests(void) {
+    puts("Running cdict tests:");
+    bool succeeded = false;
+    cdict(int) *dict = cdict_make(0);
+    test_thread_t threads[CDICT_TEST_THREADS];
+    cdict_test_thread_t thread_args[CDICT_TEST_THREADS];
+    for (int i = 0; i < CDICT_TEST_THREADS; i++) {
+        thread_args[i].dict = dict;
+        thread_args[i].thread_ix = i;
+        succeeded = test_thread_start(&threads[i], cdict_test_thread, &thread_args[i]);
+        assert(succeeded);
+    }
+    for (int i = 0; i < CDICT_TEST_THREADS; i++) {
+        test_thread_join(threads[i]);
+    }
+    assert(cdict_count(dict) == CDICT_TEST_THREADS * CDICT_TEST_ITEMS_PER_THREAD / 2);
+    for (int i = 0; i < CDICT_TEST_THREADS * CDICT_TEST_ITEMS_PER_THREAD; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        int *val = cdict_getn(dict, buf, strlen(buf));
+        assert(i % 2 == 0 ? val == NULL : (val && *val == i));
+    }
+    dict_key_t key = dict_key_make(NULL, "1", 1);
+    assert(cdict_get_with_key(dict, &key) != NULL);
+    cdict_clear(dict);
+    assert(cdict_count(dict) == 0);
+    cdict_destroy(dict);
+    puts("cdict tests: ok");
+}
+
+static void frozendict_tests(void) {
+    puts("Running frozendict tests:");
+    static int values[TEST_ITEMS_COUNT];
+    dict(int) *dict = dict_make();
+    frozendict(int) *frozen = frozendict_make(dict);
+    assert(frozen && frozendict_count(frozen) == 0);
+    assert(frozendict_get(frozen, "0") == NULL);
+    frozendict_destroy(frozen);
+
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        dict_set(dict, buf, &values[i]);
+    }
+    frozen = frozendict_make(dict);
+    assert(frozen && frozendict_count(frozen) == TEST_ITEMS_COUNT);
+    for (int i = 0; i < TEST_ITEMS_COUNT * 2; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        int *val = frozendict_get(frozen, buf);
+        assert(i < TEST_ITEMS_COUNT ? (val && *val == i) : val == NULL);
+    }
+    for (unsigned int i = 0; i < frozendict_count(frozen); i++) {
+        const char *key = frozendict_get_key_at(frozen, i);
+        assert(frozendict_get_value_at(frozen, i) == dict_get(dict, key));
+    }
+    assert(frozendict_getn(frozen, "12345678", 3) == &values[123]);
+    assert(frozendict_getn(frozen, "12", 1) == &values[1]);
+
+    dict_stats_t dict_stats;
+    dict_stats_t frozen_stats;
+    dict_get_stats(dict, &dict_stats);
+    frozendict_get_stats(frozen, &frozen_stats);
+    assert(frozen_stats.total_bytes < dict_stats.total_bytes);
+    frozendict_destroy(frozen);
+
+    // colliding hashes make the build fall back to rehashing keys with a new seed
+    dict_set_hash_fn(dict, dict_hash_djb2, 0);
+    dict_clear(dict);
+    dict_set(dict, "Aa", &values[0]);
+    dict_set(dict, "B@", &values[1]);
+    dict_set(dict, "AaB@", &values[2]);
+    dict_set(dict, "B@Aa", &values[3]);
+    frozen = frozendict_make(dict);
+    assert(frozendict_get(frozen, "Aa") == &values[0] && frozendict_get(frozen, "B@") == &values[1]);
+    assert(frozendict_get(frozen, "AaB@") == &values[2] && frozendict_get(frozen, "B@Aa") == &values[3]);
+    frozendict_destroy(frozen);
+    dict_destroy(dict);
+    puts("frozendict tests: ok");
+}
+
+static const void *dict_snapshot_test_int_value(void *value, size_t *out_size, void *ctx) {
+    (void)ctx;
+    *out_size = sizeof(int);
+    return value;
+}
+
+static void dict_snapshot_tests(void) {
+    puts("Running dict snapshot tests:");
+    bool succeeded = false;
+    const char *path = "cutils_snapshot_test.bin";
+    static int values[TEST_ITEMS_COUNT];
+    dict(char) *strings = dict_make();
+    dict_set(strings, "lorem", "ipsum");
+    dict_set(strings, "dolor", "");
+    dict_set(strings, "sit", NULL);
+    succeeded = dict_snapshot_write(strings, path, NULL, NULL);
+    assert(succeeded);
+    dict_snapshot_t *snapshot = dict_snapshot_open(path);
+    assert(snapshot && dict_snapshot_count(snapshot) == 3);
+    assert(strcmp(dict_snapshot_get(snapshot, "lorem"), "ipsum") == 0);
+    assert(strcmp(dict_snapshot_get(snapshot, "dolor"), "") == 0);
+    size_t size = 1;
+    assert(dict_snapshot_getn(snapshot, "sit", 3, &size) == NULL && size == 0);
+    assert(dict_snapshot_get(snapshot, "sit") == NULL && dict_get(strings, "sit") == NULL);
+    for (unsigned int i = 0; i < dict_snapshot_count(snapshot); i++) {
+        const char *key = dict_snapshot_get_key_at(snapshot, i);
+        assert((dict_snapshot_get_value_at(snapshot, i) == NULL) == (strcmp(key, "sit") == 0));
+    }
+    assert(dict_snapshot_get(snapshot, "amet") == NULL);
+
+    // rewriting replaces the file, readers of the old one keep their data
+    dict_set(strings, "lorem", "replaced");
+    succeeded = dict_snapshot_write(strings, path, NULL, NULL);
+    assert(succeeded);
+    assert(strcmp(dict_snapshot_get(snapshot, "lorem"), "ipsum") == 0);
+    dict_snapshot_close(snapshot);
+    snapshot = dict_snapshot_open(path);
+    assert(snapshot && strcmp(dict_snapshot_get(snapshot, "lorem"), "replaced") == 0);
+    dict_snapshot_close(snapshot);
+    char tmp_path[160];
+#if !defined(_WIN32) // temp files are named by pid where snapshots are mapped
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid());
+#else
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+#endif
+    FILE *tmp_fp = fopen(tmp_path, "rb");
+    assert(tmp_fp == NULL);
+    succeeded = dict_snapshot_write(strings, "/nonexistent_dir/snapshot.bin", NULL, NULL);
+    assert(succeeded == false);
+    dict_destroy(strings);
+
+    dict(int) *dict = dict_make();
+    dict_set_hash_fn(dict, dict_hash_djb2, 0);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        values[i] = i;
+        dict_set(dict, buf, &values[i]);
+    }
+    succeeded = dict_snapshot_write(dict, path, dict_snapshot_test_int_value, NULL);
+    assert(succeeded);
+    snapshot = dict_snapshot_open(path);
+    assert(snapshot && dict_snapshot_count(snapshot) == TEST_ITEMS_COUNT);
+    for (int i = 0; i < TEST_ITEMS_COUNT * 2; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%d", i);
+        const int *val = dict_snapshot_get(snapshot, buf);
+        assert(i < TEST_ITEMS_COUNT ? (val && *val == i) : val == NULL);
+    }
+    for (unsigned int i = 0; i < dict_snapshot_count(snapshot); i++) {
+        const char *key = dict_snapshot_get_key_at(snapshot, i);
+        const int *val = dict_snapshot_get_value_at(snapshot, i);
+        assert(*val == *(int*)dict_get(dict, key));
+    }
+    dict_snapshot_close(snapshot);
+    dict_destroy(dict);
+
+    FILE *fp = fopen(path, "wb");
+    fputs("not a snapshot", fp);
+    fclose(fp);
+    assert(dict_snapshot_open(path) == NULL);
+    remove(path);
+    assert(dict_snapshot_open(path) == NULL);
+    puts("dict snapshot tests: ok");
+}
+
+static void pdict_test_count_item(const char *key, void *value, void *ctx) {
+    assert(strcmp(key, value) == 0);
+    (*(int*)ctx)++;
+}
+
+static test_thread_result_t TEST_THREAD_CALL pdict_test_reader_thread(void *arg) {
+    pdict(char) *snapshot = arg;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 2000; i++) {
+            char key[32];
+            sprintf(key, "%d", i);
+            char *value = pdict_get(snapshot, key);
+            assert(value && strcmp(value, key) == 0);
+        }
+    }
+    pdict_destroy(snapshot);
+    return 0;
+}
+
+static void pdict_tests(void) {
+    puts("Running pdict tests:");
+    bool succeeded = false;
+    static char keys[20000][32];
+    static char updated[] = "updated";
+    pdict(char) *dict = pdict_make();
+    for (int i = 0; i < 20000; i++) {
+        sprintf(keys[i], "%d", i);
+        succeeded = pdict_set(dict, keys[i], keys[i]);
+        assert(succeeded);
+    }
+    assert(pdict_count(dict) == 20000);
+    for (int i = 0; i < 20000; i++) {
+        assert(pdict_get(dict, keys[i]) == keys[i]);
+    }
+    succeeded = pdict_remove(dict, "missing");
+    assert(succeeded == false && pdict_get(dict, "missing") == NULL);
+
+    pdict(char) *snapshot = pdict_snapshot(dict);
+    dict_stats_t stats;
+    pdict_get_stats(dict, &stats);
+    size_t shared_bytes = stats.total_bytes;
+    for (int i = 0; i < 20000; i += 2) {
+        succeeded = pdict_remove(dict, keys[i]);
+        assert(succeeded);
+    }
+    succeeded = pdict_set(dict, keys[1], updated) && pdict_set(dict, "added", "added");
+    assert(succeeded);
+    assert(pdict_count(dict) == 10001 && pdict_count(snapshot) == 20000);
+    for (int i = 0; i < 20000; i++) {
+        assert(pdict_get(snapshot, keys[i]) == keys[i]);
+        assert(pdict_get(dict, keys[i]) == (i % 2 == 0 ? NULL : (i == 1 ? updated : keys[i])));
+    }
+    assert(pdict_get(snapshot, "added") == NULL && pdict_contains(dict, "added"));
+    pdict_destroy(dict);
+    int count = 0;
+    pdict_foreach(snapshot, pdict_test_count_item, &count);
+    assert(count == 20000);
+
+    // updating a value copies one node per level and no keys
+    dict = pdict_snapshot(snapshot);
+    succeeded = pdict_set(dict, keys[0], updated);
+    assert(succeeded);
+    pdict_get_stats(dict, &stats);
+    assert(stats.total_bytes == shared_bytes);
+    assert(pdict_get(dict, keys[0]) == updated && pdict_get(snapshot, keys[0]) == keys[0]);
+    pdict_destroy(snapshot);
+    for (int i = 0; i < 20000; i++) {
+        succeeded = pdict_remove(dict, keys[i]);
+        assert(succeeded);
+    }
+    pdict_get_stats(dict, &stats);
+    assert(pdict_count(dict) == 0 && stats.max_displacement == 0);
+    pdict_destroy(dict);
+
+    // readers drop snapshots while the writer keeps modifying
+    dict = pdict_make();
+    for (int i = 0; i < 2000; i++) {
+        pdict_set(dict, keys[i], keys[i]);
+    }
+    test_thread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        succeeded = test_thread_start(&threads[i], pdict_test_reader_thread, pdict_snapshot(dict));
+        assert(succeeded);
+    }
+    for (int i = 0; i < 2000; i++) {
+        succeeded = pdict_remove(dict, keys[i]) && pdict_set(dict, keys[i + 2000], keys[i + 2000]);
+        assert(succeeded);
+    }
+    for (int i = 0; i < 4; i++) {
+        test_thread_join(threads[i]);
+    }
+    pdict_destroy(dict);
+
+    dict_t_ *source = dict_make();
+    dict_set(source, "a", "a");
+    dict_set(source, "b", "b");
+    dict = pdict_make_from_dict(source);
+    assert(pdict_count(dict) == 2 && strcmp(pdict_get(dict, "b"), "b") == 0);
+    pdict_destroy(dict);
+    dict_destroy(source);
+    puts("pdict tests: ok");
+}
+
+static void cache_tests(void) {
+    puts("Running cache tests:");
+    bool succeeded = false;
+    char *value = NULL;
+    static char keys[1000][32];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(keys[i], i % 2 ? "%d" : "cache_test_long_key_%d", i);
+    }
+    int evicted_count = 0;
+    cache(char) *cache = cache_make(100, 0);
+    cache_set_evict_fn(cache, cache_test_count_evicted, &evicted_count);
+    for (int i = 0; i < 100; i++) {
+        succeeded = cache_set(cache, keys[i], keys[i], 0);
+        assert(succeeded);
+    }
+    assert(cache_count(cache) == 100 && evicted_count == 0);
+    for (int i = 0; i < 10; i++) {
+        value = cache_get(cache, keys[i]); // referenced keys survive the next sweep
+        assert(value == keys[i]);
+    }
+    for (int i = 100; i < 190; i++) {
+        succeeded = cache_set(cache, keys[i], keys[i], 0);
+        assert(succeeded);
+        value = cache_get(cache, keys[i]);
+        assert(value == keys[i]);
+    }
+    assert(cache_count(cache) == 100 && evicted_count == 90);
+    for (int i = 0; i < 10; i++) {
+        assert(cache_peek(cache, keys[i]) == keys[i]);
+    }
+    for (int i = 10; i < 100; i++) {
+        assert(cache_peek(cache, keys[i]) == NULL);
+    }
+    succeeded = cache_set(cache, keys[0], keys[1], 0);
+    assert(succeeded && evicted_count == 91); // replaced value
+    succeeded = cache_remove(cache, keys[0]);
+    assert(succeeded && evicted_count == 92);
+    succeeded = cache_remove(cache, keys[0]);
+    assert(succeeded == false);
+    cache_stats_t stats;
+    cache_get_stats(cache, &stats);
+    assert(stats.count == 99 && stats.hits == 100 && stats.misses == 0 && stats.evictions == 90);
+    value = cache_get(cache, keys[0]);
+    assert(value == NULL);
+    cache_get_stats(cache, &stats);
+    assert(stats.misses == 1 && stats.hit_ratio > 0.98);
+    cache_clear(cache);
+    assert(cache_count(cache) == 0 && evicted_count == 191);
+    succeeded = cache_set(cache, keys[0], keys[0], 0);
+    assert(succeeded);
+    cache_destroy(cache);
+    assert(evicted_count == 192);
+
+    cache = cache_make(0, 1000);
+    succeeded = cache_set(cache, keys[0], keys[0], 1001);
+    assert(succeeded == false);
+    for (int i = 0; i < 1000; i++) {
+        succeeded = cache_set(cache, keys[i], keys[i], 10 + i % 20);
+        assert(succeeded);
+        assert(cache_bytes(cache) <= 1000);
+    }
+    collections_size_t count = cache_count(cache);
+    size_t bytes = 0;
+    for (int i = 0; i < 1000; i++) {
+        if (cache_peek(cache, keys[i])) {
+            bytes += 10 + i % 20;
+            count--;
+        }
+    }
+    assert(count == 0 && bytes == cache_bytes(cache) && bytes > 900);
+    succeeded = cache_set(cache, keys[999], keys[999], 1000);
+    assert(succeeded && cache_count(cache) == 1 && cache_bytes(cache) == 1000);
+    cache_destroy(cache);
+    assert(cache_make(0, 0) == NULL);
+    puts("cache tests: ok");
+}
+
+static void cache_test_count_evicted(const char *key, void *value, void *ctx) {
+    assert(key && value);
+    (*(int*)ctx)++;
+}
+
 static void array_tests() {
     puts("Running array tests:");
     array(int) *int_arr = array_make(int);
@@ -94,6 +1303,83 @@ static void array_tests() {
 
 }
 
+static void array_bulk_tests(void) {
+    puts("Running array bulk tests:");
+    bool succeeded = false;
+    int values[1000];
+    for (int i = 0; i < 1000; i++) {
+        values[i] = i;
+    }
+    array(int) *arr = array_make(int);
+    succeeded = array_addn(arr, values, 1000);
+    assert(succeeded && array_count(arr) == 1000);
+    succeeded = array_add_array(arr, arr); // source reallocated while copied
+    assert(succeeded && array_count(arr) == 2000);
+    for (int i = 0; i < 2000; i++) {
+        assert(*(int*)array_get(arr, i) == i % 1000);
+    }
+    succeeded = array_removen(arr, 1000, 1000);
+    assert(succeeded && array_count(arr) == 1000);
+    succeeded = array_removen(arr, 900, 101);
+    assert(succeeded == false);
+    succeeded = array_removen(arr, 1000, 0);
+    assert(succeeded);
+
+    succeeded = array_insertn(arr, 10, values, 5);
+    assert(succeeded && array_count(arr) == 1005);
+    for (int i = 0; i < 1005; i++) {
+        assert(*(int*)array_get(arr, i) == (i < 10 ? i : i < 15 ? i - 10 : i - 5));
+    }
+    succeeded = array_removen(arr, 10, 5);
+    assert(succeeded);
+    // inserting part of the array into itself, values straddle the insert position
+    succeeded = array_insertn(arr, 500, array_get(arr, 498), 4);
+    assert(succeeded && array_count(arr) == 1004);
+    int expected[] = { 497, 498, 499, 498, 499, 500, 501, 500, 501 };
+    for (int i = 0; i < 9; i++) {
+        assert(*(int*)array_get(arr, 497 + i) == expected[i]);
+    }
+    succeeded = array_removen(arr, 500, 4);
+    assert(succeeded);
+
+    succeeded = array_setn(arr, 990, values, 20);
+    assert(succeeded && array_count(arr) == 1010);
+    for (int i = 0; i < 1010; i++) {
+        assert(*(int*)array_get(arr, i) == (i < 990 ? i : i - 990));
+    }
+    succeeded = array_setn(arr, 1005, array_get(arr, 0), 1000);
+    assert(succeeded && array_count(arr) == 2005);
+    assert(*(int*)array_get(arr, 1005) == 0 && *(int*)array_get(arr, 1994) == 989 && *(int*)array_get(arr, 2004) == 9);
+
+    succeeded = array_resize(arr, 10);
+    assert(succeeded && array_count(arr) == 10);
+    succeeded = array_resize(arr, 20);
+    assert(succeeded && *(int*)array_get(arr, 19) == 0 && *(int*)array_get(arr, 9) == 9);
+    succeeded = array_reserve(arr, 100000);
+    assert(succeeded && array_count(arr) == 20);
+    int *data = array_data(arr);
+    succeeded = array_addn(arr, NULL, 99980);
+    assert(succeeded && array_data(arr) == data);
+    array_destroy(arr);
+
+    arr = array_make(int);
+    succeeded = array_set_growth(arr, 1.0f, 0, false);
+    assert(succeeded == false);
+    succeeded = array_set_growth(arr, 1.5f, 4096, true);
+    assert(succeeded);
+    for (int i = 0; i < 100000; i++) {
+        succeeded = array_add(arr, &i);
+        assert(succeeded);
+    }
+    succeeded = array_addn(arr, values, 1000);
+    assert(succeeded && array_count(arr) == 101000);
+    for (int i = 0; i < 101000; i++) {
+        assert(*(int*)array_get(arr, i) == (i < 100000 ? i : i - 100000));
+    }
+    array_destroy(arr);
+    puts("array bulk tests: ok");
+}
+
 static void ptrarray_tests() {
     puts("Running ptrarray tests:");
     ptrarray(int) *int_arr = ptrarray_make();
@@ -108,3 +1394,262 @@ static void ptrarray_tests() {
     }
     puts("ptrarray tests: ok");
 }
+
+static void smallarray_tests(void) {
+    puts("Running smallarray tests:");
+    bool succeeded = false;
+    smallarray(int, 4) ints;
+    smallarray_init(&ints);
+    for (int i = 0; i < 4; i++) {
+        succeeded = smallarray_add(&ints.base, &i);
+        assert(succeeded);
+    }
+    assert(smallarray_is_inline(&ints.base) && smallarray_data(&ints.base) == ints.items);
+
+    // inline items are found by offset, so copies of the containing struct work
+    struct { int id; smallarray(int, 4) children; } node, node_copy;
+    node.id = 1;
+    smallarray_init(&node.children);
+    succeeded = smallarray_addn(&node.children.base, ints.items, 3);
+    assert(succeeded);
+    memcpy(&node_copy, &node, sizeof(node));
+    memset(&node, 0, sizeof(node));
+    assert(smallarray_count(&node_copy.children.base) == 3 && *(int*)smallarray_get(&node_copy.children.base, 2) == 2);
+    assert(smallarray_data(&node_copy.children.base) == node_copy.children.items);
+
+    // self insert straddling the insert position while spilling to the heap
+    succeeded = smallarray_insertn(&ints.base, 2, smallarray_get(&ints.base, 1), 3);
+    assert(succeeded);
+    assert(smallarray_is_inline(&ints.base) == false && smallarray_count(&ints.base) == 7);
+    int expected[] = { 0, 1, 1, 2, 3, 2, 3 };
+    for (int i = 0; i < 7; i++) {
+        assert(*(int*)smallarray_get(&ints.base, i) == expected[i]);
+    }
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        succeeded = smallarray_add(&ints.base, &i);
+        assert(succeeded);
+    }
+    succeeded = smallarray_removen(&ints.base, 0, 7);
+    assert(succeeded && smallarray_count(&ints.base) == TEST_ITEMS_COUNT);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        assert(*(int*)smallarray_get(&ints.base, i) == i);
+    }
+    int last = 0;
+    succeeded = smallarray_pop(&ints.base, &last);
+    assert(succeeded && last == TEST_ITEMS_COUNT - 1);
+    assert(*(int*)smallarray_get_last(&ints.base) == TEST_ITEMS_COUNT - 2);
+    smallarray_deinit(&ints.base);
+    assert(smallarray_count(&ints.base) == 0 && smallarray_is_inline(&ints.base));
+    succeeded = smallarray_pop(&ints.base, NULL);
+    assert(succeeded == false && smallarray_get_last(&ints.base) == NULL);
+
+    smallarray(void*, 2) ptrs;
+    collections_arena_t_ *arena = collections_arena_make(0);
+    smallarray_init_with_allocator(&ptrs, collections_arena_allocator(arena));
+    static int values[100];
+    for (int i = 0; i < 100; i++) {
+        void *ptr = &values[i];
+        succeeded = smallarray_add(&ptrs.base, &ptr);
+        assert(succeeded);
+    }
+    assert(smallarray_is_inline(&ptrs.base) == false && collections_arena_used(arena) > 0);
+    for (int i = 0; i < 100; i++) {
+        assert(*(void**)smallarray_get(&ptrs.base, i) == &values[i]);
+    }
+    void *ptr = NULL;
+    succeeded = smallarray_set(&ptrs.base, 99, &ptr);
+    assert(succeeded && *(void**)smallarray_get(&ptrs.base, 99) == NULL);
+    smallarray_clear(&ptrs.base);
+    assert(smallarray_count(&ptrs.base) == 0);
+    succeeded = smallarray_reserve(&ptrs.base, 1000);
+    assert(succeeded);
+    smallarray_deinit(&ptrs.base);
+    collections_arena_destroy(arena);
+
+    array(int) *empty = array_make(int);
+    assert(array_data(empty) == NULL);
+    succeeded = array_addn(empty, NULL, 0) && array_removen(empty, 0, 0);
+    assert(succeeded);
+    succeeded = array_add(empty, &last);
+    assert(succeeded && *(int*)array_get(empty, 0) == last);
+    array_destroy(empty);
+    puts("smallarray tests: ok");
+}
+
+static void allocator_tests(void) {
+    puts("Running allocator tests:");
+    bool succeeded = false;
+    collections_arena_t_ *arena = collections_arena_make(4096);
+    const collections_allocator_t *allocator = collections_arena_allocator(arena);
+    static int values[TEST_ITEMS_COUNT];
+    for (int round = 0; round < 2; round++) {
+        dict(int) *dict = dict_make_with_allocator(0, allocator);
+        succeeded = dict_set_key_arena(dict, round == 1);
+        assert(succeeded);
+        for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "allocator_test_key_%d", i);
+            values[i] = i;
+            succeeded = dict_set(dict, buf, &values[i]);
+            assert(succeeded);
+        }
+        for (int i = 0; i < TEST_ITEMS_COUNT; i += 2) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "allocator_test_key_%d", i);
+            succeeded = dict_remove(dict, buf);
+            assert(succeeded);
+        }
+        for (int i = 1; i < TEST_ITEMS_COUNT; i += 2) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "allocator_test_key_%d", i);
+            int *val = dict_get(dict, buf);
+            assert(val && *val == i);
+        }
+        ptrdict(int, int) *ptrdict = ptrdict_make_with_allocator(0, allocator);
+        array(int) *arr = array_make_with_allocator(0, sizeof(int), allocator);
+        ptrarray(int) *ptrarr = ptrarray_make_with_allocator(0, allocator);
+        strbuf_t *buf = strbuf_make_with_allocator(0, allocator);
+        for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+            succeeded = ptrdict_set(ptrdict, &values[i], &values[i])
+                     && array_add(arr, &i)
+                     && ptrarray_add(ptrarr, &values[i])
+                     && strbuf_appendf(buf, "%d,", i % 10);
+            assert(succeeded);
+        }
+        for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+            assert(ptrdict_get(ptrdict, &values[i]) == &values[i]);
+            assert(*(int*)array_get(arr, i) == i);
+            assert(ptrarray_get(ptrarr, (unsigned int)i) == &values[i]);
+        }
+        const char *str = strbuf_get_string(buf);
+        assert(strlen(str) == TEST_ITEMS_COUNT * 2 && strncmp(str, "0,1,2,", 6) == 0);
+        assert(collections_arena_used(arena) > TEST_ITEMS_COUNT * (sizeof(int) + sizeof(void*)));
+        dict_destroy(dict);
+        ptrdict_destroy(ptrdict);
+        array_destroy(arr);
+        ptrarray_destroy(ptrarr);
+        strbuf_destroy(buf);
+        collections_arena_reset(arena);
+        assert(collections_arena_used(arena) == 0);
+    }
+    collections_arena_destroy(arena);
+
+    // block size that isn't a multiple of the alignment, last allocation grown to fill it
+    arena = collections_arena_make(100);
+    allocator = collections_arena_allocator(arena);
+    unsigned char *small = allocator->alloc(allocator->ctx, 1);
+    small = allocator->realloc(allocator->ctx, small, 1, 100);
+    assert(small);
+    memset(small, 1, 100);
+    unsigned char *next = allocator->alloc(allocator->ctx, 64);
+    assert(next && (next >= small + 100 || next + 64 <= small));
+    memset(next, 2, 64);
+    assert(small[99] == 1);
+    collections_arena_destroy(arena);
+
+    // everything allocated through a custom allocator is given back to it
+    long live_allocations = 0;
+    collections_allocator_t counting = { counting_alloc, counting_realloc, counting_free, &live_allocations };
+    dict(int) *dict = dict_make_with_allocator(0, &counting);
+    succeeded = dict_set_key_arena(dict, true);
+    assert(succeeded);
+    array(int) *arr = array_make_with_allocator(0, sizeof(int), &counting);
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "counting_allocator_test_key_%d", i);
+        succeeded = dict_set(dict, buf, &values[i]) && array_add(arr, &i);
+        assert(succeeded);
+        if (i % 3 == 0) {
+            succeeded = dict_remove(dict, buf);
+            assert(succeeded);
+        }
+    }
+    succeeded = dict_set_key_arena(dict, false);
+    assert(succeeded && live_allocations > 0);
+    dict_destroy(dict);
+    array_destroy(arr);
+    assert(live_allocations == 0);
+
+    // same for every other container that takes an allocator
+    valdict(int) *vdict = valdict_make_with_allocator(0, sizeof(int), &counting);
+    strset_t_ *set_a = strset_make_with_allocator(0, &counting);
+    strset_t_ *set_b = strset_make_with_allocator(0, &counting);
+    ptrset_t_ *pset = ptrset_make_with_allocator(0, &counting);
+    cdict(int) *cdict = cdict_make_with_allocator(0, &counting);
+    pdict(int) *pdict = pdict_make_with_allocator(&counting);
+    bloom_t_ *bloom = bloom_make_with_allocator(TEST_ITEMS_COUNT, 0, &counting);
+    cache(int) *cache = cache_make_with_allocator(0, TEST_ITEMS_COUNT * sizeof(int), &counting);
+    dict = dict_make_with_allocator(0, &counting);
+    succeeded = dict_set_bloom_filter(dict, true);
+    assert(succeeded);
+    pdict_t_ *snapshots[4];
+    int snapshot_count = 0;
+    for (int i = 0; i < TEST_ITEMS_COUNT; i++) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "counting_allocator_test_key_%d", i);
+        succeeded = valdict_set(vdict, buf, &i)
+                 && strset_add(i % 2 ? set_a : set_b, buf)
+                 && ptrset_add(pset, &values[i])
+                 && cdict_set(cdict, buf, &values[i])
+                 && pdict_set(pdict, buf, &values[i])
+                 && cache_set(cache, buf, &values[i], 2 * sizeof(int))
+                 && dict_set(dict, buf, &values[i]);
+        assert(succeeded);
+        bloom_add(bloom, buf);
+        if (i % 3 == 0) {
+            succeeded = pdict_remove(pdict, buf);
+            assert(succeeded);
+        }
+        if (i % (TEST_ITEMS_COUNT / 4) == 0 && snapshot_count < 4) {
+            snapshots[snapshot_count++] = pdict_snapshot(pdict);
+        }
+    }
+    strset_t_ *set_union = strset_union(set_a, set_b);
+    assert(set_union && strset_count(set_union) == TEST_ITEMS_COUNT);
+    frozendict(int) *frozen = frozendict_make_with_allocator(dict, &counting);
+    assert(frozen && frozendict_count(frozen) == TEST_ITEMS_COUNT);
+    const char *path = "cutils_allocator_snapshot_test.bin";
+    succeeded = dict_snapshot_write(dict, path, dict_snapshot_test_int_value, NULL);
+    assert(succeeded);
+    dict_snapshot_t *snapshot = dict_snapshot_open_with_allocator(path, &counting);
+    assert(snapshot && dict_snapshot_count(snapshot) == TEST_ITEMS_COUNT);
+    assert(live_allocations > 0);
+    valdict_destroy(vdict);
+    strset_destroy(set_a);
+    strset_destroy(set_b);
+    strset_destroy(set_union);
+    ptrset_destroy(pset);
+    cdict_destroy(cdict);
+    for (int i = 0; i < snapshot_count; i++) {
+        pdict_destroy(snapshots[i]);
+    }
+    pdict_destroy(pdict);
+    bloom_destroy(bloom);
+    cache_destroy(cache);
+    frozendict_destroy(frozen);
+    dict_destroy(dict);
+    dict_snapshot_close(snapshot);
+    remove(path);
+    assert(live_allocations == 0);
+    puts("allocator tests: ok");
+}
+
+static void *counting_alloc(void *ctx, size_t size) {
+    (*(long*)ctx)++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    (void)old_size;
+    if (ptr == NULL) {
+        (*(long*)ctx)++;
+    }
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void *ctx, void *ptr) {
+    if (ptr) {
+        (*(long*)ctx)--;
+    }
+    free(ptr);
+}